@@ -0,0 +1,22 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <string>
+#include <vector>
+
+namespace Bench {
+/** Arguments of a benchmark (the ones after its name). */
+using Args = std::vector<std::string>;
+
+void transfer(const Args& args);
+void receive(const Args& args);
+void messages(const Args& args);
+void hash(const Args& args);
+void rwlock(const Args& args);
+void rcu(const Args& args);
+void flat_map(const Args& args);
+void load(const Args& args);
+void micro(const Args& args);
+}  // namespace Bench
+
+#endif
@@ -0,0 +1,82 @@
+#include <malloc.h>
+#include <chrono>
+#include <cinttypes>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include "bench.h"
+#include "server_flat_map.h"
+
+/** lookups timed for each map */
+#define LOOKUPS 1000000
+
+/**
+ * @brief Gets the bytes allocated with malloc and not freed yet (large
+ * blocks are mapped apart, and counted apart).
+ */
+static std::size_t allocated() {
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+/**
+ * @brief Fills a map with ids as keys and file names as values (like
+ * `FileIndex::Shard::files`), then looks up random ids, half of them
+ * missing. Prints the lookups per second and the bytes per entry.
+ */
+template <class Map>
+static void measure(const char* name, uint32_t entries) {
+    std::size_t before = allocated();
+    std::size_t found = 0;
+    double seconds;
+    {
+        Map map;
+        for (uint32_t id = 0; id < entries; id++) {
+            /* short enough to be stored in the std::string itself */
+            map.emplace(id, "file" + std::to_string(id % 1000000));
+        }
+        std::size_t bytes = allocated() - before;
+
+        std::mt19937 random{entries};
+        std::uniform_int_distribution<uint32_t> ids{0, entries * 2 - 1};
+        std::vector<uint32_t> keys(LOOKUPS);
+        for (uint32_t& key : keys) {
+            key = ids(random);
+        }
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t key : keys) {
+            found += map.find(key) != map.end();
+        }
+        seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+
+        std::cout << name << ": entries=" << entries
+                  << " lookups/s=" << static_cast<uint64_t>(LOOKUPS / seconds)
+                  << " bytes/entry=" << bytes / entries
+                  << " found=" << found << std::endl;
+    }
+}
+
+/**
+ * @brief Compares lookups in a std::map and in a FlatMap (as used by the
+ * indexes) of the given sizes.
+ * Arguments: `[entries...]` (1M and 10M by default).
+ *
+ * @param args Benchmark arguments.
+ */
+void Bench::flat_map(const Bench::Args& args) {
+    std::vector<uint32_t> sizes = {1000000, 10000000};
+    if (!args.empty()) {
+        sizes.clear();
+        for (const std::string& arg : args) {
+            sizes.push_back(std::stoul(arg));
+        }
+    }
+    for (uint32_t entries : sizes) {
+        measure<std::map<uint32_t, std::string>>("std::map", entries);
+        measure<Server::FlatMap<uint32_t, std::string>>("FlatMap", entries);
+    }
+}
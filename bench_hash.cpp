@@ -0,0 +1,47 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "bench.h"
+#include "common_sha256.h"
+
+/**
+ * @brief Measures the SHA-256 throughput of the portable and the hardware
+ * accelerated implementations (when the CPU has one).
+ * Arguments: `[size in MiB = 256]`.
+ *
+ * @param args Benchmark arguments.
+ */
+void Bench::hash(const Bench::Args& args) {
+    uint64_t size_mib = args.size() > 0 ? std::stoul(args[0]) : 256;
+
+    std::vector<char> data(1024 * 1024);
+    for (std::size_t i = 0; i < data.size(); i++) {
+        data[i] = static_cast<char>(rand());
+    }
+
+    std::string digests[2];
+    for (int accelerated = 0; accelerated < 2; accelerated++) {
+        Digest::Sha256::set_accelerated(accelerated);
+        if (accelerated && !Digest::Sha256::accelerated()) {
+            std::cout << "accelerated: no disponible en este CPU" << std::endl;
+            break;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        Digest::Sha256 sha;
+        for (uint64_t i = 0; i < size_mib; i++) {
+            sha.update(data.data(), data.size());
+        }
+        digests[accelerated] = sha.hex_digest();
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        std::cout << (accelerated ? "accelerated" : "portable   ")
+                  << ": size=" << size_mib << "MiB"
+                  << " rate=" << size_mib / elapsed.count() << "MiB/s"
+                  << " digest=" << digests[accelerated] << std::endl;
+    }
+    Digest::Sha256::set_accelerated(true);
+}
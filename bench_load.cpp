@@ -0,0 +1,446 @@
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "bench.h"
+#include "client_versioner.h"
+#include "common_comm_socket.h"
+#include "common_error.h"
+#include "common_sha256.h"
+
+/** prefix of the files pushed and pulled, in the current directory */
+#define LOAD_FILE_PREFIX "bench_load_"
+/** size of the random data the files are cut from */
+#define LOAD_DATA_SIZE (1 << 20)
+
+namespace {
+enum Command { PUSH, TAG, PULL, NUM_COMMANDS };
+
+const char* const COMMAND_NAMES[NUM_COMMANDS] = {"push", "tag", "pull"};
+
+/**
+ * @brief Workload, from the arguments `<host> <port> [--name=value...]`.
+ */
+struct LoadOptions {
+    std::string host;
+    std::string port;
+    /** Concurrent clients (`--threads=N`). */
+    unsigned threads{8};
+    /** Length of the run (`--seconds=N`). */
+    unsigned seconds{10};
+    /** Weight of each command (`--mix=push:70,tag:10,pull:20`). */
+    unsigned weights[NUM_COMMANDS]{70, 10, 20};
+    /** Median size of the pushed files (`--median=BYTES`); sizes follow a
+     * log-normal distribution, most files are small and a few are large. */
+    uint64_t median_size{16 * 1024};
+    /** Largest pushed file (`--max=BYTES`). */
+    uint64_t max_size{16 * 1024 * 1024};
+    /** Files per tag (`--tag-files=N`). */
+    unsigned tag_files{8};
+    /** Where to write the results as JSON (`--results=FILE`), if given. */
+    std::string results;
+};
+
+/**
+ * @brief What the clients measured.
+ */
+struct LoadResults {
+    /**
+     * Latency of every command that succeeded, in us, sorted once the run
+     * is over. Each client keeps its own and adds them at the end, and the
+     * percentiles are taken from all of them (see `percentile`).
+     */
+    std::vector<uint64_t> latency[NUM_COMMANDS];
+    std::mutex latency_mutex;
+    std::atomic<uint64_t> errors[NUM_COMMANDS];
+    /** Bytes of the files pushed and pulled. */
+    std::atomic<uint64_t> bytes[NUM_COMMANDS];
+
+    LoadResults() {
+        for (int i = 0; i < NUM_COMMANDS; i++) {
+            this->errors[i].store(0);
+            this->bytes[i].store(0);
+        }
+    }
+
+    /**
+     * @brief Adds the latencies measured by a client.
+     */
+    void add_latency(const std::vector<uint64_t> (&samples)[NUM_COMMANDS]) {
+        std::lock_guard<std::mutex> lock(this->latency_mutex);
+        for (int i = 0; i < NUM_COMMANDS; i++) {
+            this->latency[i].insert(this->latency[i].end(),
+                                    samples[i].begin(), samples[i].end());
+        }
+    }
+};
+
+/**
+ * @brief Gets a percentile of sorted values (nearest rank).
+ *
+ * @param sorted Values, in increasing order.
+ * @param p Fraction of the values, in (0, 1].
+ * @return The smallest value with at least `p` of them at or below it, or
+ * 0 if there are none.
+ */
+uint64_t percentile(const std::vector<uint64_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    std::size_t rank = std::ceil(p * sorted.size());
+    return sorted[std::max<std::size_t>(rank, 1) - 1];
+}
+
+/**
+ * @brief Gets the largest of sorted values, or 0 if there are none.
+ */
+uint64_t max_of(const std::vector<uint64_t>& sorted) {
+    return sorted.empty() ? 0 : sorted.back();
+}
+
+/**
+ * @brief Parses the arguments of the benchmark.
+ */
+LoadOptions parse_options(const Bench::Args& args) {
+    if (args.size() < 2) {
+        throw Error::Error{
+            "uso: bench load <host> <puerto> [--threads=N] [--seconds=N] "
+            "[--mix=push:P,tag:T,pull:L] [--median=BYTES] [--max=BYTES] "
+            "[--tag-files=N] [--results=ARCHIVO]"};
+    }
+    LoadOptions options;
+    options.host = args[0];
+    options.port = args[1];
+    for (std::size_t i = 2; i < args.size(); i++) {
+        const std::string& option = args[i];
+        std::size_t eq = option.find('=');
+        if (option.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+            throw Error::Error{"opcion invalida: %s", option.c_str()};
+        }
+        std::string name = option.substr(2, eq - 2);
+        std::string value = option.substr(eq + 1);
+        if (name == "threads") {
+            options.threads = std::stoul(value);
+        } else if (name == "seconds") {
+            options.seconds = std::stoul(value);
+        } else if (name == "median") {
+            options.median_size = std::stoull(value);
+        } else if (name == "max") {
+            options.max_size = std::stoull(value);
+        } else if (name == "tag-files") {
+            options.tag_files = std::stoul(value);
+        } else if (name == "results") {
+            options.results = value;
+        } else if (name == "mix") {
+            std::fill(options.weights, options.weights + NUM_COMMANDS, 0);
+            std::istringstream entries{value};
+            std::string entry;
+            while (std::getline(entries, entry, ',')) {
+                std::size_t colon = entry.find(':');
+                auto command = std::find(COMMAND_NAMES,
+                                         COMMAND_NAMES + NUM_COMMANDS,
+                                         entry.substr(0, colon));
+                if (colon == std::string::npos ||
+                    command == COMMAND_NAMES + NUM_COMMANDS) {
+                    throw Error::Error{"opcion invalida: %s",
+                                       option.c_str()};
+                }
+                options.weights[command - COMMAND_NAMES] =
+                    std::stoul(entry.substr(colon + 1));
+            }
+        } else {
+            throw Error::Error{"opcion invalida: %s", option.c_str()};
+        }
+    }
+    if (options.threads == 0 || options.tag_files == 0 ||
+        options.median_size == 0 || options.max_size == 0 ||
+        options.weights[PUSH] == 0) {
+        throw Error::Error{"Error: argumentos invalidos."};
+    }
+    return options;
+}
+
+/**
+ * @brief A client that runs commands, picked at random by their weight,
+ * until it is told to stop. Each command goes through a new connection,
+ * like the `client` program does.
+ */
+class LoadClient {
+   public:
+    LoadClient(const LoadOptions& options, LoadResults& results,
+               const std::string& data, unsigned id)
+        : options(options),
+          results(results),
+          data(data),
+          prefix(LOAD_FILE_PREFIX + std::to_string(getpid()) + "_" +
+                 std::to_string(id) + "_"),
+          random(id),
+          commands(options.weights, options.weights + NUM_COMMANDS),
+          sizes(std::log(options.median_size), 1.5) {
+    }
+
+    void run(const std::atomic<bool>& running) {
+        while (running) {
+            Command command = static_cast<Command>(this->commands(random));
+            /* tags need pushed files, and pulls need tags */
+            if (command == PULL && this->tags.empty()) {
+                command = TAG;
+            }
+            if (command == TAG && this->untagged.empty()) {
+                command = PUSH;
+            }
+            switch (command) {
+                case PUSH:
+                    this->push();
+                    break;
+                case TAG:
+                    this->tag();
+                    break;
+                default:
+                    this->pull();
+                    break;
+            }
+        }
+        this->results.add_latency(this->latency);
+    }
+
+   private:
+    /** A tag made by this client, and its files. */
+    struct Tag {
+        std::string name;
+        std::vector<std::string> files;
+        uint64_t bytes;
+    };
+
+    /** A pushed file. */
+    struct File {
+        std::string name;
+        std::string hash;
+        uint64_t size;
+    };
+
+    std::unique_ptr<IO::CommSocket> connect() {
+        std::unique_ptr<IO::CommSocket> comm{
+            new IO::CommSocket{this->options.host, this->options.port}};
+        if (!Client::Versioner::negotiate(*comm)) {
+            comm.reset(
+                new IO::CommSocket{this->options.host, this->options.port});
+        }
+        return comm;
+    }
+
+    /**
+     * @brief Runs a command and records its latency, or the error.
+     *
+     * @return false if it failed.
+     */
+    template <class Run>
+    bool measure(Command command, Run run) {
+        auto start = std::chrono::steady_clock::now();
+        try {
+            std::unique_ptr<IO::CommSocket> comm = this->connect();
+            Client::Versioner versioner{*comm};
+            run(versioner);
+        } catch (const std::exception& e) {
+            this->results.errors[command]++;
+            return false;
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        this->latency[command].push_back(
+            std::chrono::duration_cast<std::chrono::microseconds>(elapsed)
+                .count());
+        return true;
+    }
+
+    /**
+     * @brief Pushes a new file. It is written (and hashed) before the
+     * command starts, so only the command is measured.
+     */
+    void push() {
+        File file;
+        file.name = this->prefix + std::to_string(this->next++);
+        file.size = std::min<uint64_t>(
+            this->options.max_size,
+            std::max<uint64_t>(1, std::llround(this->sizes(this->random))));
+
+        /* starts with the name, so every file has its own hash */
+        Digest::Sha256 sha;
+        std::ofstream output{file.name, std::ios::binary};
+        output << file.name;
+        sha.update(file.name.data(), file.name.size());
+        uint64_t written = file.name.size();
+        while (written < file.size) {
+            std::size_t offset = this->random() % this->data.size();
+            std::size_t chunk = std::min<uint64_t>(
+                this->data.size() - offset, file.size - written);
+            output.write(this->data.data() + offset, chunk);
+            sha.update(this->data.data() + offset, chunk);
+            written += chunk;
+        }
+        output.close();
+        file.hash = sha.hex_digest();
+        file.size = written;
+
+        if (this->measure(PUSH, [&](Client::Versioner& versioner) {
+                versioner.push(file.name, file.hash);
+            })) {
+            this->results.bytes[PUSH] += file.size;
+            this->untagged.push_back(file);
+        }
+        unlink(file.name.c_str());
+    }
+
+    /**
+     * @brief Tags the files pushed since the previous tag (the latest ones,
+     * up to `tag_files`).
+     */
+    void tag() {
+        std::size_t count = std::min<std::size_t>(this->untagged.size(),
+                                                  this->options.tag_files);
+        Tag tag{this->prefix + "tag" + std::to_string(this->next++), {}, 0};
+        std::vector<std::string> hashes;
+        for (std::size_t i = this->untagged.size() - count;
+             i < this->untagged.size(); i++) {
+            tag.files.push_back(this->untagged[i].name);
+            tag.bytes += this->untagged[i].size;
+            hashes.push_back(this->untagged[i].hash);
+        }
+        this->untagged.clear();
+
+        if (this->measure(TAG, [&](Client::Versioner& versioner) {
+                versioner.tag(tag.name, hashes);
+            })) {
+            this->tags.push_back(std::move(tag));
+        }
+    }
+
+    /**
+     * @brief Pulls one of the tags made by this client, and removes the
+     * files it wrote.
+     */
+    void pull() {
+        const Tag& tag = this->tags[this->random() % this->tags.size()];
+        if (this->measure(PULL, [&](Client::Versioner& versioner) {
+                versioner.pull(tag.name);
+            })) {
+            this->results.bytes[PULL] += tag.bytes;
+        }
+        for (const std::string& file : tag.files) {
+            unlink((file + "." + tag.name).c_str());
+        }
+    }
+
+    const LoadOptions& options;
+    LoadResults& results;
+    const std::string& data;
+    const std::string prefix;
+    uint64_t next{0};
+    std::mt19937_64 random;
+    std::discrete_distribution<int> commands;
+    std::lognormal_distribution<double> sizes;
+
+    std::vector<File> untagged;
+    std::vector<Tag> tags;
+    /** Latency of each command, in us, until the run is over. */
+    std::vector<uint64_t> latency[NUM_COMMANDS];
+};
+
+/**
+ * @brief Writes the results as JSON, to compare them between builds.
+ */
+void write_results(const LoadOptions& options, const LoadResults& results,
+                   double seconds) {
+    std::ofstream output{options.results};
+    output << "{\"threads\": " << options.threads
+           << ", \"seconds\": " << seconds
+           << ", \"median_size\": " << options.median_size
+           << ", \"commands\": {";
+    for (int i = 0; i < NUM_COMMANDS; i++) {
+        const std::vector<uint64_t>& latency = results.latency[i];
+        output << (i > 0 ? ", " : "") << "\"" << COMMAND_NAMES[i]
+               << "\": {\"count\": " << latency.size()
+               << ", \"errors\": " << results.errors[i]
+               << ", \"per_second\": " << latency.size() / seconds
+               << ", \"bytes\": " << results.bytes[i]
+               << ", \"p50_us\": " << percentile(latency, 0.5)
+               << ", \"p99_us\": " << percentile(latency, 0.99)
+               << ", \"p999_us\": " << percentile(latency, 0.999)
+               << ", \"max_us\": " << max_of(latency) << "}";
+    }
+    output << "}}" << std::endl;
+    if (!output) {
+        throw Error::Error{"Error escribiendo %s", options.results.c_str()};
+    }
+}
+}  // namespace
+
+/**
+ * @brief Generates load on a running server: several clients push files
+ * of random sizes, tag them and pull the tags, in the given proportions.
+ * Reports the throughput and the latency percentiles of each command.
+ * Arguments: `<host> <port> [--threads=8] [--seconds=10]
+ * [--mix=push:70,tag:10,pull:20] [--median=16384] [--max=16777216]
+ * [--tag-files=8] [--results=FILE]`.
+ *
+ * @param args Benchmark arguments.
+ */
+void Bench::load(const Bench::Args& args) {
+    LoadOptions options = parse_options(args);
+
+    std::string data(LOAD_DATA_SIZE, '\0');
+    std::mt19937 random{0};
+    for (char& byte : data) {
+        byte = static_cast<char>(random());
+    }
+
+    LoadResults results;
+    std::atomic<bool> running{true};
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < options.threads; i++) {
+        threads.emplace_back([&, i] {
+            LoadClient client{options, results, data, i};
+            client.run(running);
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::seconds{options.seconds});
+    running = false;
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    for (std::vector<uint64_t>& latency : results.latency) {
+        std::sort(latency.begin(), latency.end());
+    }
+
+    std::cout << "threads=" << options.threads << " seconds=" << seconds
+              << std::endl;
+    for (int i = 0; i < NUM_COMMANDS; i++) {
+        const std::vector<uint64_t>& latency = results.latency[i];
+        std::cout << COMMAND_NAMES[i] << ": n=" << latency.size()
+                  << " errors=" << results.errors[i]
+                  << " ops/s=" << latency.size() / seconds
+                  << " MB/s=" << results.bytes[i] / seconds / 1e6
+                  << " p50=" << percentile(latency, 0.5) << "us"
+                  << " p99=" << percentile(latency, 0.99) << "us"
+                  << " p999=" << percentile(latency, 0.999) << "us"
+                  << " max=" << max_of(latency) << "us" << std::endl;
+    }
+    if (!options.results.empty()) {
+        write_results(options, results, seconds);
+    }
+}
@@ -0,0 +1,69 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bench.h"
+#include "common_histogram.h"
+#include "common_rw_lock.h"
+
+/**
+ * @brief Keeps the thread busy for a while, without sleeping.
+ */
+static void spin(std::chrono::microseconds duration) {
+    auto end = std::chrono::steady_clock::now() + duration;
+    while (std::chrono::steady_clock::now() < end) {
+    }
+}
+
+/**
+ * @brief Measures how long readers and writers wait for an RWLock under a
+ * steady stream of readers (like pulls) with an occasional writer (like a
+ * push or a tag).
+ * Arguments: `[readers = 8] [seconds = 2]`.
+ *
+ * @param args Benchmark arguments.
+ */
+void Bench::rwlock(const Bench::Args& args) {
+    unsigned num_readers = args.size() > 0 ? std::stoul(args[0]) : 8;
+    unsigned seconds = args.size() > 1 ? std::stoul(args[1]) : 2;
+
+    Concurrency::RWLock lock;
+    Stats::Histogram read_wait, write_wait;
+    lock.set_stats(&read_wait, &write_wait);
+
+    std::atomic<bool> running{true};
+    std::atomic<uint64_t> reads{0}, writes{0};
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < num_readers; i++) {
+        threads.emplace_back([&] {
+            while (running) {
+                Concurrency::ReadLock read{lock};
+                spin(std::chrono::microseconds{50});
+                reads++;
+            }
+        });
+    }
+    threads.emplace_back([&] {
+        while (running) {
+            {
+                Concurrency::WriteLock write{lock};
+                spin(std::chrono::microseconds{10});
+                writes++;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        }
+    });
+
+    std::this_thread::sleep_for(std::chrono::seconds{seconds});
+    running = false;
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    std::cout << "readers=" << num_readers << " reads=" << reads
+              << " writes=" << writes << std::endl;
+    read_wait.report(std::cout, "read wait", "us");
+    write_wait.report(std::cout, "write wait", "us");
+}
@@ -0,0 +1,37 @@
+#include <exception>
+#include <iostream>
+#include <map>
+#include <string>
+#include "bench.h"
+
+int main(int argc, const char* argv[]) {
+    /* available benchmarks */
+    const std::map<std::string, void (*)(const Bench::Args&)> benchmarks{
+        {"transfer", Bench::transfer},
+        {"receive", Bench::receive},
+        {"messages", Bench::messages},
+        {"hash", Bench::hash},
+        {"rwlock", Bench::rwlock},
+        {"rcu", Bench::rcu},
+        {"flatmap", Bench::flat_map},
+        {"load", Bench::load},
+        {"micro", Bench::micro},
+    };
+
+    if (argc < 2 || benchmarks.find(argv[1]) == benchmarks.end()) {
+        std::cout << "uso: bench <benchmark> [argumentos...]" << std::endl;
+        for (const auto& pair : benchmarks) {
+            std::cout << "  " << pair.first << std::endl;
+        }
+        return 0;
+    }
+
+    try {
+        Bench::Args args{argv + 2, argv + argc};
+        benchmarks.at(argv[1])(args);
+    } catch (const std::exception& e) {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bench.h"
+#include "common_comm_socket.h"
+#include "common_error.h"
+#include "common_socket.h"
+
+/** System calls made by one side of the connection. */
+struct Calls {
+    uint64_t sends{0};
+    uint64_t recvs{0};
+};
+
+/**
+ * @brief Server side: decodes tag-like requests (u8 id, u32 count, name and
+ * `count` hashes) and answers each one with a response code.
+ *
+ * @param server Listening socket.
+ * @param buffering Whether the CommSocket buffers are used.
+ * @param requests Number of requests to serve.
+ * @param calls Where the system calls made are stored.
+ */
+static void serve(IO::Socket& server, bool buffering, unsigned requests,
+                  Calls& calls) {
+    try {
+        IO::CommSocket comm{server.accept()};
+        comm.set_buffering(buffering);
+        for (unsigned i = 0; i < requests; i++) {
+            uint8_t id;
+            uint32_t count;
+            std::string name, hash;
+            comm >> id >> count >> name;
+            for (uint32_t j = 0; j < count; j++) {
+                comm >> hash;
+            }
+            comm << IO::Response::OK;
+        }
+        comm.flush();
+        calls.sends = comm.get_socket().get_send_calls();
+        calls.recvs = comm.get_socket().get_recv_calls();
+    } catch (const std::exception& e) {
+        std::cerr << "servidor: " << e.what() << std::endl;
+    }
+}
+
+/**
+ * @brief Measures the system calls and the time it takes to exchange tag
+ * requests with many hashes, with and without the CommSocket buffers.
+ * Arguments: `[hashes per request = 500] [requests = 1000] [port = 7655]`.
+ *
+ * @param args Benchmark arguments.
+ */
+void Bench::messages(const Bench::Args& args) {
+    unsigned num_hashes = args.size() > 0 ? std::stoul(args[0]) : 500;
+    unsigned requests = args.size() > 1 ? std::stoul(args[1]) : 1000;
+    std::string port = args.size() > 2 ? args[2] : "7655";
+
+    std::vector<std::string> hashes;
+    for (unsigned i = 0; i < num_hashes; i++) {
+        hashes.push_back(std::string(64, 'a' + i % 26));
+    }
+
+    IO::Socket server;
+    server.bind(port);
+    server.listen();
+
+    for (bool buffering : {false, true}) {
+        Calls server_calls;
+        std::thread thread{serve, std::ref(server), buffering, requests,
+                           std::ref(server_calls)};
+
+        Calls client_calls;
+        std::chrono::duration<double> elapsed{0};
+        try {
+            IO::CommSocket comm{"127.0.0.1", port};
+            comm.set_buffering(buffering);
+
+            auto start = std::chrono::steady_clock::now();
+            for (unsigned i = 0; i < requests; i++) {
+                comm << static_cast<uint8_t>(2) << num_hashes << "tag";
+                for (const std::string& hash : hashes) {
+                    comm << hash;
+                }
+                IO::Response response;
+                comm >> response;
+            }
+            elapsed = std::chrono::steady_clock::now() - start;
+
+            client_calls.sends = comm.get_socket().get_send_calls();
+            client_calls.recvs = comm.get_socket().get_recv_calls();
+        } catch (...) {
+            server.shutdown();
+            thread.join();
+            throw;
+        }
+        thread.join();
+
+        std::cout << (buffering ? "buffered  " : "unbuffered")
+                  << ": requests=" << requests << " hashes=" << num_hashes
+                  << " time=" << elapsed.count() * 1000 << "ms"
+                  << " client_sends=" << client_calls.sends
+                  << " client_recvs=" << client_calls.recvs
+                  << " server_sends=" << server_calls.sends
+                  << " server_recvs=" << server_calls.recvs << std::endl;
+    }
+}
@@ -0,0 +1,313 @@
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "bench.h"
+#include "common_comm_socket.h"
+#include "common_rw_lock.h"
+#include "common_sha256.h"
+#include "common_socket.h"
+#include "server_file_index.h"
+#include "server_hash_table.h"
+#include "server_tag_index.h"
+
+/** files in the index of the index cases */
+#define MICRO_FILES 100000
+/** tags added by the tag cases, and hashes in each one */
+#define MICRO_TAGS 100
+#define MICRO_TAG_SIZE 1000
+/** lock and unlock pairs per thread in the lock cases */
+#define MICRO_LOCKS 200000
+/** values sent in the encoding cases */
+#define MICRO_MESSAGES 200000
+/** file sent in the file case, and how many times */
+#define MICRO_FILE "bench_micro.tmp"
+#define MICRO_RECEIVED "bench_micro_received.tmp"
+#define MICRO_FILE_SIZE (64 * 1024)
+#define MICRO_FILE_SENDS 2000
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief Runs a case once (its setup included) and gives its time per
+ * operation, in ns, measured around the operations only.
+ */
+using Run = std::function<double()>;
+
+double ns_per_op(Clock::time_point start, uint64_t ops) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - start)
+               .count() /
+           ops;
+}
+
+/**
+ * @brief Hashes as the client sends them: SHA-256 digests in hex.
+ */
+std::vector<std::string> make_hashes(std::size_t count, std::size_t seed) {
+    std::vector<std::string> hashes;
+    for (std::size_t i = 0; i < count; i++) {
+        std::string data = std::to_string(seed) + "/" + std::to_string(i);
+        Digest::Sha256 sha;
+        sha.update(data.data(), data.size());
+        hashes.push_back(sha.hex_digest());
+    }
+    return hashes;
+}
+
+/**
+ * @brief Index cases: an index of MICRO_FILES files.
+ */
+struct IndexCases {
+    std::vector<std::string> names;
+    std::vector<std::string> hashes;
+    std::vector<std::string> missing;
+
+    IndexCases()
+        : hashes(make_hashes(MICRO_FILES, 0)),
+          missing(make_hashes(MICRO_FILES, 1)) {
+        for (std::size_t i = 0; i < MICRO_FILES; i++) {
+            this->names.push_back("dir/file" + std::to_string(i));
+        }
+    }
+
+    void fill(Server::FileIndex& files) const {
+        for (std::size_t i = 0; i < MICRO_FILES; i++) {
+            files.insert_file(this->names[i], this->hashes[i]);
+        }
+    }
+
+    double insert_file() const {
+        Server::HashTable table;
+        Server::FileIndex files{table};
+        Clock::time_point start = Clock::now();
+        this->fill(files);
+        return ns_per_op(start, MICRO_FILES);
+    }
+
+    double exists(bool hit) const {
+        Server::HashTable table;
+        Server::FileIndex files{table};
+        this->fill(files);
+        const std::vector<std::string>& keys =
+            hit ? this->hashes : this->missing;
+        std::size_t found = 0;
+        Clock::time_point start = Clock::now();
+        for (const std::string& hash : keys) {
+            found += files.exists(hash);
+        }
+        double result = ns_per_op(start, keys.size());
+        if (found != (hit ? keys.size() : 0)) {
+            throw Error::Error{"Resultado incorrecto"};
+        }
+        return result;
+    }
+
+    /** Tags of MICRO_TAG_SIZE hashes each, overlapping like nightlies. */
+    std::vector<std::set<std::string>> tags() const {
+        std::vector<std::set<std::string>> tags(MICRO_TAGS);
+        for (std::size_t i = 0; i < MICRO_TAGS; i++) {
+            for (std::size_t j = 0; j < MICRO_TAG_SIZE; j++) {
+                tags[i].insert(this->hashes[(i * 10 + j) % MICRO_FILES]);
+            }
+        }
+        return tags;
+    }
+
+    double tag_add() const {
+        std::vector<std::set<std::string>> tags = this->tags();
+        Server::HashTable table;
+        Server::TagIndex index{table};
+        Clock::time_point start = Clock::now();
+        for (std::size_t i = 0; i < MICRO_TAGS; i++) {
+            index.add("tag" + std::to_string(i), tags[i]);
+        }
+        return ns_per_op(start, MICRO_TAGS);
+    }
+
+    double tag_get_hashes() const {
+        std::vector<std::set<std::string>> tags = this->tags();
+        Server::HashTable table;
+        Server::TagIndex index{table};
+        for (std::size_t i = 0; i < MICRO_TAGS; i++) {
+            index.add("tag" + std::to_string(i), tags[i]);
+        }
+        std::size_t total = 0;
+        Clock::time_point start = Clock::now();
+        for (std::size_t i = 0; i < MICRO_TAGS; i++) {
+            total += index.get_hashes("tag" + std::to_string(i)).size();
+        }
+        double result = ns_per_op(start, MICRO_TAGS);
+        if (total != MICRO_TAGS * MICRO_TAG_SIZE) {
+            throw Error::Error{"Resultado incorrecto"};
+        }
+        return result;
+    }
+};
+
+/**
+ * @brief Acquires and releases an RWLock from several threads at once.
+ *
+ * @return Time per pair, over all the threads.
+ */
+double lock_pairs(unsigned threads, bool write) {
+    Concurrency::RWLock lock;
+    std::vector<std::thread> workers;
+    Clock::time_point start = Clock::now();
+    for (unsigned i = 0; i < threads; i++) {
+        workers.emplace_back([&] {
+            for (unsigned j = 0; j < MICRO_LOCKS; j++) {
+                if (write) {
+                    Concurrency::WriteLock guard{lock};
+                } else {
+                    Concurrency::ReadLock guard{lock};
+                }
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    return ns_per_op(start, static_cast<uint64_t>(threads) * MICRO_LOCKS);
+}
+
+/**
+ * @brief Sends values through a CommSocket over a socketpair, and decodes
+ * them on the other end.
+ *
+ * @param send Sends value `i`.
+ * @param receive Receives a value.
+ * @return Time per value, until the last one is decoded.
+ */
+double exchange(unsigned count,
+                const std::function<void(IO::CommSocket&, unsigned)>& send,
+                const std::function<void(IO::CommSocket&)>& receive) {
+    std::pair<IO::Socket, IO::Socket> sockets = IO::Socket::pair();
+    IO::CommSocket sender{std::move(sockets.first)};
+    IO::CommSocket receiver{std::move(sockets.second)};
+
+    Clock::time_point start = Clock::now();
+    std::thread thread{[&] {
+        for (unsigned i = 0; i < count; i++) {
+            send(sender, i);
+        }
+        sender.flush();
+    }};
+    for (unsigned i = 0; i < count; i++) {
+        receive(receiver);
+    }
+    double result = ns_per_op(start, count);
+    thread.join();
+    return result;
+}
+
+double send_u32() {
+    return exchange(
+        MICRO_MESSAGES,
+        [](IO::CommSocket& comm, unsigned i) {
+            comm << static_cast<uint32_t>(i);
+        },
+        [](IO::CommSocket& comm) {
+            uint32_t value;
+            comm >> value;
+        });
+}
+
+double send_string() {
+    const std::string hash(64, 'a');
+    return exchange(
+        MICRO_MESSAGES,
+        [&](IO::CommSocket& comm, unsigned i) { comm << hash; },
+        [](IO::CommSocket& comm) {
+            std::string value;
+            comm >> value;
+        });
+}
+
+double send_file() {
+    std::ofstream{MICRO_FILE, std::ios::binary}
+        << std::string(MICRO_FILE_SIZE, 'x');
+    double result = exchange(
+        MICRO_FILE_SENDS,
+        [](IO::CommSocket& comm, unsigned i) { comm.send_file(MICRO_FILE); },
+        [](IO::CommSocket& comm) { comm.receive_file(MICRO_RECEIVED); });
+    unlink(MICRO_FILE);
+    unlink(MICRO_RECEIVED);
+    return result;
+}
+
+/**
+ * @brief Runs a case several times and prints the median, the fastest run
+ * and the spread of the runs around the median. Each case starts from a
+ * fresh state, so runs only differ by noise.
+ */
+void report(const std::string& name, unsigned repeats, const Run& run) {
+    /* warms up caches and the allocator */
+    run();
+    std::vector<double> times;
+    for (unsigned i = 0; i < repeats; i++) {
+        times.push_back(run());
+    }
+    std::sort(times.begin(), times.end());
+    double median = times[times.size() / 2];
+    std::cout.precision(1);
+    std::cout << std::fixed << name << ": median=" << median
+              << "ns min=" << times.front() << "ns spread="
+              << 100 * (times.back() - times.front()) / median << "%"
+              << std::endl;
+}
+}  // namespace
+
+/**
+ * @brief Microbenchmarks of the code run by every request: the index
+ * lookups and updates, the RWLock and the encoding of the protocol. Runs
+ * within the process, without network.
+ * Arguments: `[filter = ""] [repeats = 5]`, to run only the cases whose
+ * name contains `filter`.
+ *
+ * @param args Benchmark arguments.
+ */
+void Bench::micro(const Bench::Args& args) {
+    std::string filter = args.size() > 0 ? args[0] : "";
+    unsigned repeats = args.size() > 1 ? std::stoul(args[1]) : 5;
+    if (repeats == 0) {
+        throw Error::Error{"Error: argumentos invalidos."};
+    }
+
+    std::vector<std::pair<std::string, Run>> cases;
+    IndexCases index;
+    cases.emplace_back("file_index.insert_file",
+                       [&] { return index.insert_file(); });
+    cases.emplace_back("file_index.exists.hit",
+                       [&] { return index.exists(true); });
+    cases.emplace_back("file_index.exists.miss",
+                       [&] { return index.exists(false); });
+    cases.emplace_back("tag_index.add",
+                       [&] { return index.tag_add(); });
+    cases.emplace_back("tag_index.get_hashes",
+                       [&] { return index.tag_get_hashes(); });
+    for (bool write : {false, true}) {
+        for (unsigned threads = 1; threads <= 64; threads *= 2) {
+            cases.emplace_back(std::string{"rwlock."} +
+                                   (write ? "write" : "read") + ".threads=" +
+                                   std::to_string(threads),
+                               [=] { return lock_pairs(threads, write); });
+        }
+    }
+    cases.emplace_back("comm.u32", send_u32);
+    cases.emplace_back("comm.string", send_string);
+    cases.emplace_back("comm.file", send_file);
+
+    for (const auto& pair : cases) {
+        if (pair.first.find(filter) != std::string::npos) {
+            report(pair.first, repeats, pair.second);
+        }
+    }
+}
@@ -0,0 +1,77 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bench.h"
+#include "common_epoch.h"
+#include "common_rcu_map.h"
+#include "common_rw_lock.h"
+
+/**
+ * @brief Runs `lookup` on `num_threads` threads for a while.
+ *
+ * @return Lookups per second, over all the threads.
+ */
+template <class Lookup>
+static double lookups_per_second(unsigned num_threads, unsigned entries,
+                                 Lookup lookup) {
+    std::atomic<bool> running{true};
+    std::atomic<uint64_t> total{0};
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < num_threads; i++) {
+        threads.emplace_back([&, i] {
+            uint64_t count = 0;
+            for (unsigned key = i; running; key = (key + 7919) % entries) {
+                count += lookup(std::to_string(key));
+            }
+            total += count;
+        });
+    }
+
+    std::chrono::milliseconds duration{500};
+    std::this_thread::sleep_for(duration);
+    running = false;
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    return total * 1000.0 / duration.count();
+}
+
+/**
+ * @brief Compares lookups in a map behind an RWLock (how pulls read the
+ * index under its locks) with lookups in an RcuMap, for 1 up to the given
+ * number of threads.
+ * Arguments: `[threads = 8] [entries = 100000]`.
+ *
+ * @param args Benchmark arguments.
+ */
+void Bench::rcu(const Bench::Args& args) {
+    unsigned max_threads = args.size() > 0 ? std::stoul(args[0]) : 8;
+    unsigned entries = args.size() > 1 ? std::stoul(args[1]) : 100000;
+
+    std::map<std::string, std::string> map;
+    Concurrency::RWLock lock;
+    Concurrency::RcuMap<std::string> rcu_map;
+    for (unsigned key = 0; key < entries; key++) {
+        map[std::to_string(key)] = std::to_string(key);
+        rcu_map.insert(std::to_string(key), std::to_string(key));
+    }
+
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+        double locked = lookups_per_second(
+            threads, entries, [&](const std::string& key) {
+                Concurrency::ReadLock read{lock};
+                return map.find(key) != map.end();
+            });
+        double lock_free = lookups_per_second(
+            threads, entries, [&](const std::string& key) {
+                Concurrency::EpochGuard guard;
+                return rcu_map.find(key) != nullptr;
+            });
+        std::cout << "threads=" << threads << " rwlock=" << locked
+                  << "/s rcu=" << lock_free << "/s" << std::endl;
+    }
+}
@@ -0,0 +1,188 @@
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bench.h"
+#include "common_comm_socket.h"
+#include "common_error.h"
+#include "common_socket.h"
+
+/** file sent by the benchmarks */
+#define TRANSFER_FILE "bench_transfer.tmp"
+/** file written by the receiving side */
+#define RECEIVED_FILE "bench_received.tmp"
+
+/** Ways of moving a file through a CommSocket. */
+enum class Path { Stream, Copy, ZeroCopy };
+
+/**
+ * @brief Name of a transfer path.
+ */
+static const char* path_name(Path path, bool receiving) {
+    switch (path) {
+        case Path::Stream:
+            return "stream  ";
+        case Path::Copy:
+            return "copy    ";
+        default:
+            return receiving ? "splice  " : "sendfile";
+    }
+}
+
+/**
+ * @brief Creates the file to send.
+ *
+ * @param size Size of the file in bytes.
+ */
+static void create_file(uint64_t size) {
+    std::ofstream file{TRANSFER_FILE, std::ios::binary};
+    std::vector<char> block(1024 * 1024);
+    for (std::size_t i = 0; i < block.size(); i++) {
+        block[i] = static_cast<char>(rand());
+    }
+    for (uint64_t written = 0; written < size; written += block.size()) {
+        uint64_t chunk = std::min<uint64_t>(block.size(), size - written);
+        file.write(block.data(), chunk);
+    }
+    if (!file) {
+        throw Error::Error{"Error escribiendo %s", TRANSFER_FILE};
+    }
+}
+
+/**
+ * @brief Sends a file through the given path.
+ */
+static void send_with(IO::CommSocket& comm, Path path) {
+    comm.set_zero_copy(path == Path::ZeroCopy);
+    if (path == Path::Stream) {
+        std::ifstream file{TRANSFER_FILE, std::ios::binary};
+        comm << file;
+    } else {
+        comm.send_file(TRANSFER_FILE);
+    }
+}
+
+/**
+ * @brief Receives a file through the given path.
+ */
+static void receive_with(IO::CommSocket& comm, Path path) {
+    comm.set_zero_copy(path == Path::ZeroCopy);
+    if (path == Path::Stream) {
+        std::ofstream file{RECEIVED_FILE, std::ios::binary};
+        comm >> file;
+    } else {
+        comm.receive_file(RECEIVED_FILE);
+    }
+}
+
+/**
+ * @brief Receiving side: receives each file through its path and answers a
+ * byte after each one so the sender can time the whole transfer.
+ *
+ * @param server Listening socket.
+ * @param paths Path used to receive each file.
+ */
+static void receiver(IO::Socket& server, const std::vector<Path>& paths) {
+    try {
+        IO::CommSocket comm{server.accept()};
+        for (Path path : paths) {
+            receive_with(comm, path);
+            comm << static_cast<uint8_t>(1);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "receptor: " << e.what() << std::endl;
+    }
+}
+
+/**
+ * @brief Times sending files over a loopback connection, varying the path of
+ * the sending or the receiving side (the other one always uses the zero
+ * copy path).
+ * Arguments: `[size in MiB = 256] [rounds = 5] [port = 7654]`.
+ *
+ * @param args Benchmark arguments.
+ * @param receiving Whether the receiving side is measured.
+ */
+static void run(const Bench::Args& args, bool receiving) {
+    uint64_t size_mib = args.size() > 0 ? std::stoul(args[0]) : 256;
+    unsigned rounds = args.size() > 1 ? std::stoul(args[1]) : 5;
+    std::string port = args.size() > 2 ? args[2] : "7654";
+    uint64_t size = size_mib * 1024 * 1024;
+    if (size == 0 || size > UINT32_MAX) {
+        throw Error::Error{"transfer: tamanio invalido"};
+    }
+
+    const Path paths[] = {Path::Stream, Path::Copy, Path::ZeroCopy};
+    std::vector<Path> receiver_paths;
+    for (Path path : paths) {
+        receiver_paths.insert(receiver_paths.end(), rounds,
+                              receiving ? path : Path::ZeroCopy);
+    }
+
+    create_file(size);
+
+    IO::Socket server;
+    server.bind(port);
+    server.listen();
+    std::thread thread{receiver, std::ref(server), std::cref(receiver_paths)};
+
+    try {
+        IO::CommSocket comm{"127.0.0.1", port};
+        for (Path path : paths) {
+            double best = 0, total = 0;
+            for (unsigned i = 0; i < rounds; i++) {
+                auto start = std::chrono::steady_clock::now();
+                send_with(comm, receiving ? Path::ZeroCopy : path);
+                uint8_t ack;
+                comm >> ack;
+                std::chrono::duration<double> elapsed =
+                    std::chrono::steady_clock::now() - start;
+
+                double rate = size_mib / elapsed.count();
+                best = std::max(best, rate);
+                total += rate;
+            }
+
+            std::cout << path_name(path, receiving) << ": size=" << size_mib
+                      << "MiB rounds=" << rounds
+                      << " avg=" << total / rounds << "MiB/s"
+                      << " best=" << best << "MiB/s" << std::endl;
+        }
+    } catch (...) {
+        server.shutdown();
+        thread.join();
+        unlink(TRANSFER_FILE);
+        unlink(RECEIVED_FILE);
+        throw;
+    }
+
+    thread.join();
+    unlink(TRANSFER_FILE);
+    unlink(RECEIVED_FILE);
+}
+
+/**
+ * @brief Compares the ways of sending a file through CommSocket: operator<<
+ * with a stream, and send_file copying or with sendfile.
+ *
+ * @param args Benchmark arguments (see `run`).
+ */
+void Bench::transfer(const Bench::Args& args) {
+    run(args, false);
+}
+
+/**
+ * @brief Compares the ways of receiving a file through CommSocket:
+ * operator>> with a stream, and receive_file copying or with splice.
+ *
+ * @param args Benchmark arguments (see `run`).
+ */
+void Bench::receive(const Bench::Args& args) {
+    run(args, true);
+}
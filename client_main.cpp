@@ -1,11 +1,40 @@
+#include <cstdlib>
 #include <exception>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <string>
 #include <vector>
 #include "client_versioner.h"
 #include "common_comm_socket.h"
 #include "common_error.h"
 
+/**
+ * @brief Reads the operations of a batch, one per line, written as in the
+ * command line (e.g. `push file hash`). Empty lines are skipped.
+ *
+ * @param input Stream with the operations.
+ * @return The operations.
+ */
+static std::vector<Client::Operation> read_batch(std::istream& input) {
+    std::vector<Client::Operation> operations;
+    std::string line;
+    while (std::getline(input, line)) {
+        std::istringstream words{line};
+        std::string action, arg;
+        if (!(words >> action)) {
+            continue;
+        }
+        std::vector<std::string> args;
+        while (words >> arg) {
+            args.push_back(arg);
+        }
+        operations.emplace_back(action, args);
+    }
+    return operations;
+}
+
 int main(int argc, const char* argv[]) {
     if (argc < 4) {
         std::cout << "Error: argumentos invalidos." << std::endl;
@@ -17,20 +46,60 @@ int main(int argc, const char* argv[]) {
     std::string action{argv[3]};
 
     try {
-        IO::CommSocket comm{ip, service};
-        Client::Versioner v{comm};
+        std::unique_ptr<IO::CommSocket> comm{new IO::CommSocket{ip, service}};
+        if (!Client::Versioner::negotiate(*comm)) {
+            /* the server is too old, so it closed the connection: starts
+             * over with the original protocol (a busy server that closed
+             * it closes the new one too, and the command fails) */
+            comm.reset(new IO::CommSocket{ip, service});
+        }
+        Client::Versioner v{*comm};
 
         /* selects the appropriate action from the command line arguments */
         if (action == "push" && argc == 6) {
             v.push(argv[4], argv[5]);
+        } else if (action == "push-delta" && argc == 6) {
+            /* sends only what changed since the previous version */
+            v.push_delta(argv[4], argv[5]);
         } else if (action == "pull" && argc == 5) {
             v.pull(argv[4]);
+        } else if (action == "pull" && argc == 6) {
+            /* pulls through the given number of connections */
+            int connections = std::atoi(argv[5]);
+            if (connections < 1) {
+                throw Error::Error{"Error: argumentos invalidos."};
+            }
+            v.pull(argv[4], [&]() {
+                std::unique_ptr<IO::Comm> extra{
+                    new IO::CommSocket{ip, service}};
+                if (!Client::Versioner::negotiate(*extra)) {
+                    throw Error::Error{"Error: negociacion fallida."};
+                }
+                return extra;
+            }, connections);
         } else if (action == "tag" && argc > 5) {
             std::vector<std::string> hashes;
             for (int i = 5; i < argc; i++) {
                 hashes.push_back(argv[i]);
             }
             v.tag(argv[4], hashes);
+        } else if (action == "stats" && argc == 4) {
+            v.stats(std::cout);
+        } else if (action == "batch" && argc == 5) {
+            /* runs every operation in the file ("-" for stdin) through the
+             * same connection */
+            std::string batch_file{argv[4]};
+            std::vector<Client::Operation> operations;
+            if (batch_file == "-") {
+                operations = read_batch(std::cin);
+            } else {
+                std::ifstream input{batch_file};
+                if (!input) {
+                    throw Error::Error{"Error: archivo inexistente."};
+                }
+                operations = read_batch(input);
+            }
+            v.batch(operations, std::cout);
         } else {
             throw Error::Error{"Error: argumentos invalidos."};
         }
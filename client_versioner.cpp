@@ -1,8 +1,23 @@
 #include "client_versioner.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <exception>
 #include <fstream>
 #include <limits>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <set>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 /**
@@ -17,6 +32,61 @@ Client::Versioner::Versioner(IO::Comm& comm) : comm(comm) {
 Client::Versioner::~Versioner() {
 }
 
+/**
+ * @brief Agrees with the server on the latest protocol revision both speak,
+ * and on the compression of the files when the revision allows it.
+ * Servers that predate the negotiation close the connection, in which case
+ * the caller must connect again and use the original revision.
+ *
+ * @param comm Newly connected endpoint.
+ * @return false if the server didn't take part in the negotiation.
+ * @throw Error::Error if the server is too busy to serve the client.
+ */
+bool Client::Versioner::negotiate(IO::Comm& comm) {
+    const uint8_t hello_cmd_id = 0;
+
+    try {
+        comm << hello_cmd_id << IO::PROTOCOL_VERSION;
+
+        IO::Response response = IO::Response::Error;
+        comm >> response;
+        if (response == IO::Response::Busy) {
+            throw Error::Error{"Error: servidor ocupado."};
+        }
+        if (response != IO::Response::OK) {
+            return false;
+        }
+
+        uint32_t version;
+        comm >> version;
+        if (version == 0 || version > IO::PROTOCOL_VERSION) {
+            throw Error::Error{"Version de protocolo invalida"};
+        }
+        comm.set_version(version);
+
+        /* offers to compress the files, the server has the last word */
+        if (version >= 5) {
+            const uint8_t compress_cmd_id = 7;
+            comm << compress_cmd_id << static_cast<uint8_t>(1)
+                 << static_cast<uint8_t>(IO::Codec::Deflate);
+
+            comm >> response;
+            if (response != IO::Response::OK) {
+                throw Error::Error{"Compresion invalida"};
+            }
+            uint8_t codec;
+            comm >> codec;
+            if (codec > static_cast<uint8_t>(IO::Codec::Deflate)) {
+                throw Error::Error{"Compresion invalida"};
+            }
+            comm.set_codec(static_cast<IO::Codec>(codec));
+        }
+        return true;
+    } catch (const IO::CommError& e) {
+        return false;
+    }
+}
+
 /**
  * @brief Does a push operation on a file.
  *
@@ -25,15 +95,568 @@ Client::Versioner::~Versioner() {
  */
 void Client::Versioner::push(const std::string& file_name,
                              const std::string& hash) {
-    const uint8_t pull_cmd_id = 1;
+    this->send_push(file_name, hash);
+    this->finish_push(file_name);
+}
+
+/**
+ * @brief Does a push operation on a file, sending only what changed since
+ * the latest version of the file the server has (rsync style): the server
+ * sends the signatures of the blocks of that version, and the file is sent
+ * as the blocks it can copy from it plus literal data for the rest.
+ * Falls back to a regular push if the server has no earlier version or
+ * doesn't support it.
+ *
+ * @param file_name Name of the file to push.
+ * @param hash File hash.
+ */
+void Client::Versioner::push_delta(const std::string& file_name,
+                                   const std::string& hash) {
+    const uint8_t signatures_cmd_id = 8;
+    const uint8_t delta_cmd_id = 9;
+
+    if (this->comm.get_version() < 6) {
+        this->push(file_name, hash);
+        return;
+    }
+    if (access(file_name.c_str(), F_OK) == -1) {
+        throw Error::Error{"Error: archivo inexistente."};
+    }
+
+    /* gets the signatures of the latest version */
+    this->comm << signatures_cmd_id << file_name;
+
+    IO::Response response = IO::Response::Error;
+    this->comm >> response;
+    if (response == IO::Response::Busy) {
+        throw Error::Error{"Error: servidor ocupado."};
+    }
+    if (response != IO::Response::OK) {
+        this->push(file_name, hash);
+        return;
+    }
+
+    std::string basis;
+    uint32_t block_size, num_blocks;
+    this->comm >> basis >> block_size >> num_blocks;
+    std::vector<Delta::BlockSignature> blocks;
+    for (uint32_t i = 0; i < num_blocks; i++) {
+        uint32_t weak;
+        std::string strong;
+        this->comm >> weak >> strong;
+        blocks.emplace_back(weak, strong);
+    }
+
+    this->comm << delta_cmd_id << file_name << hash << basis << block_size;
+
+    this->comm >> response;
+    if (response == IO::Response::Busy) {
+        throw Error::Error{"Error: servidor ocupado."};
+    }
+    if (response != IO::Response::OK) {
+        /* the hash already exists, so it's a no op */
+        return;
+    }
+
+    this->send_delta(file_name, block_size, blocks);
+    this->finish_upload();
+}
+
+/**
+ * @brief Does a pull operation on a tag.
+ *
+ * @param tag Name of the tag to pull.
+ */
+void Client::Versioner::pull(const std::string& tag) {
+    this->send_pull(tag);
+    this->finish_pull(tag);
+}
+
+/**
+ * @brief Does a pull operation on a tag through several connections.
+ * The files of the tag are listed first, and then fetched one by one from a
+ * shared queue by a thread per connection (this one included). Servers that
+ * don't support it get a regular pull.
+ *
+ * @param tag Name of the tag to pull.
+ * @param connect Opens each additional connection.
+ * @param connections Maximum number of connections to use.
+ */
+void Client::Versioner::pull(const std::string& tag, const Connector& connect,
+                             std::size_t connections) {
+    if (this->comm.get_version() < 4 || connections <= 1) {
+        this->pull(tag);
+        return;
+    }
+
+    /* a tag may hold several versions of a file name, which a regular pull
+     * writes one over the other: only the one it leaves (the last in hash
+     * order, as listed) is fetched, so no file is written concurrently */
+    const std::vector<ManifestEntry> listed = this->manifest(tag);
+    std::unordered_map<std::string, std::size_t> last;
+    for (std::size_t i = 0; i < listed.size(); i++) {
+        last[listed[i].name] = i;
+    }
+    std::vector<ManifestEntry> files;
+    for (std::size_t i = 0; i < listed.size(); i++) {
+        if (last[listed[i].name] == i) {
+            files.push_back(listed[i]);
+        }
+    }
+    connections = std::min(connections, files.size());
+
+    std::atomic<std::size_t> next{0};
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    /* fetches files until the queue is empty or a connection failed */
+    auto worker = [&](IO::Comm& comm) {
+        Versioner versioner{comm};
+        try {
+            std::size_t i;
+            while (!failed && (i = next++) < files.size()) {
+                versioner.fetch(files[i].hash, files[i].name + "." + tag);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+            failed = true;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < connections; i++) {
+        threads.emplace_back([&]() {
+            std::unique_ptr<IO::Comm> comm;
+            try {
+                comm = connect();
+            } catch (...) {
+                /* the other connections can still do the work */
+                return;
+            }
+            worker(*comm);
+        });
+    }
+    worker(this->comm);
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+/**
+ * @brief Does a tag operation.
+ *
+ * @param tag The tag name.
+ * @param hashes The list of hashes to include in the tag.
+ */
+void Client::Versioner::tag(const std::string& tag,
+                            std::vector<std::string>& hashes) {
+    this->send_tag(tag, hashes);
+    this->finish_tag();
+}
+
+/**
+ * @brief Asks the server which of the given hashes it already has.
+ * Requires protocol revision 3.
+ *
+ * @param hashes Hashes to query.
+ * @return Whether the server has each hash, in the same order.
+ */
+std::vector<bool> Client::Versioner::have(
+    const std::vector<std::string>& hashes) {
+    const uint8_t have_cmd_id = 4;
+
+    this->comm << have_cmd_id << static_cast<uint32_t>(hashes.size());
+    for (const std::string& hash : hashes) {
+        this->comm << hash;
+    }
+
+    IO::Response response = IO::Response::Error;
+    this->comm >> response;
+    uint32_t num_hashes;
+    if (response != IO::Response::OK ||
+        (this->comm >> num_hashes, num_hashes != hashes.size())) {
+        throw Error::Error{"Have: respuesta invalida"};
+    }
+
+    /* one bit per hash, from the least significant bit of the first byte */
+    std::vector<uint8_t> bitmap((num_hashes + 7) / 8);
+    if (this->comm.read(bitmap.data(), bitmap.size()) !=
+        static_cast<ssize_t>(bitmap.size())) {
+        throw IO::CommError{"Error en la lectura de bitmap"};
+    }
+
+    std::vector<bool> found(num_hashes);
+    for (uint32_t i = 0; i < num_hashes; i++) {
+        found[i] = bitmap[i / 8] & (1 << (i % 8));
+    }
+    return found;
+}
+
+/**
+ * @brief Lists the files of a tag, without receiving them.
+ * Requires protocol revision 4.
+ *
+ * @param tag Name of the tag.
+ * @return The files of the tag.
+ */
+std::vector<Client::ManifestEntry> Client::Versioner::manifest(
+    const std::string& tag) {
+    const uint8_t manifest_cmd_id = 5;
+
+    this->comm << manifest_cmd_id << tag;
+
+    IO::Response response = IO::Response::Error;
+    this->comm >> response;
+
+    switch (response) {
+        case IO::Response::OK:
+            break;
+        case IO::Response::Error:
+            throw Error::Error{"Error: tag/hash incorrecto."};
+        case IO::Response::Busy:
+            throw Error::Error{"Error: servidor ocupado."};
+        default:
+            throw Error::Error{"Manifest: codigo de retorno invalido"};
+    }
+
+    uint32_t num_files;
+    this->comm >> num_files;
+
+    std::vector<ManifestEntry> files;
+    for (uint32_t i = 0; i < num_files; i++) {
+        std::string name, hash;
+        uint64_t size;
+        this->comm >> name >> hash >> size;
+        files.emplace_back(name, hash, size);
+    }
+    return files;
+}
+
+/**
+ * @brief Receives a single file, given its hash.
+ * Requires protocol revision 4.
+ *
+ * @param hash Hash of the file.
+ * @param file_name Name of the file to write.
+ */
+void Client::Versioner::fetch(const std::string& hash,
+                              const std::string& file_name) {
+    const uint8_t fetch_cmd_id = 6;
+
+    this->comm << fetch_cmd_id << hash;
+
+    IO::Response response = IO::Response::Error;
+    this->comm >> response;
+
+    switch (response) {
+        case IO::Response::OK:
+            break;
+        case IO::Response::Error:
+            throw Error::Error{"Error: tag/hash incorrecto."};
+        case IO::Response::Busy:
+            throw Error::Error{"Error: servidor ocupado."};
+        default:
+            throw Error::Error{"Fetch: codigo de retorno invalido"};
+    }
+
+    /* the file is preallocated as soon as its size is known */
+    this->comm.receive_file(file_name);
+}
+
+/**
+ * @brief Gets the live metrics of the server and writes them, a `name
+ * value` pair per line.
+ * Requires protocol revision 7.
+ *
+ * @param out Where the metrics are written.
+ */
+void Client::Versioner::stats(std::ostream& out) {
+    const uint8_t stats_cmd_id = 10;
+
+    if (this->comm.get_version() < 7) {
+        throw Error::Error{"Error: el servidor no informa metricas."};
+    }
+    this->comm << stats_cmd_id;
+
+    IO::Response response = IO::Response::Error;
+    this->comm >> response;
+    if (response != IO::Response::OK) {
+        throw Error::Error{"Stats: codigo de retorno invalido"};
+    }
+
+    uint32_t num_values;
+    this->comm >> num_values;
+    for (uint32_t i = 0; i < num_values; i++) {
+        std::string name;
+        uint64_t value;
+        this->comm >> name >> value;
+        out << name << " " << value << std::endl;
+    }
+}
+
+/**
+ * @brief Runs several operations through the same connection.
+ * Requests are pipelined: up to `window` requests are sent before waiting
+ * for their responses. A push waits for every response up to its own,
+ * because the file can only be sent once the server accepted it.
+ * A failed operation doesn't stop the batch.
+ * If the server supports it, the hashes of every push are queried first
+ * and the files the server already has are not sent at all.
+ *
+ * @param operations Operations to run, in order.
+ * @param errors Where the errors of each failed operation are written.
+ * @param window Maximum number of requests waiting for a response.
+ */
+void Client::Versioner::batch(const std::vector<Operation>& operations,
+                              std::ostream& errors, std::size_t window) {
+    std::deque<const Operation*> in_flight;
+    std::set<std::string> known = this->known_hashes(operations);
+
+    auto finish_next = [&]() {
+        const Operation& operation = *in_flight.front();
+        in_flight.pop_front();
+        try {
+            this->finish(operation);
+        } catch (const IO::CommError& e) {
+            /* the connection is gone, so is the rest of the batch */
+            throw;
+        } catch (const Error::Error& e) {
+            errors << e.what() << std::endl;
+        }
+    };
+
+    for (const Operation& operation : operations) {
+        /* pushing an existing hash is a no op */
+        if (operation.action == "push" && operation.args.size() == 2 &&
+            known.find(operation.args[1]) != known.end()) {
+            continue;
+        }
+
+        try {
+            this->send(operation);
+        } catch (const IO::CommError& e) {
+            throw;
+        } catch (const Error::Error& e) {
+            /* the request wasn't sent, so there is no response to wait for */
+            errors << e.what() << std::endl;
+            continue;
+        }
+        in_flight.push_back(&operation);
+
+        while (!in_flight.empty() &&
+               (operation.action == "push" || in_flight.size() > window)) {
+            finish_next();
+        }
+    }
+
+    while (!in_flight.empty()) {
+        finish_next();
+    }
+}
+
+/**
+ * @brief Gets the hashes of the pushes of a batch that the server already
+ * has.
+ *
+ * @param operations Operations of the batch.
+ * @return Known hashes (none if the server can't be asked).
+ */
+std::set<std::string> Client::Versioner::known_hashes(
+    const std::vector<Operation>& operations) {
+    std::set<std::string> known;
+    if (this->comm.get_version() < 3) {
+        return known;
+    }
+
+    std::vector<std::string> hashes;
+    for (const Operation& operation : operations) {
+        if (operation.action == "push" && operation.args.size() == 2) {
+            hashes.push_back(operation.args[1]);
+        }
+    }
+    if (hashes.empty()) {
+        return known;
+    }
+
+    std::vector<bool> found = this->have(hashes);
+    for (std::size_t i = 0; i < hashes.size(); i++) {
+        if (found[i]) {
+            known.insert(hashes[i]);
+        }
+    }
+    return known;
+}
+
+/**
+ * @brief Sends a file as a delta against the blocks of its basis.
+ * A window the size of a block is slid over the file, looking up its
+ * rolling checksum among the blocks of the basis (and confirming the
+ * candidates with the strong hash). Matching windows are sent as copies,
+ * and the bytes between them as literals.
+ *
+ * @param file_name Name of the file to send.
+ * @param block_size Block size of the signatures.
+ * @param blocks Signatures of the blocks of the basis.
+ */
+void Client::Versioner::send_delta(
+    const std::string& file_name, uint32_t block_size,
+    const std::vector<Delta::BlockSignature>& blocks) {
+/* literals are sent in pieces of at most this size */
+#define MAX_LITERAL_SIZE ((std::size_t)64 * 1024 * 1024)
+    std::unordered_map<uint32_t, std::vector<uint32_t>> by_weak;
+    /* most windows match nothing, and a bit per checksum tells them apart
+     * without going to the map */
+    std::vector<bool> filter(1 << 16);
+    for (uint32_t i = 0; i < blocks.size(); i++) {
+        by_weak[blocks[i].weak].push_back(i);
+        filter[(blocks[i].weak ^ (blocks[i].weak >> 16)) & 0xffff] = true;
+    }
+
+    int fd = open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        throw Error::Error{"Error: archivo inexistente."};
+    }
+    struct stat info;
+    if (fstat(fd, &info) == -1) {
+        close(fd);
+        throw Error::Error{"fstat %s: %s", file_name.c_str(), strerror(errno)};
+    }
+    std::size_t size = info.st_size;
+    const char* data = nullptr;
+    if (size > 0) {
+        void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            throw Error::Error{"mmap %s: %s", file_name.c_str(),
+                               strerror(errno)};
+        }
+        data = static_cast<const char*>(map);
+        madvise(map, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    /* consecutive copies are merged into one instruction */
+    uint32_t copy_first = 0, copy_count = 0;
+    auto flush_copy = [&]() {
+        if (copy_count > 0) {
+            this->comm << static_cast<uint8_t>(Delta::Op::Copy) << copy_first
+                       << copy_count;
+            copy_count = 0;
+        }
+    };
+    auto send_literal = [&](std::size_t from, std::size_t to) {
+        flush_copy();
+        while (from < to) {
+            std::size_t piece = std::min(to - from, MAX_LITERAL_SIZE);
+            this->comm << static_cast<uint8_t>(Delta::Op::Literal)
+                       << static_cast<uint32_t>(piece);
+            this->comm.write(data + from, piece);
+            from += piece;
+        }
+    };
+
+    /* finds the block of the basis equal to the window at `pos`, preferring
+     * the one after the last copy */
+    auto find_block = [&](std::size_t pos, uint32_t weak, uint32_t& index) {
+        auto candidates = by_weak.find(weak);
+        if (candidates == by_weak.end()) {
+            return false;
+        }
+        std::string strong = Delta::strong_hash(data + pos, block_size);
+        bool found = false;
+        for (uint32_t candidate : candidates->second) {
+            if (blocks[candidate].strong != strong) {
+                continue;
+            }
+            if (!found || (copy_count > 0 &&
+                           candidate == copy_first + copy_count)) {
+                index = candidate;
+                found = true;
+            }
+        }
+        return found;
+    };
+
+    try {
+        std::size_t literal_start = 0, pos = 0;
+        if (!blocks.empty() && size >= block_size) {
+            Delta::RollingChecksum checksum{data, block_size};
+            while (true) {
+                uint32_t weak = checksum.value();
+                uint32_t index = 0;
+                if (filter[(weak ^ (weak >> 16)) & 0xffff] &&
+                    find_block(pos, weak, index)) {
+                    send_literal(literal_start, pos);
+                    if (copy_count > 0 && index == copy_first + copy_count) {
+                        copy_count++;
+                    } else {
+                        flush_copy();
+                        copy_first = index;
+                        copy_count = 1;
+                    }
+                    pos += block_size;
+                    literal_start = pos;
+                    if (size - pos < block_size) {
+                        break;
+                    }
+                    checksum = Delta::RollingChecksum{data + pos, block_size};
+                    continue;
+                }
+
+                if (pos + block_size >= size) {
+                    break;
+                }
+                checksum.roll(data[pos], data[pos + block_size]);
+                pos++;
+            }
+        }
+        send_literal(literal_start, size);
+        flush_copy();
+        this->comm << static_cast<uint8_t>(Delta::Op::End);
+    } catch (...) {
+        if (data) {
+            munmap(const_cast<char*>(data), size);
+        }
+        throw;
+    }
+    if (data) {
+        munmap(const_cast<char*>(data), size);
+    }
+}
+
+/**
+ * @brief Sends a push request.
+ *
+ * @param file_name Name of the file to push.
+ * @param hash File hash.
+ */
+void Client::Versioner::send_push(const std::string& file_name,
+                                  const std::string& hash) {
+    const uint8_t push_cmd_id = 1;
 
     if (access(file_name.c_str(), F_OK) == -1) {
         throw Error::Error{"Error: archivo inexistente."};
     }
 
     /* writes the command ID */
-    this->comm << pull_cmd_id << file_name << hash;
+    this->comm << push_cmd_id << file_name << hash;
+}
 
+/**
+ * @brief Gets the response of a push and sends the file if the server
+ * accepted it.
+ *
+ * @param file_name Name of the pushed file.
+ */
+void Client::Versioner::finish_push(const std::string& file_name) {
     /* gets the server response */
     IO::Response response = IO::Response::Error;
     this->comm >> response;
@@ -44,25 +667,53 @@ void Client::Versioner::push(const std::string& file_name,
             return;
         case IO::Response::OK:
             break;
+        case IO::Response::Busy:
+            throw Error::Error{"Error: servidor ocupado."};
         default:
             throw Error::Error{"Push: codigo de retorno invalido"};
     }
 
-    std::ifstream file{file_name, std::ios::binary};
-    this->comm << file;
+    this->comm.send_file(file_name);
+    this->finish_upload();
 }
 
 /**
- * @brief Does a pull operation on a tag.
+ * @brief Gets the final response of a push or delta, once the server
+ * committed the file (revision 9). Older servers don't send it.
+ *
+ * @throw Error::Error if the server discarded the file (e.g. its contents
+ * don't match the hash).
+ */
+void Client::Versioner::finish_upload() {
+    if (this->comm.get_version() < 9) {
+        return;
+    }
+
+    IO::Response response = IO::Response::Error;
+    this->comm >> response;
+    if (response != IO::Response::OK) {
+        throw Error::Error{"Error: el servidor rechazo el archivo."};
+    }
+}
+
+/**
+ * @brief Sends a pull request.
  *
  * @param tag Name of the tag to pull.
  */
-void Client::Versioner::pull(const std::string& tag) {
+void Client::Versioner::send_pull(const std::string& tag) {
     const uint8_t pull_cmd_id = 3;
 
     /* writes the command ID */
     this->comm << pull_cmd_id << tag;
+}
 
+/**
+ * @brief Gets the response of a pull and writes the received files.
+ *
+ * @param tag Name of the pulled tag.
+ */
+void Client::Versioner::finish_pull(const std::string& tag) {
     /* gets the server response */
     IO::Response response = IO::Response::Error;
     this->comm >> response;
@@ -73,6 +724,8 @@ void Client::Versioner::pull(const std::string& tag) {
             break;
         case IO::Response::Error:
             throw Error::Error{"Error: tag/hash incorrecto."};
+        case IO::Response::Busy:
+            throw Error::Error{"Error: servidor ocupado."};
         default:
             throw Error::Error{"Pull: codigo de retorno invalido"};
     }
@@ -86,26 +739,30 @@ void Client::Versioner::pull(const std::string& tag) {
         this->comm >> file_name;
 
         /* writes to disk */
-        std::ofstream file{file_name + "." + tag, std::ios::binary};
-        this->comm >> file;
+        this->comm.receive_file(file_name + "." + tag);
     }
 }
 
 /**
- * @brief Does a tag operation.
+ * @brief Sends a tag request.
  *
  * @param tag The tag name.
  * @param hashes The list of hashes to include in the tag.
  */
-void Client::Versioner::tag(const std::string& tag,
-                            std::vector<std::string>& hashes) {
+void Client::Versioner::send_tag(const std::string& tag,
+                                 const std::vector<std::string>& hashes) {
     const uint8_t tag_cmd_id = 2;
 
     this->comm << tag_cmd_id << static_cast<uint32_t>(hashes.size()) << tag;
     for (std::size_t i = 0; i < hashes.size(); i++) {
         this->comm << hashes[i];
     }
+}
 
+/**
+ * @brief Gets the response of a tag.
+ */
+void Client::Versioner::finish_tag() {
     IO::Response response = IO::Response::Error;
     this->comm >> response;
 
@@ -114,7 +771,44 @@ void Client::Versioner::tag(const std::string& tag,
             break;
         case IO::Response::Error:
             throw Error::Error{"Error: tag/hash incorrecto."};
+        case IO::Response::Busy:
+            throw Error::Error{"Error: servidor ocupado."};
         default:
             throw Error::Error{"Tag: codigo de retorno invalido"};
     }
 }
+
+/**
+ * @brief Sends the request of a batch operation.
+ *
+ * @param operation Operation to send.
+ */
+void Client::Versioner::send(const Operation& operation) {
+    const std::vector<std::string>& args = operation.args;
+
+    if (operation.action == "push" && args.size() == 2) {
+        this->send_push(args[0], args[1]);
+    } else if (operation.action == "pull" && args.size() == 1) {
+        this->send_pull(args[0]);
+    } else if (operation.action == "tag" && args.size() > 1) {
+        std::vector<std::string> hashes{args.begin() + 1, args.end()};
+        this->send_tag(args[0], hashes);
+    } else {
+        throw Error::Error{"Error: argumentos invalidos."};
+    }
+}
+
+/**
+ * @brief Finishes a batch operation whose request was already sent.
+ *
+ * @param operation Operation to finish.
+ */
+void Client::Versioner::finish(const Operation& operation) {
+    if (operation.action == "push") {
+        this->finish_push(operation.args[0]);
+    } else if (operation.action == "pull") {
+        this->finish_pull(operation.args[0]);
+    } else {
+        this->finish_tag();
+    }
+}
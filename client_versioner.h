@@ -1,25 +1,96 @@
 #ifndef VERSIONER_H_
 #define VERSIONER_H_
 
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <set>
 #include <string>
 #include <vector>
 #include "common_comm.h"
+#include "common_delta.h"
 #include "common_error.h"
 #include "common_socket.h"
 
 namespace Client {
+/**
+ * @brief An operation of a batch: the action name (push, pull or tag)
+ * followed by the same arguments it takes in the command line.
+ */
+class Operation {
+   public:
+    Operation(const std::string& action, const std::vector<std::string>& args)
+        : action(action), args(args) {
+    }
+    ~Operation() {
+    }
+
+    std::string action;
+    std::vector<std::string> args;
+};
+
+/**
+ * @brief A file of a tag, as listed by the server before fetching it.
+ */
+class ManifestEntry {
+   public:
+    ManifestEntry(const std::string& name, const std::string& hash,
+                  uint64_t size)
+        : name(name), hash(hash), size(size) {
+    }
+    ~ManifestEntry() {
+    }
+
+    std::string name;
+    std::string hash;
+    uint64_t size;
+};
+
+/** Opens a new connection to the same server, already negotiated. */
+using Connector = std::function<std::unique_ptr<IO::Comm>()>;
+
 class Versioner {
    public:
     explicit Versioner(IO::Comm& comm);
     ~Versioner();
 
+    static bool negotiate(IO::Comm& comm);
+
     void push(const std::string& file_name, const std::string& hash);
+    void push_delta(const std::string& file_name, const std::string& hash);
     void pull(const std::string& tag);
+    void pull(const std::string& tag, const Connector& connect,
+              std::size_t connections);
     void tag(const std::string& tag, std::vector<std::string>& hashes);
+    std::vector<bool> have(const std::vector<std::string>& hashes);
+    std::vector<ManifestEntry> manifest(const std::string& tag);
+    void fetch(const std::string& hash, const std::string& file_name);
+    void stats(std::ostream& out);
+
+    void batch(const std::vector<Operation>& operations, std::ostream& errors,
+               std::size_t window = 32);
 
    private:
     /** Internal socket used to communicate with the server. */
     IO::Comm& comm;
+
+    /** requests */
+    void send_push(const std::string& file_name, const std::string& hash);
+    void send_pull(const std::string& tag);
+    void send_tag(const std::string& tag,
+                  const std::vector<std::string>& hashes);
+    void send(const Operation& operation);
+    std::set<std::string> known_hashes(
+        const std::vector<Operation>& operations);
+    void send_delta(const std::string& file_name, uint32_t block_size,
+                    const std::vector<Delta::BlockSignature>& blocks);
+
+    /** responses */
+    void finish_push(const std::string& file_name);
+    void finish_upload();
+    void finish_pull(const std::string& tag);
+    void finish_tag();
+    void finish(const Operation& operation);
 };
 }  // namespace Client
 
@@ -0,0 +1,328 @@
+#include "common_codec.h"
+#include <algorithm>
+#include <exception>
+#include <istream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "common_error.h"
+
+/** size of the blocks read from files and handed between threads */
+#define CODEC_BLOCK_SIZE ((std::size_t)64 * 1024)
+/** blocks that may wait between the compression and the socket */
+#define CODEC_QUEUE_BLOCKS 4
+
+/**
+ * @brief Construct a new Deflater.
+ *
+ * @param level zlib compression level (1 is the fastest, 9 the smallest).
+ */
+IO::Deflater::Deflater(int level) : stream() {
+    if (deflateInit(&this->stream, level) != Z_OK) {
+        throw Error::Error{"deflateInit: %s", this->stream.msg};
+    }
+}
+
+IO::Deflater::~Deflater() {
+    deflateEnd(&this->stream);
+}
+
+/**
+ * @brief Compresses a block of bytes.
+ *
+ * @param data Bytes to compress.
+ * @param size Number of bytes.
+ * @param output Where the compressed bytes are appended.
+ */
+void IO::Deflater::compress(const void* data, std::size_t size,
+                            std::string& output) {
+    this->run(data, size, Z_NO_FLUSH, output);
+}
+
+/**
+ * @brief Ends the compressed stream, appending whatever zlib still holds.
+ *
+ * @param output Where the compressed bytes are appended.
+ */
+void IO::Deflater::finish(std::string& output) {
+    this->run(nullptr, 0, Z_FINISH, output);
+}
+
+/**
+ * @brief Feeds zlib until it consumed the whole input (and, when finishing,
+ * until it wrote the end of the stream).
+ */
+void IO::Deflater::run(const void* data, std::size_t size, int flush,
+                       std::string& output) {
+    this->stream.next_in =
+        reinterpret_cast<Bytef*>(const_cast<void*>(data));
+    this->stream.avail_in = size;
+
+    int result;
+    do {
+        std::size_t used = output.size();
+        output.resize(used + CODEC_BLOCK_SIZE);
+        this->stream.next_out = reinterpret_cast<Bytef*>(&output[used]);
+        this->stream.avail_out = CODEC_BLOCK_SIZE;
+
+        result = deflate(&this->stream, flush);
+        output.resize(used + CODEC_BLOCK_SIZE - this->stream.avail_out);
+        if (result == Z_STREAM_ERROR) {
+            throw Error::Error{"deflate: error de compresion"};
+        }
+    } while (this->stream.avail_out == 0 ||
+             (flush == Z_FINISH && result != Z_STREAM_END));
+}
+
+IO::Inflater::Inflater() : stream() {
+    if (inflateInit(&this->stream) != Z_OK) {
+        throw Error::Error{"inflateInit: %s", this->stream.msg};
+    }
+}
+
+IO::Inflater::~Inflater() {
+    inflateEnd(&this->stream);
+}
+
+/**
+ * @brief Decompresses a block of a compressed stream.
+ *
+ * @param data Compressed bytes.
+ * @param size Number of bytes.
+ * @param output Where the decompressed bytes are appended.
+ * @throw Error::Error if the data is not a valid stream.
+ */
+void IO::Inflater::decompress(const void* data, std::size_t size,
+                              std::string& output) {
+    if (this->done) {
+        if (size > 0) {
+            throw Error::Error{"Datos despues del fin del archivo comprimido"};
+        }
+        return;
+    }
+
+    this->stream.next_in =
+        reinterpret_cast<Bytef*>(const_cast<void*>(data));
+    this->stream.avail_in = size;
+
+    do {
+        std::size_t used = output.size();
+        output.resize(used + CODEC_BLOCK_SIZE);
+        this->stream.next_out = reinterpret_cast<Bytef*>(&output[used]);
+        this->stream.avail_out = CODEC_BLOCK_SIZE;
+
+        int result = inflate(&this->stream, Z_NO_FLUSH);
+        output.resize(used + CODEC_BLOCK_SIZE - this->stream.avail_out);
+        if (result == Z_STREAM_END) {
+            this->done = true;
+            break;
+        }
+        if (result == Z_BUF_ERROR) {
+            /* needs more input */
+            break;
+        }
+        if (result != Z_OK) {
+            throw Error::Error{"Archivo comprimido invalido"};
+        }
+    } while (this->stream.avail_out == 0 || this->stream.avail_in > 0);
+
+    if (this->done && this->stream.avail_in > 0) {
+        throw Error::Error{"Datos despues del fin del archivo comprimido"};
+    }
+}
+
+/**
+ * @brief Whether the whole compressed stream was decompressed.
+ */
+bool IO::Inflater::finished() const {
+    return this->done;
+}
+
+/**
+ * @brief Construct a new BlockQueue.
+ *
+ * @param capacity Maximum number of blocks waiting in the queue.
+ */
+IO::BlockQueue::BlockQueue(std::size_t capacity) : capacity(capacity) {
+}
+
+IO::BlockQueue::~BlockQueue() {
+}
+
+/**
+ * @brief Adds a block, waiting for room if the queue is full.
+ *
+ * @param block Block to add.
+ * @return false if the queue was closed (the block is dropped).
+ */
+bool IO::BlockQueue::push(std::string&& block) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->changed.wait(lock, [this]() {
+        return this->closed || this->blocks.size() < this->capacity;
+    });
+    if (this->closed) {
+        return false;
+    }
+    this->blocks.push_back(std::move(block));
+    this->changed.notify_all();
+    return true;
+}
+
+/**
+ * @brief Takes the oldest block, waiting for one if the queue is empty.
+ *
+ * @param block Where the block is moved.
+ * @return false once the queue is closed and empty.
+ */
+bool IO::BlockQueue::pop(std::string& block) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->changed.wait(
+        lock, [this]() { return this->closed || !this->blocks.empty(); });
+    if (this->blocks.empty()) {
+        return false;
+    }
+    block = std::move(this->blocks.front());
+    this->blocks.pop_front();
+    this->changed.notify_all();
+    return true;
+}
+
+/**
+ * @brief Closes the queue: further pushes fail, and pops fail once the
+ * queued blocks are taken.
+ */
+void IO::BlockQueue::close() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->closed = true;
+    this->changed.notify_all();
+}
+
+/**
+ * @brief Sends a file compressed, in chunks.
+ * The file is read and compressed by a separate thread, so the compression
+ * of a block overlaps with the sending of the previous ones.
+ *
+ * @param comm Where the file is sent.
+ * @param file An opened stream.
+ */
+void IO::send_compressed(IO::Comm& comm, std::istream& file) {
+    comm.write_file_size(IO::CHUNKED_SIZE);
+
+    IO::BlockQueue blocks{CODEC_QUEUE_BLOCKS};
+    std::exception_ptr error;
+    std::thread compressor{[&]() {
+        try {
+            IO::Deflater deflater;
+            std::vector<char> buffer(CODEC_BLOCK_SIZE);
+            std::string output;
+            while (file.read(buffer.data(), buffer.size()),
+                   file.gcount() > 0) {
+                deflater.compress(buffer.data(), file.gcount(), output);
+
+                /* gathers the output in chunks of a reasonable size (an
+                 * empty one would end the file) */
+                if (output.size() >= CODEC_BLOCK_SIZE) {
+                    if (!blocks.push(std::move(output))) {
+                        break;
+                    }
+                    output.clear();
+                }
+            }
+            deflater.finish(output);
+            blocks.push(std::move(output));
+        } catch (...) {
+            error = std::current_exception();
+        }
+        blocks.close();
+    }};
+
+    try {
+        std::string block;
+        while (blocks.pop(block)) {
+            comm.write_chunk(block.data(), block.size());
+        }
+    } catch (...) {
+        blocks.close();
+        compressor.join();
+        throw;
+    }
+    compressor.join();
+
+    if (error) {
+        /* the file was cut short, the peer can't make sense of the rest */
+        std::rethrow_exception(error);
+    }
+    comm.write_chunk("", 0);
+}
+
+/**
+ * @brief Receives a compressed file.
+ * The file is decompressed by a separate thread, so receiving a block
+ * overlaps with the decompression and writing of the previous ones.
+ *
+ * @param comm Where the file is received from.
+ * @param sink Called with each block of the decompressed file, from the
+ * decompressing thread.
+ * @throw Error::Error if the file is not a valid compressed stream.
+ */
+void IO::receive_compressed(IO::Comm& comm, const IO::Sink& sink) {
+    IO::BlockQueue blocks{CODEC_QUEUE_BLOCKS};
+    std::exception_ptr error;
+    std::thread decompressor{[&]() {
+        try {
+            IO::Inflater inflater;
+            std::string block, output;
+            while (blocks.pop(block)) {
+                output.clear();
+                inflater.decompress(block.data(), block.size(), output);
+                if (!output.empty()) {
+                    sink(output.data(), output.size());
+                }
+            }
+            if (!inflater.finished()) {
+                throw Error::Error{"Archivo comprimido incompleto"};
+            }
+        } catch (...) {
+            error = std::current_exception();
+            blocks.close();
+        }
+    }};
+
+    /* reads the given number of bytes in blocks */
+    auto forward = [&](uint64_t size) -> bool {
+        while (size > 0) {
+            std::string block(std::min<uint64_t>(size, CODEC_BLOCK_SIZE), 0);
+            if (comm.read(&block.front(), block.size()) !=
+                static_cast<ssize_t>(block.size())) {
+                throw IO::CommError{"Error en la lectura de archivo"};
+            }
+            size -= block.size();
+            if (!blocks.push(std::move(block))) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    try {
+        uint64_t size = comm.read_file_size();
+        if (size != IO::CHUNKED_SIZE) {
+            forward(size);
+        } else {
+            uint32_t chunk;
+            while ((chunk = comm.read_chunk_size()) > 0 && forward(chunk)) {
+            }
+        }
+    } catch (...) {
+        blocks.close();
+        decompressor.join();
+        throw;
+    }
+    blocks.close();
+    decompressor.join();
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
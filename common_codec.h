@@ -0,0 +1,89 @@
+#ifndef COMMON_CODEC_H_
+#define COMMON_CODEC_H_
+
+#include <zlib.h>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <istream>
+#include <mutex>
+#include <string>
+#include "common_comm.h"
+
+namespace IO {
+/**
+ * @brief Streaming zlib compressor. The output of every call is appended
+ * to the given string, and may be empty while zlib gathers more input.
+ */
+class Deflater {
+   public:
+    explicit Deflater(int level = Z_BEST_SPEED);
+    ~Deflater();
+
+    Deflater(const Deflater& other) = delete;
+    Deflater& operator=(const Deflater& other) = delete;
+
+    void compress(const void* data, std::size_t size, std::string& output);
+    void finish(std::string& output);
+
+   private:
+    void run(const void* data, std::size_t size, int flush,
+             std::string& output);
+
+    z_stream stream;
+};
+
+/**
+ * @brief Streaming zlib decompressor, the counterpart of `Deflater`.
+ */
+class Inflater {
+   public:
+    Inflater();
+    ~Inflater();
+
+    Inflater(const Inflater& other) = delete;
+    Inflater& operator=(const Inflater& other) = delete;
+
+    void decompress(const void* data, std::size_t size, std::string& output);
+    bool finished() const;
+
+   private:
+    z_stream stream;
+    /** Whether the end of the compressed stream was reached. */
+    bool done{false};
+};
+
+/**
+ * @brief Bounded queue that hands blocks of bytes from one thread to
+ * another. The producer blocks while it is full, so a slow consumer holds
+ * back the producer instead of piling up blocks in memory.
+ */
+class BlockQueue {
+   public:
+    explicit BlockQueue(std::size_t capacity);
+    ~BlockQueue();
+
+    BlockQueue(const BlockQueue& other) = delete;
+    BlockQueue& operator=(const BlockQueue& other) = delete;
+
+    bool push(std::string&& block);
+    bool pop(std::string& block);
+    void close();
+
+   private:
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::string> blocks;
+    std::size_t capacity;
+    bool closed{false};
+};
+
+/** Receives each block of a decompressed file. */
+using Sink = std::function<void(const char* data, std::size_t size)>;
+
+void send_compressed(Comm& comm, std::istream& file);
+void receive_compressed(Comm& comm, const Sink& sink);
+}  // namespace IO
+
+#endif
@@ -0,0 +1,331 @@
+#include "common_comm.h"
+#include <arpa/inet.h>
+#include <endian.h>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include "common_error.h"
+
+/**
+ * @brief Insertion operator for the Comm class.
+ *
+ * @param c Unsigned byte to write (in network order).
+ * @return self.
+ */
+IO::Comm& IO::Comm::operator<<(uint8_t c) {
+    this->write(&c, sizeof(c));
+    return *this;
+}
+
+/**
+ * @brief Insertion operator for the Comm class.
+ *
+ * @param r Response to write.
+ * @return self.
+ */
+IO::Comm& IO::Comm::operator<<(IO::Response r) {
+    switch (r) {
+        case IO::Response::OK:
+            return *this << static_cast<uint8_t>(1);
+        case IO::Response::Error:
+            return *this << static_cast<uint8_t>(0);
+        case IO::Response::Busy:
+            return *this << static_cast<uint8_t>(2);
+        default:
+            throw Error::Error{"Unexpected response type"};
+    }
+
+    return *this;
+}
+
+/**
+ * @brief Insertion operator for the Comm class.
+ *
+ * @param i Unsigned integer to write (in network order).
+ * @return self.
+ */
+IO::Comm& IO::Comm::operator<<(uint32_t i) {
+    /* writes the integer in network byte order */
+    auto output = htonl(i);
+    this->write(&output, sizeof(output));
+    return *this;
+}
+
+/**
+ * @brief Insertion operator for the Comm class.
+ *
+ * @param i Unsigned 64 bit integer to write (in network order).
+ * @return self.
+ */
+IO::Comm& IO::Comm::operator<<(uint64_t i) {
+    auto output = htobe64(i);
+    this->write(&output, sizeof(output));
+    return *this;
+}
+
+/**
+ * @brief Insertion operator for the Comm class.
+ *
+ * @param s C string to write.
+ * @return self.
+ *
+ * @note The string is written as a 4 byte value with the length and the content
+ * after that.
+ */
+IO::Comm& IO::Comm::operator<<(const char* s) {
+    /* writes the string length first */
+    uint32_t len = strlen(s);
+    *this << len;
+
+    /* writes the actual string content */
+    this->write(s, len);
+    return *this;
+}
+
+/**
+ * @brief Insertion operator for the Comm class.
+ *
+ * @param s String to write.
+ * @return self.
+ *
+ * @note The string is written as a 4 byte value with the length and the content
+ * after that.
+ */
+IO::Comm& IO::Comm::operator<<(const std::string& s) {
+    return *this << s.c_str();
+}
+
+/**
+ * @brief Extraction operator for the Comm class.
+ *
+ * @param c To reference to the byte where the read value is written
+ * (converted to host order).
+ * @return self.
+ */
+IO::Comm& IO::Comm::operator>>(uint8_t& c) {
+    if (this->read(&c, sizeof(c)) != sizeof(c)) {
+        throw IO::CommError{"Error en la lectura de u8"};
+    }
+    return *this;
+}
+
+/**
+ * @brief Extraction operator for the Comm class.
+ *
+ * @param r Response to write.
+ * @return self.
+ */
+IO::Comm& IO::Comm::operator>>(IO::Response& r) {
+    uint8_t code;
+    *this >> code;
+
+    switch (code) {
+        case 1:
+            r = IO ::Response::OK;
+            break;
+        case 0:
+            r = IO::Response::Error;
+            break;
+        case 2:
+            r = IO::Response::Busy;
+            break;
+        default:
+            throw Error::Error{"Valor de respuesta invalido"};
+    }
+
+    return *this;
+}
+
+/**
+ * @brief Extraction operator for the Comm class.
+ *
+ * @param i To reference to the integer where the read value is written
+ * (converted to host order).
+ * @return self.
+ */
+IO::Comm& IO::Comm::operator>>(uint32_t& i) {
+    /* reads from the Comm in network order */
+    uint32_t tmp;
+    if (this->read(&tmp, sizeof(tmp)) != sizeof(i)) {
+        throw IO::CommError{"Error en la lectura de u32"};
+    }
+
+    /* converts to host order and sets the output */
+    i = ntohl(tmp);
+    return *this;
+}
+
+/**
+ * @brief Extraction operator for the Comm class.
+ *
+ * @param i To reference to the 64 bit integer where the read value is
+ * written (converted to host order).
+ * @return self.
+ */
+IO::Comm& IO::Comm::operator>>(uint64_t& i) {
+    uint64_t tmp;
+    if (this->read(&tmp, sizeof(tmp)) != sizeof(i)) {
+        throw IO::CommError{"Error en la lectura de u64"};
+    }
+    i = be64toh(tmp);
+    return *this;
+}
+
+/**
+ * @brief Extraction operator for the Comm class.
+ *
+ * @param s String to be read.
+ * @return self.
+ */
+IO::Comm& IO::Comm::operator>>(std::string& s) {
+    /* first it reads the string length as a 4 byte value in host order */
+    uint32_t len;
+    *this >> len;
+
+    /* preallocates the required space into the string */
+    s.resize(len);
+
+    /* gets the actual content */
+    if (this->read(&s.front(), len) != static_cast<ssize_t>(len)) {
+        throw IO::CommError{"Error en la lectura de string"};
+    }
+    return *this;
+}
+
+/**
+ * @brief Sends the file with the given name, exactly as `operator<<` would
+ * send it once opened. Implementations may override it to send the file
+ * more efficiently.
+ *
+ * @param file_name Name of the file to send.
+ */
+void IO::Comm::send_file(const std::string& file_name) {
+    std::ifstream file{file_name, std::ios::binary};
+    *this << file;
+}
+
+/**
+ * @brief Receives a file and writes it with the given name.
+ *
+ * @param file_name Name of the file to write.
+ */
+void IO::Comm::receive_file(const std::string& file_name) {
+    this->receive_file(file_name, IO::Progress{});
+}
+
+/**
+ * @brief Receives a file and writes it with the given name, exactly as
+ * `operator>>` would. Implementations may override it to receive the file
+ * more efficiently, and to report the progress more often.
+ *
+ * @param file_name Name of the file to write.
+ * @param progress Called with the bytes written so far (may be empty).
+ */
+void IO::Comm::receive_file(const std::string& file_name,
+                            const IO::Progress& progress) {
+    std::ofstream file{file_name, std::ios::binary};
+    *this >> file;
+    file.close();
+    if (!file) {
+        throw Error::Error{"Error escribiendo %s", file_name.c_str()};
+    }
+    if (progress) {
+        std::ifstream written{file_name, std::ios::binary | std::ios::ate};
+        progress(written.tellg());
+    }
+}
+
+/**
+ * @brief Sets the protocol revision agreed with the peer.
+ *
+ * @param version Protocol revision.
+ */
+void IO::Comm::set_version(uint32_t version) {
+    this->version = version;
+}
+
+/**
+ * @brief Gets the protocol revision in use.
+ *
+ * @return Protocol revision.
+ */
+uint32_t IO::Comm::get_version() const {
+    return this->version;
+}
+
+/**
+ * @brief Sets the compression of the file bodies agreed with the peer.
+ *
+ * @param codec Compression.
+ */
+void IO::Comm::set_codec(IO::Codec codec) {
+    this->codec = codec;
+}
+
+/**
+ * @brief Gets the compression of the file bodies.
+ *
+ * @return Compression.
+ */
+IO::Codec IO::Comm::get_codec() const {
+    return this->codec;
+}
+
+/**
+ * @brief Writes the size that precedes a file, as the protocol revision in
+ * use encodes it.
+ *
+ * @param size File size, or `CHUNKED_SIZE` if the file follows in chunks
+ * (see `write_chunk`).
+ */
+void IO::Comm::write_file_size(uint64_t size) {
+    if (this->version >= 2) {
+        *this << size;
+        return;
+    }
+    if (size > UINT32_MAX) {
+        throw Error::Error{"Archivo demasiado grande para el protocolo 1"};
+    }
+    *this << static_cast<uint32_t>(size);
+}
+
+/**
+ * @brief Reads the size that precedes a file.
+ *
+ * @return File size, or `CHUNKED_SIZE` if the file follows in chunks (see
+ * `read_chunk_size`).
+ */
+uint64_t IO::Comm::read_file_size() {
+    if (this->version >= 2) {
+        uint64_t size;
+        *this >> size;
+        return size;
+    }
+    uint32_t size;
+    *this >> size;
+    return size;
+}
+
+/**
+ * @brief Writes a chunk of a file sent in chunks. An empty chunk ends the
+ * file.
+ *
+ * @param data Chunk content.
+ * @param size Chunk size.
+ */
+void IO::Comm::write_chunk(const void* data, uint32_t size) {
+    *this << size;
+    this->write(data, size);
+}
+
+/**
+ * @brief Reads the size of the next chunk of a file sent in chunks. The
+ * chunk content follows.
+ *
+ * @return Chunk size, 0 at the end of the file.
+ */
+uint32_t IO::Comm::read_chunk_size() {
+    uint32_t size;
+    *this >> size;
+    return size;
+}
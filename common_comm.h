@@ -3,16 +3,47 @@
 
 #include <cinttypes>
 #include <fstream>
+#include <functional>
 #include <string>
 #include "common_error.h"
 
 namespace IO {
-/** Enums representing the server responses. */
-enum class Response { OK, Error };
+/**
+ * Enums representing the server responses. `Busy` (revision 8) answers the
+ * `hello` of a client the server is too loaded to serve.
+ */
+enum class Response { OK, Error, Busy };
 
 /** Valid actions. */
 enum class Action { Push, Pull, Tag };
 
+/**
+ * Latest protocol revision. Revision 1 is the original one, which every
+ * connection speaks until a `hello` command agrees on another. Revision 2
+ * sends 64 bit file sizes and allows sending files in chunks. Revision 3
+ * adds the `have` command, revision 4 the `manifest` and `fetch` commands,
+ * revision 5 the `compress` command, revision 6 the `signatures` and
+ * `delta` commands, revision 7 the `stats` command, revision 8 the `Busy`
+ * response, and revision 9 a final response to `push` and `delta` telling
+ * whether the file was committed.
+ */
+const uint32_t PROTOCOL_VERSION = 9;
+
+/**
+ * Compression of the file bodies, agreed through a `compress` command
+ * (revision 5). Compressed files are sent as a zlib stream, in chunks.
+ */
+enum class Codec : uint8_t { None = 0, Deflate = 1 };
+
+/** File size announcing that the file follows in chunks (revision 2). */
+const uint64_t CHUNKED_SIZE = UINT64_MAX;
+
+/**
+ * Called while a file is received with the number of bytes written to it so
+ * far.
+ */
+using Progress = std::function<void(uint64_t)>;
+
 /** Communication errors. */
 class CommError : public Error::Error {
    public:
@@ -23,7 +54,12 @@ class CommError : public Error::Error {
     }
 };
 
-/** Interface that the communication objects must implement. */
+/**
+ * @brief Interface that the communication objects must implement.
+ * The encoding of the primitive types is shared by every implementation and
+ * is built on top of `write` and `read`, so only those and the file transfers
+ * need to be provided.
+ */
 class Comm {
    public:
     Comm() {
@@ -31,22 +67,49 @@ class Comm {
     virtual ~Comm() {
     }
 
-    virtual Comm& operator<<(uint8_t c) = 0;
-    virtual Comm& operator<<(Response r) = 0;
-    virtual Comm& operator<<(uint32_t i) = 0;
-    virtual Comm& operator<<(const char* s) = 0;
-    virtual Comm& operator<<(const std::string& s) = 0;
+    virtual Comm& operator<<(uint8_t c);
+    virtual Comm& operator<<(Response r);
+    virtual Comm& operator<<(uint32_t i);
+    virtual Comm& operator<<(uint64_t i);
+    virtual Comm& operator<<(const char* s);
+    virtual Comm& operator<<(const std::string& s);
     virtual Comm& operator<<(std::ifstream& s) = 0;
 
-    virtual Comm& operator>>(uint8_t& c) = 0;
-    virtual Comm& operator>>(Response& r) = 0;
-    virtual Comm& operator>>(uint32_t& i) = 0;
-    virtual Comm& operator>>(std::string& s) = 0;
+    virtual Comm& operator>>(uint8_t& c);
+    virtual Comm& operator>>(Response& r);
+    virtual Comm& operator>>(uint32_t& i);
+    virtual Comm& operator>>(uint64_t& i);
+    virtual Comm& operator>>(std::string& s);
     virtual Comm& operator>>(std::ofstream& s) = 0;
 
+    virtual void send_file(const std::string& file_name);
+    void receive_file(const std::string& file_name);
+    virtual void receive_file(const std::string& file_name,
+                              const Progress& progress);
+
     /* this functions should be implemented by the base class. */
     virtual void write(const void* data, std::size_t size) = 0;
     virtual ssize_t read(void* data, std::size_t size) = 0;
+
+    /** protocol revision */
+    void set_version(uint32_t version);
+    uint32_t get_version() const;
+
+    /** compression of the file bodies */
+    void set_codec(Codec codec);
+    Codec get_codec() const;
+
+    /** file framing */
+    void write_file_size(uint64_t size);
+    uint64_t read_file_size();
+    void write_chunk(const void* data, uint32_t size);
+    uint32_t read_chunk_size();
+
+   private:
+    /** Protocol revision in use. */
+    uint32_t version{1};
+    /** Compression of the file bodies. */
+    Codec codec{Codec::None};
 };
 }  // namespace IO
 
@@ -0,0 +1,291 @@
+#include "common_comm_buffer.h"
+#include <arpa/inet.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <utility>
+#include "common_error.h"
+
+/** size of the chunks read from queued files */
+#define FILE_CHUNK_SIZE ((uint64_t)64 * 1024)
+
+IO::CommBuffer::CommBuffer() {
+}
+
+IO::CommBuffer::~CommBuffer() {
+}
+
+/**
+ * @brief Queues a chunk of bytes to be sent.
+ *
+ * @param data Pointer to the data buffer.
+ * @param size Size of the input buffer.
+ */
+void IO::CommBuffer::write(const void* data, std::size_t size) {
+    /* small writes are coalesced into the last in-memory segment */
+    if (this->output.empty() || this->output.back().file) {
+        this->output.emplace_back();
+    }
+    this->output.back().data.append(static_cast<const char*>(data), size);
+    this->output_size += size;
+}
+
+/**
+ * @brief Reads a chunk of bytes from the buffered input.
+ *
+ * @param data Output buffer.
+ * @param size Bytes to read.
+ * @return Bytes read (always `size`).
+ * @throw NeedMore if the input doesn't hold `size` bytes yet.
+ */
+ssize_t IO::CommBuffer::read(void* data, std::size_t size) {
+    if (this->input.size() - this->cursor < size) {
+        throw IO::NeedMore{};
+    }
+    memcpy(data, this->input.data() + this->cursor, size);
+    this->cursor += size;
+    return size;
+}
+
+/**
+ * @brief Queues a file to be sent. The stream is moved into the queue, so
+ * the caller's stream is left empty.
+ *
+ * @param file An opened stream.
+ * @return self.
+ */
+IO::Comm& IO::CommBuffer::operator<<(std::ifstream& file) {
+    /* gets the file size */
+    file.seekg(0, std::ios_base::end);
+    std::streamoff length = file.tellg();
+    file.seekg(0, std::ios_base::beg);
+    if (length < 0) {
+        length = 0;
+    }
+
+    Segment segment;
+    if (this->get_codec() != IO::Codec::None) {
+        /* the compressed size is unknown, so it goes in chunks */
+        this->write_file_size(IO::CHUNKED_SIZE);
+        segment.deflater.reset(new IO::Deflater{});
+    } else {
+        /* the size goes first, as in any other Comm */
+        this->write_file_size(length);
+    }
+
+    segment.file.reset(new std::ifstream{std::move(file)});
+    segment.file_remaining = length;
+    this->output.push_back(std::move(segment));
+    /* compressed files are counted by their original size until they are
+     * actually compressed */
+    this->output_size += length;
+    return *this;
+}
+
+/**
+ * @brief Receives a whole file from the buffered input.
+ *
+ * @param file An opened file stream to write the data.
+ * @return self.
+ * @throw NeedMore if the input doesn't hold the whole file yet.
+ */
+IO::Comm& IO::CommBuffer::operator>>(std::ofstream& file) {
+    /* writes the body as is, or decompressed */
+    std::unique_ptr<IO::Inflater> inflater;
+    if (this->get_codec() != IO::Codec::None) {
+        inflater.reset(new IO::Inflater{});
+    }
+    std::string decompressed;
+    auto put = [&](const char* data, std::size_t size) {
+        if (!inflater) {
+            file.write(data, size);
+            return;
+        }
+        decompressed.clear();
+        inflater->decompress(data, size, decompressed);
+        file.write(decompressed.data(), decompressed.size());
+    };
+
+    uint64_t size = this->read_file_size();
+    if (size != IO::CHUNKED_SIZE) {
+        if (this->input.size() - this->cursor < size) {
+            throw IO::NeedMore{};
+        }
+        put(this->input.data() + this->cursor, size);
+        this->cursor += size;
+    } else {
+        /* checks that every chunk arrived before writing any of them */
+        std::size_t start = this->cursor;
+        uint32_t chunk;
+        while ((chunk = this->read_chunk_size()) > 0) {
+            if (this->input.size() - this->cursor < chunk) {
+                throw IO::NeedMore{};
+            }
+            this->cursor += chunk;
+        }
+
+        std::size_t end = this->cursor;
+        this->cursor = start;
+        while ((chunk = this->read_chunk_size()) > 0) {
+            put(this->input.data() + this->cursor, chunk);
+            this->cursor += chunk;
+        }
+        this->cursor = end;
+    }
+
+    if (inflater && !inflater->finished()) {
+        throw Error::Error{"Archivo comprimido incompleto"};
+    }
+    return *this;
+}
+
+/**
+ * @brief Appends received bytes to the input buffer.
+ *
+ * @param data Received bytes.
+ * @param size Number of bytes.
+ */
+void IO::CommBuffer::feed(const void* data, std::size_t size) {
+    this->input.append(static_cast<const char*>(data), size);
+}
+
+/**
+ * @brief Moves the read position back to the first unprocessed byte, so a
+ * partially decoded message can be decoded again from the start.
+ */
+void IO::CommBuffer::rewind() {
+    this->cursor = this->consumed;
+}
+
+/**
+ * @brief Marks everything read so far as processed.
+ */
+void IO::CommBuffer::commit() {
+    this->consumed = this->cursor;
+
+    /* drops the processed prefix once it is worth the copy */
+    if (this->consumed == this->input.size()) {
+        this->input.clear();
+        this->consumed = this->cursor = 0;
+    } else if (this->consumed > FILE_CHUNK_SIZE &&
+               this->consumed > this->input.size() / 2) {
+        this->input.erase(0, this->consumed);
+        this->consumed = this->cursor = 0;
+    }
+}
+
+/**
+ * @brief Number of received bytes not read yet.
+ *
+ * @return Available bytes.
+ */
+std::size_t IO::CommBuffer::available() const {
+    return this->input.size() - this->cursor;
+}
+
+/**
+ * @brief Pointer to the first byte not read yet.
+ *
+ * @return Pointer into the input buffer, valid until the next `feed`.
+ */
+const char* IO::CommBuffer::peek() const {
+    return this->input.data() + this->cursor;
+}
+
+/**
+ * @brief Marks the given number of bytes as read and processed.
+ *
+ * @param size Number of bytes (at most `available()`).
+ */
+void IO::CommBuffer::skip(std::size_t size) {
+    this->cursor += std::min(size, this->available());
+    this->commit();
+}
+
+/**
+ * @brief Sends as much of the queued output as the socket accepts without
+ * blocking.
+ *
+ * @param socket Non blocking socket to write to.
+ * @return true if the whole output was sent.
+ */
+bool IO::CommBuffer::flush(IO::Socket& socket) {
+    while (!this->output.empty()) {
+        Segment& segment = this->output.front();
+
+        if (segment.offset == segment.data.size()) {
+            if (segment.file_remaining == 0 && !segment.deflater) {
+                this->output.pop_front();
+                continue;
+            }
+            this->load(segment);
+        }
+
+        ssize_t bytes_written =
+            socket.try_write(segment.data.data() + segment.offset,
+                             segment.data.size() - segment.offset);
+        if (bytes_written < 0) {
+            return false;
+        }
+        segment.offset += bytes_written;
+        this->output_size -= bytes_written;
+    }
+    return true;
+}
+
+/**
+ * @brief Loads the next chunk of a queued file into its segment. Compressed
+ * files are compressed as they are loaded, and framed as chunks.
+ *
+ * @param segment Segment of the file, whose loaded data was already sent.
+ */
+void IO::CommBuffer::load(Segment& segment) {
+    std::size_t chunk = std::min<uint64_t>(segment.file_remaining,
+                                           FILE_CHUNK_SIZE);
+    std::string raw(chunk, 0);
+    if (chunk > 0) {
+        segment.file->read(&raw.front(), chunk);
+        if (segment.file->gcount() != static_cast<std::streamsize>(chunk)) {
+            throw Error::Error{"Error leyendo archivo a enviar"};
+        }
+    }
+    segment.file_remaining -= chunk;
+    segment.offset = 0;
+
+    if (!segment.deflater) {
+        segment.data = std::move(raw);
+        return;
+    }
+
+    std::string compressed;
+    segment.deflater->compress(raw.data(), raw.size(), compressed);
+    if (segment.file_remaining == 0) {
+        segment.deflater->finish(compressed);
+        segment.deflater.reset();
+    }
+
+    /* zlib may hold the output back, and an empty chunk would end the file */
+    segment.data.clear();
+    if (!compressed.empty()) {
+        uint32_t size = htonl(compressed.size());
+        segment.data.append(reinterpret_cast<const char*>(&size), sizeof(size));
+        segment.data.append(compressed);
+    }
+    if (!segment.deflater) {
+        uint32_t end = 0;
+        segment.data.append(reinterpret_cast<const char*>(&end), sizeof(end));
+    }
+
+    /* the file was counted by its original size */
+    this->output_size = this->output_size - chunk + segment.data.size();
+}
+
+/**
+ * @brief Number of queued output bytes (including queued files).
+ *
+ * @return Pending bytes.
+ */
+std::size_t IO::CommBuffer::pending() const {
+    return this->output_size;
+}
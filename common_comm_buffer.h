@@ -0,0 +1,87 @@
+#ifndef COMMON_COMM_BUFFER_H_
+#define COMMON_COMM_BUFFER_H_
+
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <string>
+#include "common_codec.h"
+#include "common_comm.h"
+#include "common_socket.h"
+
+namespace IO {
+/**
+ * @brief Thrown when a message can't be decoded because the input buffer
+ * doesn't hold all of it yet. The reader should rewind and try again once
+ * more data arrives.
+ */
+class NeedMore : public Error::Error {
+   public:
+    NeedMore() : Error("incomplete message") {
+    }
+    ~NeedMore() {
+    }
+};
+
+/**
+ * @brief Comm that works over in-memory buffers instead of a socket.
+ * Incoming bytes are fed by the owner (usually read from a non blocking
+ * socket) and outgoing messages are queued until the socket is writable.
+ * Files are queued by reference and read lazily while flushing, so large
+ * responses are never fully loaded in memory (compressed ones are also
+ * compressed lazily).
+ */
+class CommBuffer : public Comm {
+   public:
+    CommBuffer();
+    ~CommBuffer();
+
+    /* overrides */
+    virtual void write(const void* data, std::size_t size) override;
+    virtual ssize_t read(void* data, std::size_t size) override;
+
+    using Comm::operator<<;
+    using Comm::operator>>;
+
+    virtual Comm& operator<<(std::ifstream& file) override;
+    virtual Comm& operator>>(std::ofstream& file) override;
+
+    /** input */
+    void feed(const void* data, std::size_t size);
+    void rewind();
+    void commit();
+    std::size_t available() const;
+    const char* peek() const;
+    void skip(std::size_t size);
+
+    /** output */
+    bool flush(Socket& socket);
+    std::size_t pending() const;
+
+   private:
+    /** Chunk of output, either in memory or still in a file. */
+    struct Segment {
+        std::string data;
+        std::size_t offset{0};
+        std::unique_ptr<std::ifstream> file;
+        uint64_t file_remaining{0};
+        /** Compresses the file, until its end is queued. */
+        std::unique_ptr<Deflater> deflater;
+    };
+
+    void load(Segment& segment);
+
+    /** Received bytes. */
+    std::string input;
+    /** Bytes of `input` that belong to already processed messages. */
+    std::size_t consumed{0};
+    /** Read position of the message being decoded. */
+    std::size_t cursor{0};
+    /** Queued output. */
+    std::deque<Segment> output;
+    /** Total bytes queued in `output`. */
+    std::size_t output_size{0};
+};
+}  // namespace IO
+
+#endif
@@ -1,251 +1,466 @@
 #include "common_comm_socket.h"
-#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <algorithm>
+#include <cerrno>
 #include <cstring>
-#include <limits>
 #include <string>
+#include "common_codec.h"
 #include "common_error.h"
 
+/** size of the output buffer */
+#define OUTPUT_BUFFER_SIZE ((std::size_t)64 * 1024)
+/** size of the input buffer */
+#define INPUT_BUFFER_SIZE ((std::size_t)64 * 1024)
+
 IO::CommSocket::CommSocket(const std::string& address,
                            const std::string& service) {
     this->socket.connect(address, service);
+    /* writes are already coalesced, so they shouldn't wait for ACKs */
+    this->socket.set_nodelay(true);
 }
 
 IO::CommSocket::CommSocket(IO::Socket&& socket) : socket(std::move(socket)) {
+    this->socket.set_nodelay(true);
 }
 
 IO::CommSocket::~CommSocket() {
+    try {
+        this->flush();
+    } catch (const std::exception& e) {
+        /* the peer is gone, there is no one to send the data to */
+    }
 }
 
 /**
- * @brief Writes a chunk of bytes into the internal socket.
+ * @brief Writes a chunk of bytes into the internal socket. Small chunks are
+ * buffered and sent later.
  *
  * @param data Pointer to the data buffer.s
  * @param size Size of the input buffer.
  */
 void IO::CommSocket::write(const void* data, std::size_t size) {
-    this->socket.write(data, size);
+    if (!this->buffering) {
+        this->socket.write(data, size);
+        return;
+    }
+
+    if (this->output.size() + size <= OUTPUT_BUFFER_SIZE) {
+        this->output.append(static_cast<const char*>(data), size);
+        return;
+    }
+
+    /* sends the buffered bytes and the new ones together */
+    this->socket.write(this->output.data(), this->output.size(), data, size);
+    this->output.clear();
+}
+
+/**
+ * @brief Sends the buffered output.
+ */
+void IO::CommSocket::flush() {
+    if (this->output.empty()) {
+        return;
+    }
+    this->socket.write(this->output.data(), this->output.size());
+    this->output.clear();
 }
 
 /**
  * @brief Reads a chunk of bytes from the internal socket.
+ * Blocks until the `size` bytes arrive or the peer closes the connection.
+ * The pending output is sent before blocking, since the peer may be waiting
+ * for it to answer.
  *
  * @param data Output buffer.
  * @param size Bytes to read.
  * @return ssize_t Bytes actually read or negative value in case of error.
  */
 ssize_t IO::CommSocket::read(void* data, std::size_t size) {
-    return this->socket.read(data, size);
-}
+    if (!this->buffering) {
+        return this->socket.read(data, size);
+    }
 
-/**
- * @brief Insertion operator for the Comm class.
- *
- * @param c Unsigned byte to write (in network order).
- * @return self.
- */
-IO::Comm& IO::CommSocket::operator<<(uint8_t c) {
-    this->write(&c, sizeof(c));
-    return *this;
-}
+    auto out = static_cast<char*>(data);
+    std::size_t total_bytes_read = this->read_buffered(out, size);
+    if (total_bytes_read == size) {
+        return size;
+    }
 
-/**
- * @brief Insertion operator for the Comm class.
- *
- * @param r Response to write.
- * @return self.
- */
-IO::Comm& IO::CommSocket::operator<<(IO::Response r) {
-    switch (r) {
-        case IO::Response::OK:
-            return *this << static_cast<uint8_t>(1);
-        case IO::Response::Error:
-            return *this << static_cast<uint8_t>(0);
-        default:
-            throw Error::Error{"Unexpected response type"};
+    this->flush();
+
+    /* large reads skip the buffer */
+    if (size - total_bytes_read >= INPUT_BUFFER_SIZE) {
+        ssize_t bytes_read =
+            this->socket.read(out + total_bytes_read, size - total_bytes_read);
+        return total_bytes_read + bytes_read;
     }
 
-    return *this;
+    if (this->input.empty()) {
+        this->input.resize(INPUT_BUFFER_SIZE);
+    }
+    while (total_bytes_read < size) {
+        ssize_t bytes_read =
+            this->socket.read_some(this->input.data(), this->input.size());
+        if (bytes_read == 0) {
+            /* the peer closed the connection */
+            break;
+        }
+        this->input_begin = 0;
+        this->input_end = bytes_read;
+        total_bytes_read += this->read_buffered(out + total_bytes_read,
+                                                size - total_bytes_read);
+    }
+    return total_bytes_read;
 }
 
 /**
- * @brief Insertion operator for the Comm class.
+ * @brief Takes bytes from the input buffer.
  *
- * @param i Unsigned integer to write (in network order).
- * @return self.
+ * @param data Output buffer.
+ * @param size Maximum number of bytes to take.
+ * @return Bytes taken.
  */
-IO::Comm& IO::CommSocket::operator<<(uint32_t i) {
-    /* writes the integer in network byte order */
-    auto output = htonl(i);
-    this->write(&output, sizeof(output));
-    return *this;
+std::size_t IO::CommSocket::read_buffered(void* data, std::size_t size) {
+    std::size_t bytes = std::min(size, this->input_end - this->input_begin);
+    memcpy(data, this->input.data() + this->input_begin, bytes);
+    this->input_begin += bytes;
+    return bytes;
 }
 
 /**
- * @brief Insertion operator for the Comm class.
+ * @brief Sends a file through the socket.
+ * With protocol revision 2 the stream is sent in chunks, so it is read only
+ * once. Revision 1 requires the size first, which is taken by seeking to
+ * the end of the stream. If the connection agreed on a compression, the
+ * stream is compressed by a separate thread as it is sent.
  *
- * @param s C string to write.
+ * @param file An opened stream.
  * @return self.
- *
- * @note The string is written as a 4 byte value with the length and the content
- * after that.
  */
-IO::Comm& IO::CommSocket::operator<<(const char* s) {
-    /* writes the string length first */
-    uint32_t len = strlen(s);
-    *this << len;
+IO::Comm& IO::CommSocket::operator<<(std::ifstream& file) {
+#define STREAM_CHUNK_SIZE 65536
+    if (this->get_codec() != IO::Codec::None) {
+        IO::send_compressed(*this, file);
+        return *this;
+    }
 
-    /* writes the actual string content */
-    this->write(s, len);
-    return *this;
-}
+    if (this->get_version() >= 2) {
+        this->write_file_size(IO::CHUNKED_SIZE);
 
-/**
- * @brief Insertion operator for the Comm class.
- *
- * @param s String to write.
- * @return self.
- *
- * @note The string is written as a 4 byte value with the length and the content
- * after that.
- */
-IO::Comm& IO::CommSocket::operator<<(const std::string& s) {
-    return *this << s.c_str();
-}
+        char buffer[STREAM_CHUNK_SIZE];
+        while (file.read(buffer, sizeof(buffer)), file.gcount() > 0) {
+            this->write_chunk(buffer, file.gcount());
+        }
+        this->write_chunk("", 0);
+        return *this;
+    }
 
-/**
- * @brief Extraction operator for the Comm class.
- *
- * @param c To reference to the byte where the read value is written
- * (converted to host order).
- * @return self.
- */
-IO::Comm& IO::CommSocket::operator>>(uint8_t& c) {
-    if (this->read(&c, sizeof(c)) != sizeof(c)) {
-        throw IO::CommError{"Error en la lectura de u8"};
+    /* gets the file size */
+    file.seekg(0, std::ios_base::end);
+    std::streamoff length = file.tellg();
+    file.seekg(0, std::ios_base::beg);
+    if (length < 0) {
+        length = 0;
+    }
+
+    /* sends the whole file size first */
+    this->write_file_size(length);
+
+    /* sends the file contents in chunks */
+    char buffer[STREAM_CHUNK_SIZE];
+    std::streamoff total_bytes_read = 0;
+    while (total_bytes_read < length) {
+        file.read(buffer, std::min<std::streamoff>(sizeof(buffer),
+                                                   length - total_bytes_read));
+        std::streamsize bytes_read = file.gcount();
+        if (bytes_read <= 0) {
+            throw Error::Error{"Error leyendo archivo a enviar"};
+        }
+        this->write(buffer, bytes_read);
+        total_bytes_read += bytes_read;
     }
+
     return *this;
 }
 
 /**
- * @brief Extraction operator for the Comm class.
+ * @brief Receives a file from the socket.
  *
- * @param r Response to write.
+ * @param file An opened file stream to write the data.
  * @return self.
  */
-IO::Comm& IO::CommSocket::operator>>(IO::Response& r) {
-    uint8_t code;
-    *this >> code;
+IO::Comm& IO::CommSocket::operator>>(std::ofstream& file) {
+#define BUFFER_SIZE ((uint64_t)65536)
+    if (this->get_codec() != IO::Codec::None) {
+        IO::receive_compressed(*this, [&file](const char* data,
+                                              std::size_t size) {
+            file.write(data, size);
+        });
+        return *this;
+    }
 
-    switch (code) {
-        case 1:
-            r = IO ::Response::OK;
-            break;
-        case 0:
-            r = IO::Response::Error;
-            break;
-        default:
-            throw Error::Error{"Valor de respuesta invalido"};
+    uint64_t size = this->read_file_size();
+    bool chunked = size == IO::CHUNKED_SIZE;
+    if (chunked) {
+        size = this->read_chunk_size();
+    }
+
+    while (size > 0) {
+        /* reads the file (or the chunk) by pieces */
+        uint64_t total_bytes_read = 0;
+        while (total_bytes_read < size) {
+            char buffer[BUFFER_SIZE];
+            uint64_t piece = std::min(size - total_bytes_read, BUFFER_SIZE);
+            if (this->read(buffer, piece) != static_cast<ssize_t>(piece)) {
+                throw IO::CommError{"Error en la lectura de archivo"};
+            }
+            file.write(buffer, piece);
+            total_bytes_read += piece;
+        }
+
+        size = chunked ? this->read_chunk_size() : 0;
     }
 
     return *this;
 }
 
 /**
- * @brief Extraction operator for the Comm class.
+ * @brief Sends a file through the socket. The contents go straight from the
+ * file to the socket with `sendfile` when possible, falling back to reading
+ * it in chunks otherwise.
  *
- * @param i To reference to the integer where the read value is written
- * (converted to host order).
- * @return self.
+ * @param file_name Name of the file to send.
  */
-IO::Comm& IO::CommSocket::operator>>(uint32_t& i) {
-    /* reads from the Comm in network order */
-    uint32_t tmp;
-    if (this->read(&tmp, sizeof(tmp)) != sizeof(i)) {
-        throw IO::CommError{"Error en la lectura de u32"};
+void IO::CommSocket::send_file(const std::string& file_name) {
+#define SEND_BUFFER_SIZE 65536
+    if (this->get_codec() != IO::Codec::None) {
+        /* the contents must go through the compressor anyway */
+        std::ifstream file{file_name, std::ios::binary};
+        *this << file;
+        return;
     }
 
-    /* converts to host order and sets the output */
-    i = ntohl(tmp);
-    return *this;
+    int fd = open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        /* sent as an empty file, like a stream that couldn't be opened */
+        this->write_file_size(0);
+        return;
+    }
+
+    try {
+        struct stat info;
+        if (fstat(fd, &info) == -1) {
+            throw Error::Error{"fstat %s: %s", file_name.c_str(),
+                               strerror(errno)};
+        }
+        uint64_t size = info.st_size;
+        this->write_file_size(size);
+
+        uint64_t sent = 0;
+        if (this->zero_copy) {
+            /* the body follows, so the buffered bytes may share its packets */
+            if (!this->output.empty()) {
+                this->socket.write(this->output.data(), this->output.size(),
+                                   true);
+                this->output.clear();
+            }
+            sent = this->socket.send_file(fd, 0, size);
+        }
+
+        /* sends whatever sendfile couldn't */
+        if (sent < size && lseek(fd, sent, SEEK_SET) == -1) {
+            throw Error::Error{"lseek %s: %s", file_name.c_str(),
+                               strerror(errno)};
+        }
+        while (sent < size) {
+            char buffer[SEND_BUFFER_SIZE];
+            ssize_t bytes_read = ::read(
+                fd, buffer, std::min<uint64_t>(size - sent, sizeof(buffer)));
+            if (bytes_read <= 0) {
+                throw Error::Error{"Error leyendo %s", file_name.c_str()};
+            }
+            this->write(buffer, bytes_read);
+            sent += bytes_read;
+        }
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
 }
 
 /**
- * @brief Extraction operator for the Comm class.
+ * @brief Receives a file from the socket. The size is preallocated and the
+ * contents go straight from the socket to the file with `splice` when
+ * possible, falling back to reading them in chunks otherwise. Compressed
+ * files are decompressed by a separate thread as they arrive instead.
  *
- * @param s String to be read.
- * @return self.
+ * @param file_name Name of the file to write.
+ * @param progress Called with the bytes written so far (may be empty).
  */
-IO::Comm& IO::CommSocket::operator>>(std::string& s) {
-    /* first it reads the string length as a 4 byte value in host order */
-    uint32_t len;
-    *this >> len;
+void IO::CommSocket::receive_file(const std::string& file_name,
+                                  const IO::Progress& progress) {
+    int fd = open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+    if (fd == -1) {
+        throw Error::Error{"open %s: %s", file_name.c_str(), strerror(errno)};
+    }
 
-    /* preallocates the required space into the string */
-    s.resize(len);
+    try {
+        uint64_t written = 0;
+        if (this->get_codec() != IO::Codec::None) {
+            /* the size is unknown, and the contents can't be spliced */
+            IO::receive_compressed(*this, [&](const char* data,
+                                              std::size_t size) {
+                for (std::size_t done = 0; done < size;) {
+                    ssize_t n = ::write(fd, data + done, size - done);
+                    if (n <= 0) {
+                        throw Error::Error{"write %s: %s", file_name.c_str(),
+                                           strerror(errno)};
+                    }
+                    done += n;
+                }
+                written += size;
+                if (progress) {
+                    progress(written);
+                }
+            });
+        } else {
+            uint64_t size = this->read_file_size();
+            if (size == IO::CHUNKED_SIZE) {
+                /* the total size is unknown, each chunk is received as a
+                 * body */
+                uint32_t chunk;
+                while ((chunk = this->read_chunk_size()) > 0) {
+                    this->receive_body(fd, chunk, file_name, progress,
+                                       written);
+                }
+            } else {
+                /* reserves the space at once, which also reduces
+                 * fragmentation. Not every file system supports it, and it
+                 * is only a hint */
+                if (size > 0) {
+                    fallocate(fd, 0, 0, size);
+                }
+                this->receive_body(fd, size, file_name, progress, written);
+            }
+        }
+    } catch (...) {
+        close(fd);
+        throw;
+    }
 
-    /* gets the actual content */
-    if (this->read(&s.front(), len) != static_cast<ssize_t>(len)) {
-        throw IO::CommError{"Error en la lectura de string"};
+    if (close(fd) == -1) {
+        throw Error::Error{"close %s: %s", file_name.c_str(), strerror(errno)};
     }
-    return *this;
 }
 
 /**
- * @brief Sends a file through the socket.
+ * @brief Receives the given number of bytes into a file.
  *
- * @param file An opened stream.
- * @return self.
+ * @param fd File to write, at its current position.
+ * @param size Bytes to receive.
+ * @param file_name Name of the file, for the error messages.
+ * @param progress Called with the bytes written so far (may be empty).
+ * @param written Bytes of the file written so far, updated as it goes.
  */
-IO::Comm& IO::CommSocket::operator<<(std::ifstream& file) {
-    /* gets the file size */
-    file.ignore(std::numeric_limits<std::streamsize>::max());
-    std::streamsize length = file.gcount();
-    uint32_t fsize = length;
-
-    /* resets so it can later read the contents */
-    file.clear();
-    file.seekg(0, std::ios_base::beg);
+void IO::CommSocket::receive_body(int fd, uint64_t size,
+                                  const std::string& file_name,
+                                  const IO::Progress& progress,
+                                  uint64_t& written) {
+#define RECEIVE_BUFFER_SIZE 65536
+/* smaller bodies are not worth setting up a pipe */
+#define SPLICE_MIN_SIZE 65536
+/* bytes spliced between progress reports */
+#define SPLICE_PROGRESS_SIZE ((uint64_t)4 * 1024 * 1024)
+    /* writes what was already buffered */
+    uint64_t received = 0;
+    while (received < size && this->input_begin < this->input_end) {
+        std::size_t chunk = std::min<uint64_t>(
+            size - received, this->input_end - this->input_begin);
+        ssize_t n =
+            ::write(fd, this->input.data() + this->input_begin, chunk);
+        if (n <= 0) {
+            throw Error::Error{"write %s: %s", file_name.c_str(),
+                               strerror(errno)};
+        }
+        this->input_begin += n;
+        received += n;
+    }
+    if (progress && received > 0) {
+        progress(written + received);
+    }
 
-    /* sends the whole file size first */
-    *this << fsize;
+    if (this->zero_copy && size - received >= SPLICE_MIN_SIZE) {
+        this->flush();
+        while (received < size) {
+            uint64_t piece = size - received;
+            if (progress) {
+                piece = std::min(piece, SPLICE_PROGRESS_SIZE);
+            }
+            uint64_t spliced = this->socket.receive_file(fd, piece);
+            received += spliced;
+            if (progress && spliced > 0) {
+                progress(written + received);
+            }
+            if (spliced < piece) {
+                break;
+            }
+        }
+    }
 
-    /* sends the file contents in chunks */
-    char buffer[1024];
-    while (true) {
-        file.read(buffer, sizeof(buffer));
-        std::streamsize bytes_read = file.gcount();
-        if (bytes_read <= 0) {
-            break;
+    /* receives whatever splice couldn't */
+    while (received < size) {
+        char buffer[RECEIVE_BUFFER_SIZE];
+        uint64_t chunk = std::min<uint64_t>(size - received, sizeof(buffer));
+        if (this->read(buffer, chunk) != static_cast<ssize_t>(chunk)) {
+            throw IO::CommError{"Error en la lectura de archivo"};
+        }
+        for (uint64_t done = 0; done < chunk;) {
+            ssize_t n = ::write(fd, buffer + done, chunk - done);
+            if (n <= 0) {
+                throw Error::Error{"write %s: %s", file_name.c_str(),
+                                   strerror(errno)};
+            }
+            done += n;
+        }
+        received += chunk;
+        if (progress) {
+            progress(written + received);
         }
-        this->write(buffer, bytes_read);
     }
 
-    return *this;
+    written += received;
 }
 
 /**
- * @brief Receives a file from the socket.
+ * @brief Enables or disables the input and output buffers (to compare both
+ * ways). Any buffered output is sent first.
  *
- * @param file An opened file stream to write the data.
- * @return self.
+ * @param enabled Whether the buffers are used.
  */
-IO::Comm& IO::CommSocket::operator>>(std::ofstream& file) {
-#define BUFFER_SIZE ((uint32_t)1024)
-    uint32_t size;
-    *this >> size;
-
-    uint32_t total_bytes_read = 0;
-
-    /* reads the file by chunks */
-    while (total_bytes_read < size) {
-        char buffer[BUFFER_SIZE];
-        ssize_t bytes_read =
-            this->read(buffer, std::min(size - total_bytes_read, BUFFER_SIZE));
+void IO::CommSocket::set_buffering(bool enabled) {
+    this->flush();
+    this->buffering = enabled;
+}
 
-        file.write(buffer, bytes_read);
-        total_bytes_read += bytes_read;
-    }
+/**
+ * @brief Gets the underlying socket (e.g. to read its counters).
+ *
+ * @return Socket.
+ */
+const IO::Socket& IO::CommSocket::get_socket() const {
+    return this->socket;
+}
 
-    return *this;
+/**
+ * @brief Enables or disables the use of `sendfile` and `splice` in
+ * `send_file` and `receive_file` (to compare both paths).
+ *
+ * @param enabled Whether `sendfile` may be used.
+ */
+void IO::CommSocket::set_zero_copy(bool enabled) {
+    this->zero_copy = enabled;
 }
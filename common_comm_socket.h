@@ -2,10 +2,18 @@
 #define COMMON_COMM_SOCKET_H_
 
 #include <string>
+#include <vector>
 #include "common_comm.h"
 #include "common_socket.h"
 
 namespace IO {
+/**
+ * @brief Comm over a blocking socket.
+ * Small writes are collected in an output buffer that is sent when it fills
+ * up, before blocking to read (which is when a response is complete) or when
+ * `flush` is called. Reads are served from an input buffer, so decoding a
+ * message doesn't take a system call per field.
+ */
 class CommSocket : public Comm {
    public:
     CommSocket(const std::string& address, const std::string& service);
@@ -16,21 +24,38 @@ class CommSocket : public Comm {
     virtual void write(const void* data, std::size_t size) override;
     virtual ssize_t read(void* data, std::size_t size) override;
 
-    virtual Comm& operator<<(uint8_t c) override;
-    virtual Comm& operator<<(Response r) override;
-    virtual Comm& operator<<(uint32_t i) override;
-    virtual Comm& operator<<(const char* s) override;
-    virtual Comm& operator<<(const std::string& s) override;
-    virtual Comm& operator<<(std::ifstream& file) override;
+    using Comm::operator<<;
+    using Comm::operator>>;
 
-    virtual Comm& operator>>(uint8_t& c) override;
-    virtual Comm& operator>>(Response& r) override;
-    virtual Comm& operator>>(uint32_t& i) override;
-    virtual Comm& operator>>(std::string& s) override;
+    virtual Comm& operator<<(std::ifstream& file) override;
     virtual Comm& operator>>(std::ofstream& file) override;
+    virtual void send_file(const std::string& file_name) override;
+    using Comm::receive_file;
+    virtual void receive_file(const std::string& file_name,
+                              const Progress& progress) override;
+
+    void flush();
+
+    void set_zero_copy(bool enabled);
+    void set_buffering(bool enabled);
+    const Socket& get_socket() const;
 
    private:
+    std::size_t read_buffered(void* data, std::size_t size);
+    void receive_body(int fd, uint64_t size, const std::string& file_name,
+                      const Progress& progress, uint64_t& written);
+
     Socket socket;
+    /** Bytes written but not sent yet. */
+    std::string output;
+    /** Bytes received but not read yet: `input[input_begin, input_end)`. */
+    std::vector<char> input;
+    std::size_t input_begin{0};
+    std::size_t input_end{0};
+    /** Whether writes and reads go through the buffers. */
+    bool buffering{true};
+    /** Whether `send_file` and `receive_file` may avoid user space copies. */
+    bool zero_copy{true};
 };
 }  // namespace IO
 
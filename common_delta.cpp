@@ -0,0 +1,106 @@
+#include "common_delta.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "common_error.h"
+#include "common_sha256.h"
+
+/** bounds of the block size: smaller blocks find more matches, but take
+ * more signatures */
+#define MIN_BLOCK_SIZE 2048
+#define MAX_BLOCK_SIZE (128 * 1024)
+/** hexadecimal digits of the SHA-256 kept as the strong hash */
+#define STRONG_HASH_LENGTH 32
+
+/**
+ * @brief Computes the checksum of a window.
+ *
+ * @param data First byte of the window.
+ * @param size Window size.
+ */
+Delta::RollingChecksum::RollingChecksum(const void* data, std::size_t size)
+    : size(size) {
+    auto bytes = static_cast<const unsigned char*>(data);
+    for (std::size_t i = 0; i < size; i++) {
+        this->a += bytes[i];
+        this->b += (size - i) * bytes[i];
+    }
+}
+
+Delta::RollingChecksum::~RollingChecksum() {
+}
+
+/**
+ * @brief Slides the window one byte forward.
+ *
+ * @param out Byte that leaves the window (its first one).
+ * @param in Byte that enters the window.
+ */
+void Delta::RollingChecksum::roll(unsigned char out, unsigned char in) {
+    this->a += in - out;
+    this->b += this->a - this->size * out;
+}
+
+/**
+ * @brief Gets the checksum of the current window.
+ */
+uint32_t Delta::RollingChecksum::value() const {
+    return (this->a & 0xffff) | (this->b << 16);
+}
+
+/**
+ * @brief Picks the block size for a basis file, close to the square root
+ * of its size (as rsync does), which balances the size of the signatures
+ * against the data resent around each change.
+ *
+ * @param file_size Size of the basis file.
+ * @return Block size.
+ */
+uint32_t Delta::block_size_for(uint64_t file_size) {
+    uint64_t size = std::sqrt(static_cast<double>(file_size));
+    size = std::max<uint64_t>(MIN_BLOCK_SIZE, std::min<uint64_t>(
+                                                  MAX_BLOCK_SIZE, size));
+    /* rounds to a multiple of 64 */
+    return size & ~static_cast<uint64_t>(63);
+}
+
+/**
+ * @brief Computes the strong hash of a block.
+ *
+ * @param data First byte of the block.
+ * @param size Block size.
+ * @return Hash, as hexadecimal.
+ */
+std::string Delta::strong_hash(const void* data, std::size_t size) {
+    Digest::Sha256 sha;
+    sha.update(data, size);
+    return sha.hex_digest().substr(0, STRONG_HASH_LENGTH);
+}
+
+/**
+ * @brief Computes the signatures of the blocks of a file. A shorter block
+ * at the end of the file gets no signature, it is never copied.
+ *
+ * @param file_name Name of the basis file.
+ * @param block_size Block size.
+ * @return Signatures, in the order of the blocks.
+ */
+std::vector<Delta::BlockSignature> Delta::compute_signatures(
+    const std::string& file_name, uint32_t block_size) {
+    std::ifstream file{file_name, std::ios::binary};
+    if (!file) {
+        throw Error::Error{"Error abriendo %s", file_name.c_str()};
+    }
+
+    std::vector<BlockSignature> signatures;
+    std::vector<char> block(block_size);
+    while (file.read(block.data(), block.size()),
+           file.gcount() == static_cast<std::streamsize>(block_size)) {
+        RollingChecksum checksum{block.data(), block.size()};
+        signatures.emplace_back(checksum.value(),
+                                strong_hash(block.data(), block.size()));
+    }
+    return signatures;
+}
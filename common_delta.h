@@ -0,0 +1,60 @@
+#ifndef COMMON_DELTA_H_
+#define COMMON_DELTA_H_
+
+#include <cinttypes>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace Delta {
+/**
+ * Instructions of a delta push (revision 6). Each one is an `Op` byte
+ * followed by its arguments:
+ * - `Copy`: first block and number of blocks (u32 each) of the basis file.
+ * - `Literal`: length (u32) and the bytes themselves.
+ * - `End`: no arguments, the file is complete.
+ */
+enum class Op : uint8_t { End = 0, Copy = 1, Literal = 2 };
+
+/**
+ * @brief Signature of a block of the basis file: a cheap checksum that can
+ * be rolled over the new file, and a strong hash that confirms the matches.
+ */
+class BlockSignature {
+   public:
+    BlockSignature(uint32_t weak, const std::string& strong)
+        : weak(weak), strong(strong) {
+    }
+    ~BlockSignature() {
+    }
+
+    uint32_t weak;
+    std::string strong;
+};
+
+/**
+ * @brief rsync's checksum: two 16 bit sums of the bytes of a window, which
+ * can be slid one byte forward in constant time.
+ */
+class RollingChecksum {
+   public:
+    RollingChecksum(const void* data, std::size_t size);
+    ~RollingChecksum();
+
+    void roll(unsigned char out, unsigned char in);
+    uint32_t value() const;
+
+   private:
+    uint32_t a{0};
+    uint32_t b{0};
+    /** Window size. */
+    std::size_t size;
+};
+
+uint32_t block_size_for(uint64_t file_size);
+std::string strong_hash(const void* data, std::size_t size);
+std::vector<BlockSignature> compute_signatures(const std::string& file_name,
+                                               uint32_t block_size);
+}  // namespace Delta
+
+#endif
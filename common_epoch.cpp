@@ -0,0 +1,139 @@
+#include "common_epoch.h"
+#include <atomic>
+#include <cinttypes>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/** size of a cache line, so each slot gets its own */
+#define CACHE_LINE_SIZE 64
+
+/*
+ * Epoch based reclamation: there is a global epoch, and each reader
+ * publishes in its slot the epoch it saw when it entered (0 when it is not
+ * reading). An object is retired once it can no longer be reached, tagged
+ * with the epoch at that moment, and the epoch is advanced. Readers that
+ * entered later can't reach it, so it is freed as soon as no slot holds an
+ * epoch up to its tag.
+ */
+
+namespace {
+/**
+ * @brief Epoch published by a thread. Slots are never freed, a thread
+ * takes a free one when it first reads and gives it back when it exits.
+ */
+struct Slot {
+    std::atomic<uint64_t> epoch{0};
+    std::atomic<bool> in_use{false};
+    Slot* next{nullptr};
+    char padding[CACHE_LINE_SIZE];
+};
+
+std::atomic<uint64_t> global_epoch{1};
+std::atomic<Slot*> slots{nullptr};
+
+/** Objects retired and not freed yet, with the epoch they were retired. */
+std::mutex retired_mutex;
+std::vector<std::pair<uint64_t, std::function<void()>>> retired;
+
+/**
+ * @brief Slot of the calling thread, and how many guards it has open.
+ */
+struct ThreadSlot {
+    ~ThreadSlot() {
+        if (this->slot) {
+            this->slot->in_use.store(false);
+        }
+    }
+
+    Slot* get() {
+        if (this->slot) {
+            return this->slot;
+        }
+        /* reuses the slot of a thread that exited */
+        for (Slot* s = slots.load(); s; s = s->next) {
+            bool expected = false;
+            if (s->in_use.compare_exchange_strong(expected, true)) {
+                return this->slot = s;
+            }
+        }
+        Slot* s = new Slot{};
+        s->in_use.store(true);
+        s->next = slots.load();
+        while (!slots.compare_exchange_weak(s->next, s)) {
+        }
+        return this->slot = s;
+    }
+
+    Slot* slot{nullptr};
+    unsigned depth{0};
+};
+
+thread_local ThreadSlot thread_slot;
+
+/**
+ * @brief Oldest epoch a reader may still be in.
+ */
+uint64_t oldest_epoch() {
+    uint64_t oldest = global_epoch.load();
+    for (Slot* s = slots.load(); s; s = s->next) {
+        uint64_t epoch = s->epoch.load();
+        if (epoch != 0 && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+    return oldest;
+}
+}  // namespace
+
+/**
+ * @brief Enters a read section.
+ */
+Concurrency::EpochGuard::EpochGuard() {
+    if (thread_slot.depth++ > 0) {
+        return;
+    }
+    /* the epoch is published before anything is read (both sequentially
+     * consistent), so a writer that retires an object afterwards sees it */
+    thread_slot.get()->epoch.store(global_epoch.load());
+}
+
+/**
+ * @brief Leaves a read section.
+ */
+Concurrency::EpochGuard::~EpochGuard() {
+    if (--thread_slot.depth > 0) {
+        return;
+    }
+    thread_slot.slot->epoch.store(0, std::memory_order_release);
+}
+
+/**
+ * @brief Frees an object once no reader may still be using it. Must be
+ * called after the object was made unreachable for new readers. Objects
+ * retired earlier are freed along the way, if possible.
+ *
+ * @param deleter Frees the object.
+ */
+void Concurrency::retire(std::function<void()> deleter) {
+    std::vector<std::function<void()>> ready;
+    {
+        std::lock_guard<std::mutex> lock(retired_mutex);
+        retired.emplace_back(global_epoch.fetch_add(1), std::move(deleter));
+
+        uint64_t oldest = oldest_epoch();
+        auto keep = retired.begin();
+        for (auto it = retired.begin(); it != retired.end(); ++it) {
+            if (it->first < oldest) {
+                ready.push_back(std::move(it->second));
+            } else {
+                *keep++ = std::move(*it);
+            }
+        }
+        retired.erase(keep, retired.end());
+    }
+    for (auto& free : ready) {
+        free();
+    }
+}
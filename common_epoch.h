@@ -0,0 +1,27 @@
+#ifndef COMMON_EPOCH_H_
+#define COMMON_EPOCH_H_
+
+#include <functional>
+
+namespace Concurrency {
+/**
+ * @brief Marks the calling thread as reading data published for lock-free
+ * readers (see RcuMap), for as long as it lives.
+ * Objects retired meanwhile (see `retire`) are not freed until the reader
+ * is done. Entering and leaving only write to a slot of the calling
+ * thread, readers never write to memory shared with other threads.
+ * Guards may be nested.
+ */
+class EpochGuard {
+   public:
+    EpochGuard();
+    ~EpochGuard();
+
+    EpochGuard(const EpochGuard& other) = delete;
+    EpochGuard& operator=(const EpochGuard& other) = delete;
+};
+
+void retire(std::function<void()> deleter);
+}  // namespace Concurrency
+
+#endif
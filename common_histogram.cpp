@@ -0,0 +1,118 @@
+#include "common_histogram.h"
+#include <atomic>
+#include <ostream>
+
+Stats::Histogram::Histogram() {
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        this->buckets[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+Stats::Histogram::~Histogram() {
+}
+
+/**
+ * @brief Adds a value to the histogram.
+ *
+ * @param value Value to record.
+ */
+void Stats::Histogram::record(uint64_t value) {
+    /* the bucket is the number of significant bits of the value */
+    int bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+    this->buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    this->total.fetch_add(1, std::memory_order_relaxed);
+    this->total_sum.fetch_add(value, std::memory_order_relaxed);
+
+    uint64_t current = this->max_value.load(std::memory_order_relaxed);
+    while (value > current &&
+           !this->max_value.compare_exchange_weak(current, value,
+                                                  std::memory_order_relaxed)) {
+    }
+}
+
+/**
+ * @brief Number of recorded values.
+ */
+uint64_t Stats::Histogram::count() const {
+    return this->total.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Sum of the recorded values.
+ */
+uint64_t Stats::Histogram::sum() const {
+    return this->total_sum.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Largest recorded value.
+ */
+uint64_t Stats::Histogram::max() const {
+    return this->max_value.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Gets an upper bound of the given percentile.
+ *
+ * @param p Percentile, between 0 and 1.
+ * @return Upper bound of the bucket that holds the percentile.
+ */
+uint64_t Stats::Histogram::percentile(double p) const {
+    uint64_t n = this->count();
+    if (n == 0) {
+        return 0;
+    }
+
+    uint64_t rank = static_cast<uint64_t>(p * n);
+    if (rank >= n) {
+        rank = n - 1;
+    }
+
+    uint64_t seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        seen += this->buckets[i].load(std::memory_order_relaxed);
+        if (seen > rank) {
+            uint64_t bound = upper_bound(i);
+            return bound < this->max() ? bound : this->max();
+        }
+    }
+    return this->max();
+}
+
+/**
+ * @brief Number of recorded values in a bucket.
+ *
+ * @param i Bucket, below NUM_BUCKETS.
+ */
+uint64_t Stats::Histogram::bucket(int i) const {
+    return this->buckets[i].load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Largest value that goes into a bucket.
+ *
+ * @param i Bucket, below NUM_BUCKETS.
+ */
+uint64_t Stats::Histogram::upper_bound(int i) {
+    return i == 0 ? 0 : (i == 64 ? UINT64_MAX : (1ULL << i) - 1);
+}
+
+/**
+ * @brief Writes a one line summary of the histogram.
+ *
+ * @param out Output stream.
+ * @param name Name of the measured value.
+ * @param unit Unit of the measured value.
+ */
+void Stats::Histogram::report(std::ostream& out, const char* name,
+                              const char* unit) const {
+    uint64_t n = this->count();
+    out << name << ": n=" << n;
+    if (n > 0) {
+        out << " avg=" << this->sum() / n << unit
+            << " p50=" << this->percentile(0.5) << unit
+            << " p99=" << this->percentile(0.99) << unit
+            << " max=" << this->max() << unit;
+    }
+    out << std::endl;
+}
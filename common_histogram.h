@@ -0,0 +1,47 @@
+#ifndef COMMON_HISTOGRAM_H_
+#define COMMON_HISTOGRAM_H_
+
+#include <atomic>
+#include <cinttypes>
+#include <ostream>
+
+namespace Stats {
+/**
+ * @brief Lock free histogram with power of two buckets.
+ * Bucket `i` counts the values in [2^(i-1), 2^i), so percentiles are
+ * reported as the upper bound of their bucket. Recording a value is a couple
+ * of relaxed atomic increments, cheap enough for hot paths.
+ */
+class Histogram {
+   public:
+    /** Number of buckets (enough for any 64 bit value). */
+    static const int NUM_BUCKETS = 65;
+
+    Histogram();
+    ~Histogram();
+
+    Histogram(const Histogram& other) = delete;
+    Histogram& operator=(const Histogram& other) = delete;
+
+    /** api */
+    void record(uint64_t value);
+
+    /** query */
+    uint64_t count() const;
+    uint64_t sum() const;
+    uint64_t max() const;
+    uint64_t percentile(double p) const;
+    uint64_t bucket(int i) const;
+    static uint64_t upper_bound(int i);
+
+    void report(std::ostream& out, const char* name, const char* unit) const;
+
+   private:
+    std::atomic<uint64_t> buckets[NUM_BUCKETS];
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> total_sum{0};
+    std::atomic<uint64_t> max_value{0};
+};
+}  // namespace Stats
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef COMMON_RCU_MAP_H_
+#define COMMON_RCU_MAP_H_
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "common_epoch.h"
+
+namespace Concurrency {
+/**
+ * @brief Map from keys (strings unless told otherwise) to values that can
+ * be read without locks.
+ * Entries are only added, never changed nor removed, so readers just follow
+ * pointers: an entry is published (with its successor in the bucket
+ * already set) by storing it at the head of its bucket. Growing the table
+ * copies the entries into a new one, publishes it and retires the old one,
+ * which is freed once the readers that may see it are gone (see
+ * EpochGuard). Writers take a mutex.
+ */
+template <class Value, class Key = std::string>
+class RcuMap {
+   public:
+    RcuMap() : table(new Table{INITIAL_BUCKETS}) {
+    }
+
+    ~RcuMap() {
+        delete this->table.load();
+    }
+
+    RcuMap(const RcuMap& other) = delete;
+    RcuMap& operator=(const RcuMap& other) = delete;
+
+    /**
+     * @brief Looks up a key. Must be called within an EpochGuard, which
+     * keeps the value alive.
+     *
+     * @param key Key to look up.
+     * @return The value, or nullptr if the key is not in the map.
+     */
+    const Value* find(const Key& key) const {
+        /* sequentially consistent, so it is ordered after entering the
+         * EpochGuard */
+        const Table* table = this->table.load();
+        std::size_t hash = std::hash<Key>{}(key);
+        const Node* node =
+            table->bucket(hash).load(std::memory_order_acquire);
+        for (; node; node = node->next) {
+            if (node->hash == hash && node->key == key) {
+                return &node->value;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief Adds an entry, unless the key is already in the map.
+     *
+     * @param key Key.
+     * @param value Value.
+     * @return false if the key was already in the map.
+     */
+    bool insert(const Key& key, const Value& value) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        Table* table = this->table.load();
+        std::size_t hash = std::hash<Key>{}(key);
+        for (Node* node = table->bucket(hash).load(); node;
+             node = node->next) {
+            if (node->hash == hash && node->key == key) {
+                return false;
+            }
+        }
+
+        if (table->size >= table->buckets.size()) {
+            table = this->grow(table);
+        }
+        std::atomic<Node*>& bucket = table->bucket(hash);
+        Node* node = new Node{hash, key, value, bucket.load()};
+        bucket.store(node, std::memory_order_release);
+        table->size++;
+        this->count.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * @brief Visits every entry, in no particular order. Must be called
+     * within an EpochGuard. Entries added meanwhile may be missed, the ones
+     * added before the call are not.
+     *
+     * @param visit Called with each key and value.
+     */
+    void for_each(const std::function<void(const Key& key,
+                                           const Value& value)>& visit) const {
+        const Table* table = this->table.load();
+        for (const std::atomic<Node*>& bucket : table->buckets) {
+            for (const Node* node = bucket.load(std::memory_order_acquire);
+                 node; node = node->next) {
+                visit(node->key, node->value);
+            }
+        }
+    }
+
+    /**
+     * @brief Gets the number of entries, without locks (it may miss the
+     * entries being added).
+     */
+    std::size_t size() const {
+        return this->count.load(std::memory_order_relaxed);
+    }
+
+   private:
+    static const std::size_t INITIAL_BUCKETS = 1024;
+
+    struct Node {
+        std::size_t hash;
+        Key key;
+        Value value;
+        /** Never changes once the node is published. */
+        Node* next;
+    };
+
+    struct Table {
+        explicit Table(std::size_t buckets) : buckets(buckets) {
+            for (std::atomic<Node*>& bucket : this->buckets) {
+                bucket.store(nullptr, std::memory_order_relaxed);
+            }
+        }
+
+        ~Table() {
+            for (std::atomic<Node*>& bucket : this->buckets) {
+                Node* node = bucket.load();
+                while (node) {
+                    Node* next = node->next;
+                    delete node;
+                    node = next;
+                }
+            }
+        }
+
+        std::atomic<Node*>& bucket(std::size_t hash) {
+            return this->buckets[hash & (this->buckets.size() - 1)];
+        }
+        const std::atomic<Node*>& bucket(std::size_t hash) const {
+            return this->buckets[hash & (this->buckets.size() - 1)];
+        }
+
+        /** Power of two, so the bucket is taken from the low bits. */
+        std::vector<std::atomic<Node*>> buckets;
+        std::size_t size{0};
+    };
+
+    /**
+     * @brief Replaces the table with one twice as large. The nodes are
+     * copied, as readers may still be walking the old ones.
+     */
+    Table* grow(Table* old) {
+        Table* table = new Table{old->buckets.size() * 2};
+        for (std::atomic<Node*>& bucket : old->buckets) {
+            for (Node* node = bucket.load(); node; node = node->next) {
+                std::atomic<Node*>& to = table->bucket(node->hash);
+                to.store(new Node{node->hash, node->key, node->value,
+                                  to.load()});
+            }
+        }
+        table->size = old->size;
+        this->table.store(table);
+        retire([old] { delete old; });
+        return table;
+    }
+
+    std::atomic<Table*> table;
+    std::mutex mutex;
+    std::atomic<std::size_t> count{0};
+};
+}  // namespace Concurrency
+
+#endif
@@ -1,30 +1,86 @@
 #include "common_rw_lock.h"
+#include <chrono>
+#include <cinttypes>
+#include <cstddef>
 #include <mutex>
+#include <set>
+
+/**
+ * @brief Microseconds elapsed since a given time.
+ */
+static uint64_t micros_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+}
 
 /**
  * @brief Blocks until the lock is available for writing.
- * Once unblocked, the lock will be held until the returned `unique_lock` is
- * destructed.
- * @return Write lock that must be held until no writing access is required.
+ * The lock will be held until `release_write_access` is called.
  */
-std::unique_lock<std::mutex> Concurrency::RWLock::wait_write_access() {
+void Concurrency::RWLock::wait_write_access() {
     std::unique_lock<std::mutex> lock(this->mutex);
-    while (this->readers) {
-        this->cv.wait(lock);
+    uint64_t waited = 0;
+    if (this->writer || this->readers > 0 || this->admitted > 0) {
+        auto start = std::chrono::steady_clock::now();
+        this->waiting_writers += 1;
+        this->write_cv.wait(lock, [this] {
+            return !this->writer && this->readers == 0 && this->admitted == 0;
+        });
+        this->waiting_writers -= 1;
+        waited = micros_since(start);
+    }
+    this->writer = true;
+    if (this->write_wait) {
+        this->write_wait->record(waited);
+    }
+}
+
+/**
+ * @brief Releases a write lock. The readers waiting for it go first, the
+ * next writer waits until they are done.
+ */
+void Concurrency::RWLock::release_write_access() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->writer = false;
+    this->releases += 1;
+    this->admitted = this->waiting_readers;
+    if (this->admitted > 0) {
+        this->read_cv.notify_all();
+    } else {
+        this->write_cv.notify_one();
     }
-    return lock;
 }
 
 /**
  * @brief Blocks until the lock is available for reading.
  * The read lock will be held until `release_read_access` is called.
- * Readers do not need to check for the existance of writers, because a
- * writer will hold the lock, so the fact that the mutex was taken means
- * that there is no current writer.
+ * A reader waits while a writer holds the lock, and also while one waits
+ * for it (unless a writer left since the reader started waiting), so a
+ * stream of readers can't starve the writers.
  */
 void Concurrency::RWLock::wait_read_access() {
     std::unique_lock<std::mutex> lock(this->mutex);
+    uint64_t waited = 0;
+    if (this->writer || this->waiting_writers > 0) {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t arrival = this->releases;
+        this->waiting_readers += 1;
+        this->read_cv.wait(lock, [this, arrival] {
+            return !this->writer && (this->waiting_writers == 0 ||
+                                     this->releases != arrival);
+        });
+        this->waiting_readers -= 1;
+        if (this->releases != arrival) {
+            /* was let in by the last writer */
+            this->admitted -= 1;
+        }
+        waited = micros_since(start);
+    }
     this->readers += 1;
+    if (this->read_wait) {
+        this->read_wait->record(waited);
+    }
 }
 
 /**
@@ -35,9 +91,111 @@ void Concurrency::RWLock::release_read_access() {
     if (this->readers > 0) {
         this->readers -= 1;
     }
-    if (this->readers == 0) {
-        /* if there are no readers, notifies for any thread that may be
-         * blocked waiting for write access */
-        this->cv.notify_one();
+    if (this->readers == 0 && this->admitted == 0 &&
+        this->waiting_writers > 0) {
+        /* the last reader lets the next writer in */
+        this->write_cv.notify_one();
+    }
+}
+
+/**
+ * @brief Sets where the time waited for the lock is recorded, in
+ * microseconds. Acquisitions that don't wait are recorded as 0.
+ *
+ * @param read_wait Histogram for the readers (or nullptr).
+ * @param write_wait Histogram for the writers (or nullptr).
+ */
+void Concurrency::RWLock::set_stats(Stats::Histogram* read_wait,
+                                    Stats::Histogram* write_wait) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->read_wait = read_wait;
+    this->write_wait = write_wait;
+}
+
+/**
+ * @brief Creates the stripes.
+ *
+ * @param stripes Number of stripes.
+ */
+Concurrency::StripedLock::StripedLock(std::size_t stripes) {
+    for (std::size_t i = 0; i < stripes; i++) {
+        this->stripes.emplace_back(new RWLock{});
+    }
+}
+
+Concurrency::StripedLock::~StripedLock() {
+}
+
+/**
+ * @brief Gets a stripe.
+ *
+ * @param stripe Index of the stripe.
+ * @return The lock of the stripe.
+ */
+Concurrency::RWLock& Concurrency::StripedLock::operator[](
+    std::size_t stripe) {
+    return *this->stripes.at(stripe);
+}
+
+/**
+ * @brief Number of stripes.
+ */
+std::size_t Concurrency::StripedLock::size() const {
+    return this->stripes.size();
+}
+
+/**
+ * @brief Sets where the time waited for any of the stripes is recorded
+ * (see `RWLock::set_stats`).
+ *
+ * @param read_wait Histogram for the readers (or nullptr).
+ * @param write_wait Histogram for the writers (or nullptr).
+ */
+void Concurrency::StripedLock::set_stats(Stats::Histogram* read_wait,
+                                         Stats::Histogram* write_wait) {
+    for (auto& stripe : this->stripes) {
+        stripe->set_stats(read_wait, write_wait);
+    }
+}
+
+/**
+ * @brief Takes the given stripes, in increasing order. A stripe in both
+ * sets is taken for writing.
+ *
+ * @param lock Striped lock.
+ * @param read Stripes to take for reading.
+ * @param write Stripes to take for writing.
+ */
+Concurrency::MultiLock::MultiLock(StripedLock& lock,
+                                  const std::set<std::size_t>& read,
+                                  const std::set<std::size_t>& write)
+    : lock(lock) {
+    auto r = read.begin();
+    auto w = write.begin();
+    while (r != read.end() || w != write.end()) {
+        if (w != write.end() && (r == read.end() || *w <= *r)) {
+            if (r != read.end() && *r == *w) {
+                ++r;
+            }
+            lock[*w].wait_write_access();
+            this->writers.push_back(*w);
+            ++w;
+        } else {
+            lock[*r].wait_read_access();
+            this->readers.push_back(*r);
+            ++r;
+        }
+    }
+}
+
+/**
+ * @brief Releases the stripes.
+ */
+Concurrency::MultiLock::~MultiLock() {
+    for (std::size_t stripe : this->readers) {
+        this->lock[stripe].release_read_access();
+    }
+    for (std::size_t stripe : this->writers) {
+        this->lock[stripe].release_write_access();
     }
 }
@@ -1,12 +1,23 @@
 #ifndef RW_LOCK_H_
 #define RW_LOCK_H_
 
+#include <cinttypes>
 #include <condition_variable>
+#include <cstddef>
+#include <memory>
 #include <mutex>
+#include <set>
+#include <vector>
+#include "common_histogram.h"
 
 namespace Concurrency {
 /**
  * @brief Read/write lock used for the readers and writers problem.
+ * It is phase fair: once a writer waits, new readers wait too, and the
+ * readers waiting when a writer leaves go in before the next writer. So
+ * neither a stream of readers nor one of writers can starve the others: a
+ * writer waits for at most one group of readers, a reader for at most one
+ * writer (besides the one holding the lock).
  * To apply RAII using this class, see WriteLock and ReadLock.
  */
 class RWLock {
@@ -17,17 +28,33 @@ class RWLock {
     }
 
     /** api */
-    std::unique_lock<std::mutex> wait_write_access();
+    void wait_write_access();
+    void release_write_access();
     void wait_read_access();
     void release_read_access();
 
+    void set_stats(Stats::Histogram* read_wait, Stats::Histogram* write_wait);
+
    private:
     /** Number of readers holding the lock. */
     int readers{0};
+    /** Whether a writer holds the lock. */
+    bool writer{false};
+    /** Number of readers and writers waiting. */
+    int waiting_readers{0};
+    int waiting_writers{0};
+    /** Readers let in by the last writer that haven't entered yet. */
+    int admitted{0};
+    /** Number of times a writer released the lock. */
+    uint64_t releases{0};
+    /** Where the time waited for the lock is recorded, if anywhere (us). */
+    Stats::Histogram* read_wait{nullptr};
+    Stats::Histogram* write_wait{nullptr};
     /** Internal mutex. */
     std::mutex mutex;
-    /** Condition variable to notify writers when there are no readers left. */
-    std::condition_variable cv;
+    /** Condition variables where the readers and the writers wait. */
+    std::condition_variable read_cv;
+    std::condition_variable write_cv;
 };
 
 /**
@@ -54,14 +81,59 @@ class ReadLock {
  */
 class WriteLock {
    public:
-    explicit WriteLock(RWLock& lock) {
-        this->lock = lock.wait_write_access();
+    explicit WriteLock(RWLock& lock) : lock(lock) {
+        this->lock.wait_write_access();
     }
     ~WriteLock() {
+        this->lock.release_write_access();
     }
 
    private:
-    std::unique_lock<std::mutex> lock;
+    RWLock& lock;
+};
+
+/**
+ * @brief Array of RWLocks ("stripes"), each protecting a shard of some
+ * data, so operations on different shards don't wait for each other.
+ * To take several stripes at once, see MultiLock.
+ */
+class StripedLock {
+   public:
+    explicit StripedLock(std::size_t stripes);
+    ~StripedLock();
+
+    StripedLock(const StripedLock& other) = delete;
+    StripedLock& operator=(const StripedLock& other) = delete;
+
+    RWLock& operator[](std::size_t stripe);
+    std::size_t size() const;
+
+    void set_stats(Stats::Histogram* read_wait, Stats::Histogram* write_wait);
+
+   private:
+    std::vector<std::unique_ptr<RWLock>> stripes;
+};
+
+/**
+ * @brief Takes several stripes of a StripedLock, each one in read or write
+ * mode. The stripes are always taken in increasing order, so threads that
+ * take several of them can't deadlock.
+ */
+class MultiLock {
+   public:
+    MultiLock(StripedLock& lock, const std::set<std::size_t>& read,
+              const std::set<std::size_t>& write);
+    ~MultiLock();
+
+    MultiLock(const MultiLock& other) = delete;
+    MultiLock& operator=(const MultiLock& other) = delete;
+
+   private:
+    StripedLock& lock;
+    /** Stripes taken for reading. */
+    std::vector<std::size_t> readers;
+    /** Stripes taken for writing. */
+    std::vector<std::size_t> writers;
 };
 }  // namespace Concurrency
 
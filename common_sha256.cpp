@@ -0,0 +1,267 @@
+#include "common_sha256.h"
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA256_X86 1
+#endif
+
+/** round constants */
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static inline uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+/**
+ * @brief Portable compression function.
+ *
+ * @param state Hash state.
+ * @param data Whole blocks to hash.
+ * @param blocks Number of 64 byte blocks.
+ */
+static void compress_portable(uint32_t state[8], const unsigned char* data,
+                              std::size_t blocks) {
+    for (; blocks > 0; blocks--, data += 64) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            w[i] = (uint32_t)data[4 * i] << 24 |
+                   (uint32_t)data[4 * i + 1] << 16 |
+                   (uint32_t)data[4 * i + 2] << 8 | (uint32_t)data[4 * i + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 =
+                rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 =
+                rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+            uint32_t ch = (e & f) ^ (~e & g);
+            uint32_t t1 = h + s1 + ch + K[i] + w[i];
+            uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t t2 = s0 + maj;
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#ifdef SHA256_X86
+/**
+ * @brief Compression function using the x86 SHA extensions.
+ *
+ * @param state Hash state.
+ * @param data Whole blocks to hash.
+ * @param blocks Number of 64 byte blocks.
+ */
+__attribute__((target("sha,sse4.1"))) static void compress_sha_ni(
+    uint32_t state[8], const unsigned char* data, std::size_t blocks) {
+    const __m128i byte_swap =
+        _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    /* the instructions work on the ABEF and CDGH halves of the state */
+    __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state));
+    __m128i state1 =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4));
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);
+    state1 = _mm_shuffle_epi32(state1, 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    for (; blocks > 0; blocks--, data += 64) {
+        __m128i abef = state0;
+        __m128i cdgh = state1;
+
+        /* w[i % 4] holds the message words 4i to 4i + 3 */
+        __m128i w[4];
+        for (int i = 0; i < 16; i++) {
+            if (i < 4) {
+                w[i] = _mm_shuffle_epi8(
+                    _mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(data + 16 * i)),
+                    byte_swap);
+            } else {
+                __m128i& next = w[i % 4];
+                next = _mm_sha256msg1_epu32(next, w[(i + 1) % 4]);
+                next = _mm_add_epi32(
+                    next, _mm_alignr_epi8(w[(i + 3) % 4], w[(i + 2) % 4], 4));
+                next = _mm_sha256msg2_epu32(next, w[(i + 3) % 4]);
+            }
+
+            __m128i msg = _mm_add_epi32(
+                w[i % 4],
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(K + 4 * i)));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            msg = _mm_shuffle_epi32(msg, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state), state0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), state1);
+}
+
+/**
+ * @brief Whether the CPU has the SHA extensions (and the SSE versions they
+ * are used with).
+ */
+static bool cpu_has_sha() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSSE3) ||
+        !(ecx & bit_SSE4_1)) {
+        return false;
+    }
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    return ebx & (1 << 29);
+}
+#endif
+
+/** compression function in use */
+using Compress = void (*)(uint32_t*, const unsigned char*, std::size_t);
+
+/**
+ * @brief Picks the fastest compression function the CPU supports.
+ */
+static Compress best_compress() {
+#ifdef SHA256_X86
+    if (cpu_has_sha()) {
+        return compress_sha_ni;
+    }
+#endif
+    return compress_portable;
+}
+
+static Compress compress = best_compress();
+
+Digest::Sha256::Sha256() {
+    static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                        0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                        0x1f83d9ab, 0x5be0cd19};
+    memcpy(this->state, initial, sizeof(this->state));
+}
+
+Digest::Sha256::~Sha256() {
+}
+
+/**
+ * @brief Adds data to the hash.
+ *
+ * @param data Data to hash.
+ * @param size Size of the data.
+ */
+void Digest::Sha256::update(const void* data, std::size_t size) {
+    auto in = static_cast<const unsigned char*>(data);
+    this->length += size;
+
+    /* completes the partial block first */
+    if (this->block_size > 0) {
+        std::size_t n = std::min(size, sizeof(this->block) - this->block_size);
+        memcpy(this->block + this->block_size, in, n);
+        this->block_size += n;
+        in += n;
+        size -= n;
+        if (this->block_size < sizeof(this->block)) {
+            return;
+        }
+        compress(this->state, this->block, 1);
+        this->block_size = 0;
+    }
+
+    /* hashes the whole blocks straight from the input */
+    std::size_t blocks = size / 64;
+    if (blocks > 0) {
+        compress(this->state, in, blocks);
+        in += blocks * 64;
+        size -= blocks * 64;
+    }
+
+    memcpy(this->block, in, size);
+    this->block_size = size;
+}
+
+/**
+ * @brief Finishes the hash. No more data may be added afterwards.
+ *
+ * @return Digest as lowercase hexadecimal.
+ */
+std::string Digest::Sha256::hex_digest() {
+    uint64_t bits = this->length * 8;
+
+    /* pads with a 1 bit, zeros and the length in bits */
+    unsigned char padding[72] = {0x80};
+    std::size_t padding_size =
+        (this->block_size < 56 ? 56 : 120) - this->block_size;
+    for (int i = 0; i < 8; i++) {
+        padding[padding_size + i] = bits >> (56 - 8 * i);
+    }
+    this->update(padding, padding_size + 8);
+
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    for (uint32_t word : this->state) {
+        for (int shift = 28; shift >= 0; shift -= 4) {
+            hex += digits[(word >> shift) & 0xf];
+        }
+    }
+    return hex;
+}
+
+/**
+ * @brief Whether the hardware accelerated implementation is in use.
+ */
+bool Digest::Sha256::accelerated() {
+    return compress != compress_portable;
+}
+
+/**
+ * @brief Switches between the hardware accelerated implementation (if the
+ * CPU supports it) and the portable one, e.g. to compare them.
+ *
+ * @param enabled Whether to use the accelerated implementation.
+ */
+void Digest::Sha256::set_accelerated(bool enabled) {
+    compress = enabled ? best_compress() : compress_portable;
+}
@@ -0,0 +1,36 @@
+#ifndef COMMON_SHA256_H_
+#define COMMON_SHA256_H_
+
+#include <cinttypes>
+#include <string>
+
+namespace Digest {
+/**
+ * @brief Incremental SHA-256.
+ * Uses the x86 SHA extensions when the CPU has them and a portable
+ * implementation otherwise.
+ */
+class Sha256 {
+   public:
+    Sha256();
+    ~Sha256();
+
+    /** api */
+    void update(const void* data, std::size_t size);
+    std::string hex_digest();
+
+    /** implementation selection */
+    static bool accelerated();
+    static void set_accelerated(bool enabled);
+
+   private:
+    uint32_t state[8];
+    /** Partial block. */
+    unsigned char block[64];
+    std::size_t block_size{0};
+    /** Total bytes hashed. */
+    uint64_t length{0};
+};
+}  // namespace Digest
+
+#endif
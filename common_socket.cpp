@@ -1,9 +1,14 @@
 #include "common_socket.h"
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <algorithm>
 #include <cstring>
@@ -24,6 +29,10 @@ IO::Socket::Socket() {
 
 IO::Socket::Socket(Socket&& other) {
     std::swap(this->fd, other.fd);
+    std::swap(this->send_calls, other.send_calls);
+    std::swap(this->recv_calls, other.recv_calls);
+    std::swap(this->bytes_sent, other.bytes_sent);
+    std::swap(this->bytes_received, other.bytes_received);
 }
 
 IO::Socket::~Socket() {
@@ -86,7 +95,8 @@ void IO::Socket::bind(const std::string& port) {
  * @brief Sets a socket to passive mode.
  */
 void IO::Socket::listen() {
-    if (::listen(this->fd, 10) == -1) {
+    /* clients wait here while the server is too busy to accept them */
+    if (::listen(this->fd, SOMAXCONN) == -1) {
         throw Error::Error{"listen: %s", strerror(errno)};
     }
 }
@@ -165,22 +175,69 @@ void IO::Socket::shutdown() {
  *
  * @param data Pointer to the data buffer.
  * @param size Size of the buffer.
+ * @param more Whether more data follows right away, so the kernel may wait
+ * for it to fill the packets (`MSG_MORE`).
  */
-void IO::Socket::write(const void* data, std::size_t size) {
+void IO::Socket::write(const void* data, std::size_t size, bool more) {
     /* casts the data buffer to a byte array */
     auto out = static_cast<const unsigned char*>(data);
+    int flags = MSG_NOSIGNAL | (more ? MSG_MORE : 0);
     size_t total_bytes_written = 0;
     do {
+        this->send_calls += 1;
         ssize_t bytes_written = send(this->fd, out + total_bytes_written,
-                                     size - total_bytes_written, MSG_NOSIGNAL);
+                                     size - total_bytes_written, flags);
         if (bytes_written <= 0) {
             throw Error::Error{"send: %s", strerror(errno)};
         }
 
         total_bytes_written += bytes_written;
+        this->bytes_sent += bytes_written;
     } while (total_bytes_written < size);
 }
 
+/**
+ * @brief Sends two chunks of data through the socket with a single system
+ * call (when the socket takes them at once).
+ *
+ * @param head Pointer to the first chunk.
+ * @param head_size Size of the first chunk.
+ * @param data Pointer to the second chunk.
+ * @param size Size of the second chunk.
+ */
+void IO::Socket::write(const void* head, std::size_t head_size,
+                       const void* data, std::size_t size) {
+    struct iovec iov[2];
+    iov[0].iov_base = const_cast<void*>(head);
+    iov[0].iov_len = head_size;
+    iov[1].iov_base = const_cast<void*>(data);
+    iov[1].iov_len = size;
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = iov;
+    message.msg_iovlen = 2;
+
+    this->send_calls += 1;
+    ssize_t bytes_written = sendmsg(this->fd, &message, MSG_NOSIGNAL);
+    if (bytes_written < 0) {
+        throw Error::Error{"sendmsg: %s", strerror(errno)};
+    }
+    this->bytes_sent += bytes_written;
+
+    /* sends whatever didn't fit */
+    std::size_t written = bytes_written;
+    if (written < head_size) {
+        this->write(static_cast<const char*>(head) + written,
+                    head_size - written);
+        written = head_size;
+    }
+    if (written - head_size < size) {
+        this->write(static_cast<const char*>(data) + (written - head_size),
+                    size - (written - head_size));
+    }
+}
+
 /**
  * @brief Reads a chunk of bytes from the socket.
  *
@@ -189,9 +246,313 @@ void IO::Socket::write(const void* data, std::size_t size) {
  * @return Bytes written into the buffer.
  */
 ssize_t IO::Socket::read(void* data, std::size_t size) {
+    this->recv_calls += 1;
     ssize_t bytes_read = recv(this->fd, data, size, MSG_WAITALL);
     if (bytes_read < 0) {
         throw Error::Error{"recv: %s", strerror(errno)};
     }
+    this->bytes_received += bytes_read;
     return bytes_read;
 }
+
+/**
+ * @brief Blocks until some bytes arrive and reads as many as are available
+ * (up to `size`).
+ *
+ * @param data Pointer to the output buffer.
+ * @param size Size of the output buffer.
+ * @return Bytes read, or 0 if the peer closed the connection.
+ */
+ssize_t IO::Socket::read_some(void* data, std::size_t size) {
+    while (true) {
+        this->recv_calls += 1;
+        ssize_t bytes_read = recv(this->fd, data, size, 0);
+        if (bytes_read >= 0) {
+            this->bytes_received += bytes_read;
+            return bytes_read;
+        }
+        if (errno != EINTR) {
+            throw Error::Error{"recv: %s", strerror(errno)};
+        }
+    }
+}
+
+/**
+ * @brief Sends part of a file straight from the kernel with `sendfile`,
+ * without copying it through user space.
+ *
+ * @param file_fd Descriptor of the file to send.
+ * @param offset Position of the file where the data starts.
+ * @param size Bytes to send.
+ * @return Bytes sent. It is less than `size` only if the file can't be sent
+ * this way (e.g. it is not a regular file), in which case the caller must
+ * send the rest by itself.
+ */
+uint64_t IO::Socket::send_file(int file_fd, uint64_t offset, uint64_t size) {
+    off_t position = offset;
+    uint64_t total_bytes_sent = 0;
+    while (total_bytes_sent < size) {
+        this->send_calls += 1;
+        ssize_t bytes_sent =
+            sendfile(this->fd, file_fd, &position, size - total_bytes_sent);
+        if (bytes_sent > 0) {
+            total_bytes_sent += bytes_sent;
+            this->bytes_sent += bytes_sent;
+            continue;
+        }
+        if (bytes_sent == -1 && errno == EINTR) {
+            continue;
+        }
+        if (total_bytes_sent == 0 && bytes_sent == -1 &&
+            (errno == EINVAL || errno == ENOSYS)) {
+            /* not supported for this file */
+            break;
+        }
+        if (bytes_sent == 0) {
+            throw Error::Error{"sendfile: archivo truncado"};
+        }
+        throw Error::Error{"sendfile: %s", strerror(errno)};
+    }
+    return total_bytes_sent;
+}
+
+/**
+ * @brief Writes data that is in a pipe into a file with plain reads and
+ * writes.
+ *
+ * @param pipe_fd Read end of the pipe.
+ * @param file_fd File to write to.
+ * @param size Bytes in the pipe.
+ */
+static void drain_pipe(int pipe_fd, int file_fd, std::size_t size) {
+    char buffer[4096];
+    while (size > 0) {
+        ssize_t bytes_read =
+            ::read(pipe_fd, buffer, std::min(size, sizeof(buffer)));
+        if (bytes_read == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            throw Error::Error{"read: %s", strerror(errno)};
+        }
+        for (ssize_t written = 0; written < bytes_read;) {
+            ssize_t n =
+                ::write(file_fd, buffer + written, bytes_read - written);
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                throw Error::Error{"write: %s", strerror(errno)};
+            }
+            written += n;
+        }
+        size -= bytes_read;
+    }
+}
+
+/**
+ * @brief Receives data straight into a file, moving it from the socket to
+ * the file through a pipe with `splice`, without copying it to user space.
+ * The data is written at the current position of the file.
+ *
+ * @param file_fd Descriptor of the file to write.
+ * @param size Bytes to receive.
+ * @return Bytes received. It is less than `size` if the socket can't be read
+ * this way or the peer closed the connection, in which case the caller must
+ * receive the rest by itself.
+ */
+uint64_t IO::Socket::receive_file(int file_fd, uint64_t size) {
+#define PIPE_SIZE (1024 * 1024)
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+        return 0;
+    }
+    /* a bigger pipe means fewer calls, but the default one works too */
+    fcntl(pipe_fds[1], F_SETPIPE_SZ, PIPE_SIZE);
+
+    uint64_t total_bytes_received = 0;
+    try {
+        while (total_bytes_received < size) {
+            this->recv_calls += 1;
+            ssize_t in_pipe = splice(
+                this->fd, NULL, pipe_fds[1], NULL,
+                std::min<uint64_t>(size - total_bytes_received, PIPE_SIZE),
+                SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (in_pipe == -1 && errno == EINTR) {
+                continue;
+            }
+            if (in_pipe == -1 && total_bytes_received == 0 &&
+                (errno == EINVAL || errno == ENOSYS)) {
+                /* not supported for this socket */
+                break;
+            }
+            if (in_pipe == -1) {
+                throw Error::Error{"splice: %s", strerror(errno)};
+            }
+            if (in_pipe == 0) {
+                /* the peer closed the connection */
+                break;
+            }
+
+            while (in_pipe > 0) {
+                ssize_t written =
+                    splice(pipe_fds[0], NULL, file_fd, NULL, in_pipe,
+                           SPLICE_F_MOVE | SPLICE_F_MORE);
+                if (written == -1 && errno == EINTR) {
+                    continue;
+                }
+                if (written == -1 && (errno == EINVAL || errno == ENOSYS)) {
+                    /* the file doesn't take spliced data */
+                    drain_pipe(pipe_fds[0], file_fd, in_pipe);
+                    written = in_pipe;
+                } else if (written <= 0) {
+                    throw Error::Error{"splice: %s", strerror(errno)};
+                }
+                in_pipe -= written;
+                total_bytes_received += written;
+                this->bytes_received += written;
+            }
+        }
+    } catch (...) {
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        throw;
+    }
+
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    return total_bytes_received;
+}
+
+/**
+ * @brief Switches the socket between blocking and non blocking mode.
+ *
+ * @param blocking Whether the IO operations should block.
+ */
+void IO::Socket::set_blocking(bool blocking) {
+    int flags = fcntl(this->fd, F_GETFL, 0);
+    if (flags == -1) {
+        throw Error::Error{"fcntl: %s", strerror(errno)};
+    }
+
+    flags = blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+    if (fcntl(this->fd, F_SETFL, flags) == -1) {
+        throw Error::Error{"fcntl: %s", strerror(errno)};
+    }
+}
+
+/**
+ * @brief Sends as much of the buffer as the socket accepts without blocking.
+ *
+ * @param data Pointer to the data buffer.
+ * @param size Size of the buffer.
+ * @return Bytes written, or -1 if the socket is not writable right now.
+ */
+ssize_t IO::Socket::try_write(const void* data, std::size_t size) {
+    while (true) {
+        this->send_calls += 1;
+        ssize_t bytes_written = send(this->fd, data, size, MSG_NOSIGNAL);
+        if (bytes_written >= 0) {
+            this->bytes_sent += bytes_written;
+            return bytes_written;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return -1;
+        }
+        if (errno != EINTR) {
+            throw Error::Error{"send: %s", strerror(errno)};
+        }
+    }
+}
+
+/**
+ * @brief Reads whatever is available in the socket without blocking.
+ *
+ * @param data Pointer to the output buffer.
+ * @param size Size of the output buffer.
+ * @return Bytes read, 0 if the peer closed the connection or -1 if there is
+ * nothing to read right now.
+ */
+ssize_t IO::Socket::try_read(void* data, std::size_t size) {
+    while (true) {
+        this->recv_calls += 1;
+        ssize_t bytes_read = recv(this->fd, data, size, 0);
+        if (bytes_read >= 0) {
+            this->bytes_received += bytes_read;
+            return bytes_read;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return -1;
+        }
+        if (errno != EINTR) {
+            throw Error::Error{"recv: %s", strerror(errno)};
+        }
+    }
+}
+
+/**
+ * @brief Creates a pair of connected local sockets (not TCP ones), to talk
+ * within the process without going through the network stack.
+ *
+ * @return Both ends.
+ */
+std::pair<IO::Socket, IO::Socket> IO::Socket::pair() {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+        throw Error::Error{"socketpair: %s", strerror(errno)};
+    }
+    return std::pair<Socket, Socket>{Socket{fds[0]}, Socket{fds[1]}};
+}
+
+/**
+ * @brief Enables or disables Nagle's algorithm. Callers that coalesce their
+ * own writes should disable it, so small responses are not delayed.
+ * Sockets that are not TCP ones (see `pair`) don't have it.
+ *
+ * @param nodelay Whether small packets are sent right away.
+ */
+void IO::Socket::set_nodelay(bool nodelay) {
+    int val = nodelay ? 1 : 0;
+    if (setsockopt(this->fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val)) ==
+            -1 &&
+        errno != EOPNOTSUPP) {
+        throw Error::Error{"setsockopt: %s", strerror(errno)};
+    }
+}
+
+/**
+ * @brief Gets the underlying file descriptor (to register it in a poller).
+ *
+ * @return File descriptor.
+ */
+int IO::Socket::get_fd() const {
+    return this->fd;
+}
+
+/**
+ * @brief Number of send system calls made through this socket.
+ */
+uint64_t IO::Socket::get_send_calls() const {
+    return this->send_calls;
+}
+
+/**
+ * @brief Number of receive system calls made through this socket.
+ */
+uint64_t IO::Socket::get_recv_calls() const {
+    return this->recv_calls;
+}
+
+/**
+ * @brief Number of bytes sent through this socket.
+ */
+uint64_t IO::Socket::get_bytes_sent() const {
+    return this->bytes_sent;
+}
+
+/**
+ * @brief Number of bytes received through this socket.
+ */
+uint64_t IO::Socket::get_bytes_received() const {
+    return this->bytes_received;
+}
@@ -3,6 +3,7 @@
 
 #include <cinttypes>
 #include <string>
+#include <utility>
 #include "common_error.h"
 
 namespace IO {
@@ -21,8 +22,18 @@ class Socket {
     ~Socket();
 
     /** IO */
-    void write(const void* data, std::size_t size);
+    void write(const void* data, std::size_t size, bool more = false);
+    void write(const void* head, std::size_t head_size, const void* data,
+               std::size_t size);
     ssize_t read(void* data, std::size_t size);
+    ssize_t read_some(void* data, std::size_t size);
+    uint64_t send_file(int file_fd, uint64_t offset, uint64_t size);
+    uint64_t receive_file(int file_fd, uint64_t size);
+
+    /** Non blocking IO */
+    void set_blocking(bool blocking);
+    ssize_t try_write(const void* data, std::size_t size);
+    ssize_t try_read(void* data, std::size_t size);
 
     /** Server */
     void bind(const std::string& port);
@@ -32,8 +43,20 @@ class Socket {
     /** Client */
     void connect(const std::string& address, const std::string& port);
 
+    /** Local */
+    static std::pair<Socket, Socket> pair();
+
     /** Others */
     void shutdown();
+    void set_nodelay(bool nodelay);
+    int get_fd() const;
+
+    /** Number of send and receive system calls made (for benchmarks). */
+    uint64_t get_send_calls() const;
+    uint64_t get_recv_calls() const;
+    /** Number of bytes sent and received through the socket. */
+    uint64_t get_bytes_sent() const;
+    uint64_t get_bytes_received() const;
 
     /** operators */
     Socket& operator=(Socket& other) = delete;
@@ -43,6 +66,12 @@ class Socket {
     explicit Socket(int fd);
     /** File descriptor. */
     int fd{-1};
+    /** System call counters. */
+    uint64_t send_calls{0};
+    uint64_t recv_calls{0};
+    /** Byte counters. */
+    uint64_t bytes_sent{0};
+    uint64_t bytes_received{0};
 };
 }  // namespace IO
 
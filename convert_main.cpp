@@ -0,0 +1,48 @@
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <string>
+#include "server_file_index.h"
+#include "server_hash_table.h"
+#include "server_snapshot.h"
+#include "server_tag_index.h"
+
+/**
+ * Converts an index file between the text and the binary formats (the
+ * format of the input is detected).
+ */
+int main(int argc, const char* argv[]) {
+    if (argc != 4 || (std::string{argv[1]} != "text" &&
+                      std::string{argv[1]} != "binary")) {
+        std::cout << "uso: convert <text|binary> <entrada> <salida>"
+                  << std::endl;
+        return 0;
+    }
+
+    Server::Snapshot::Format format = std::string{argv[1]} == "binary"
+                                          ? Server::Snapshot::Format::Binary
+                                          : Server::Snapshot::Format::Text;
+    try {
+        Server::HashTable hash_table;
+        Server::FileIndex files{hash_table};
+        Server::TagIndex tags{hash_table};
+
+        auto start = std::chrono::steady_clock::now();
+        Server::Snapshot::load(argv[2], files, tags);
+        auto loaded = std::chrono::steady_clock::now();
+        Server::Snapshot::save(argv[3], format, files, tags);
+        auto saved = std::chrono::steady_clock::now();
+
+        using std::chrono::duration_cast;
+        using std::chrono::milliseconds;
+        std::cout << "carga: "
+                  << duration_cast<milliseconds>(loaded - start).count()
+                  << " ms, escritura: "
+                  << duration_cast<milliseconds>(saved - loaded).count()
+                  << " ms" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -91,7 +91,7 @@ class Server {
      */
     void handle_client(Functor& handler) {
         /* blocks until a client connects to the server */
-        IO::Socket client = this->socket.accept();
+        IO::Socket client = this->accept();
 
         /* removes handlers that already finished */
         this->handlers_cleanup();
@@ -102,6 +102,16 @@ class Server {
         this->handlers.push_back(h);
     }
 
+    /**
+     * @brief Blocks until a client connects to the server, leaving it to the
+     * caller to serve it.
+     *
+     * @return The new client's socket.
+     */
+    IO::Socket accept() {
+        return this->socket.accept();
+    }
+
    private:
     /** Internal server socket. */
     IO::Socket socket;
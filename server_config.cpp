@@ -0,0 +1,110 @@
+#include "server_config.h"
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include "common_error.h"
+
+/**
+ * @brief Parses a positive integer option value.
+ *
+ * @param option Full option, for the error message.
+ * @param value Value to parse.
+ * @return Parsed value.
+ */
+static unsigned parse_unsigned(const std::string& option,
+                               const std::string& value) {
+    char* end = nullptr;
+    unsigned long n = strtoul(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || n == 0) {
+        throw Error::Error{"opcion invalida: %s", option.c_str()};
+    }
+    return n;
+}
+
+/**
+ * @brief Builds the configuration from the command line arguments.
+ *
+ * @param argc Number of arguments.
+ * @param argv Arguments, starting with the program name.
+ */
+Server::Config::Config(int argc, const char* argv[]) {
+    if (argc < 3) {
+        throw Error::Error{"parametros invalidos"};
+    }
+    this->port = argv[1];
+    this->index_file = argv[2];
+
+    unsigned cores = std::thread::hardware_concurrency();
+    this->io_threads = cores > 0 ? cores : 1;
+    this->workers = 4 * this->io_threads;
+
+    for (int i = 3; i < argc; i++) {
+        this->parse_option(argv[i]);
+    }
+}
+
+Server::Config::~Config() {
+}
+
+/**
+ * @brief Applies a single `--name=value` option.
+ *
+ * @param option The option as given in the command line.
+ */
+void Server::Config::parse_option(const std::string& option) {
+    std::size_t eq = option.find('=');
+    if (option.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+        throw Error::Error{"opcion invalida: %s", option.c_str()};
+    }
+    std::string name = option.substr(2, eq - 2);
+    std::string value = option.substr(eq + 1);
+
+    if (name == "mode") {
+        if (value == "threads") {
+            this->mode = Mode::Threads;
+        } else if (value == "pool") {
+            this->mode = Mode::Pool;
+        } else if (value == "epoll") {
+            this->mode = Mode::Epoll;
+        } else {
+            throw Error::Error{"opcion invalida: %s", option.c_str()};
+        }
+    } else if (name == "io-threads") {
+        this->io_threads = parse_unsigned(option, value);
+    } else if (name == "workers") {
+        this->workers = parse_unsigned(option, value);
+    } else if (name == "queue") {
+        this->queue_size = parse_unsigned(option, value);
+    } else if (name == "overflow") {
+        if (value == "block") {
+            this->overflow = Overflow::Block;
+        } else if (value == "reject") {
+            this->overflow = Overflow::Reject;
+        } else {
+            throw Error::Error{"opcion invalida: %s", option.c_str()};
+        }
+    } else if (name == "verify") {
+        if (value == "sha256") {
+            this->verify = true;
+        } else if (value == "none") {
+            this->verify = false;
+        } else {
+            throw Error::Error{"opcion invalida: %s", option.c_str()};
+        }
+    } else if (name == "compression") {
+        if (value == "deflate") {
+            this->compression = IO::Codec::Deflate;
+        } else if (value == "none") {
+            this->compression = IO::Codec::None;
+        } else {
+            throw Error::Error{"opcion invalida: %s", option.c_str()};
+        }
+    } else if (name == "checkpoint") {
+        this->checkpoint_interval =
+            value == "none" ? 0 : parse_unsigned(option, value);
+    } else if (name == "tag-timeout") {
+        this->tag_timeout = parse_unsigned(option, value);
+    } else {
+        throw Error::Error{"opcion invalida: %s", option.c_str()};
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef SERVER_CONFIG_H_
+#define SERVER_CONFIG_H_
+
+#include <string>
+#include "common_comm.h"
+#include "server_pool.h"
+
+namespace Server {
+/** How the server serves its clients. */
+enum class Mode { Threads, Pool, Epoll };
+
+/**
+ * @brief Server settings, taken from the command line:
+ * `server <port> <index> [--option=value ...]`.
+ */
+class Config {
+   public:
+    Config(int argc, const char* argv[]);
+    ~Config();
+
+    /** Port or service to listen on. */
+    std::string port;
+    /** Index file name. */
+    std::string index_file;
+    /** Serving model (`--mode=threads|pool|epoll`). */
+    Mode mode{Mode::Threads};
+    /** IO threads of the epoll mode (`--io-threads=N`). */
+    unsigned io_threads{1};
+    /**
+     * Worker threads of the pool mode, or of the epoll mode for the work
+     * that blocks (`--workers=N`).
+     */
+    unsigned workers{1};
+    /** Clients that may wait for a worker (`--queue=N`). */
+    std::size_t queue_size{128};
+    /**
+     * What to do with new clients when the queue is full
+     * (`--overflow=block|reject`). Rejected clients that speak revision 8
+     * or later get a `Busy` response, the others are disconnected, so the
+     * command fails either way. `block` (which delays accepting new
+     * connections instead) is the default.
+     */
+    Overflow overflow{Overflow::Block};
+    /**
+     * Whether pushed files must match their hash (`--verify=sha256|none`).
+     * Requires clients to push files with their SHA-256 as the hash, so it
+     * is off by default.
+     */
+    bool verify{false};
+    /**
+     * Compression offered to the clients that ask for it
+     * (`--compression=deflate|none`). Off by default: compressed files are
+     * copied through user space, without `sendfile` nor `splice`, and the
+     * ones that are already compressed gain nothing from it.
+     */
+    IO::Codec compression{IO::Codec::None};
+    /**
+     * Seconds between background checkpoints of the index
+     * (`--checkpoint=N|none`). Each one bounds the log replayed at startup.
+     */
+    unsigned checkpoint_interval{60};
+    /**
+     * Seconds a tag waits for the uploads of its files before it is
+     * rejected (`--tag-timeout=N`).
+     */
+    unsigned tag_timeout{60};
+
+   private:
+    void parse_option(const std::string& option);
+};
+}  // namespace Server
+
+#endif
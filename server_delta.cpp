@@ -0,0 +1,144 @@
+#include "server_delta.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include "common_error.h"
+
+/**
+ * @brief Opens the basis and creates the file to rebuild.
+ *
+ * @param basis_name Name of the basis file.
+ * @param block_size Size of the blocks the copies refer to.
+ * @param file_name Name of the file to write.
+ */
+Server::DeltaWriter::DeltaWriter(const std::string& basis_name,
+                                 uint32_t block_size,
+                                 const std::string& file_name)
+    : file_name(file_name), block_size(block_size) {
+    if (block_size == 0) {
+        throw Error::Error{"Tamanio de bloque invalido"};
+    }
+
+    this->basis_fd = open(basis_name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (this->basis_fd == -1) {
+        throw Error::Error{"open %s: %s", basis_name.c_str(), strerror(errno)};
+    }
+    struct stat info;
+    if (fstat(this->basis_fd, &info) == -1) {
+        int error = errno;
+        ::close(this->basis_fd);
+        throw Error::Error{"fstat %s: %s", basis_name.c_str(),
+                           strerror(error)};
+    }
+    this->basis_size = info.st_size;
+
+    this->fd = open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0644);
+    if (this->fd == -1) {
+        int error = errno;
+        ::close(this->basis_fd);
+        throw Error::Error{"open %s: %s", file_name.c_str(), strerror(error)};
+    }
+}
+
+Server::DeltaWriter::~DeltaWriter() {
+    if (this->fd != -1) {
+        ::close(this->fd);
+    }
+    if (this->basis_fd != -1) {
+        ::close(this->basis_fd);
+    }
+}
+
+/**
+ * @brief Appends consecutive blocks of the basis.
+ * The data is copied by the kernel (with `copy_file_range`), falling back
+ * to reading and writing it when that is not possible.
+ *
+ * @param first_block Index of the first block.
+ * @param num_blocks Number of blocks.
+ */
+void Server::DeltaWriter::copy(uint32_t first_block, uint32_t num_blocks) {
+#define COPY_BUFFER_SIZE 65536
+    uint64_t offset = static_cast<uint64_t>(first_block) * this->block_size;
+    uint64_t size = static_cast<uint64_t>(num_blocks) * this->block_size;
+    if (offset + size > this->basis_size) {
+        throw Error::Error{"Bloque fuera de rango"};
+    }
+
+    while (size > 0) {
+        loff_t in = offset;
+        ssize_t copied =
+            copy_file_range(this->basis_fd, &in, this->fd, nullptr, size, 0);
+        if (copied <= 0) {
+            break;
+        }
+        offset += copied;
+        size -= copied;
+        this->written += copied;
+    }
+
+    /* copies whatever copy_file_range couldn't */
+    while (size > 0) {
+        char buffer[COPY_BUFFER_SIZE];
+        ssize_t bytes_read = pread(this->basis_fd, buffer,
+                                   std::min<uint64_t>(size, sizeof(buffer)),
+                                   offset);
+        if (bytes_read <= 0) {
+            throw Error::Error{"Error leyendo la version anterior de %s",
+                               this->file_name.c_str()};
+        }
+        this->write(buffer, bytes_read);
+        offset += bytes_read;
+        size -= bytes_read;
+    }
+}
+
+/**
+ * @brief Appends literal data.
+ *
+ * @param data Bytes to append.
+ * @param size Number of bytes.
+ */
+void Server::DeltaWriter::literal(const void* data, std::size_t size) {
+    this->write(data, size);
+}
+
+/**
+ * @brief Finishes the file.
+ */
+void Server::DeltaWriter::close() {
+    int fd = this->fd;
+    this->fd = -1;
+    if (::close(fd) == -1) {
+        throw Error::Error{"close %s: %s", this->file_name.c_str(),
+                           strerror(errno)};
+    }
+}
+
+/**
+ * @brief Bytes of the file written so far.
+ */
+uint64_t Server::DeltaWriter::get_written() const {
+    return this->written;
+}
+
+/**
+ * @brief Writes the whole buffer at the end of the file.
+ */
+void Server::DeltaWriter::write(const void* data, std::size_t size) {
+    auto bytes = static_cast<const char*>(data);
+    for (std::size_t done = 0; done < size;) {
+        ssize_t n = ::write(this->fd, bytes + done, size - done);
+        if (n <= 0) {
+            throw Error::Error{"write %s: %s", this->file_name.c_str(),
+                               strerror(errno)};
+        }
+        done += n;
+    }
+    this->written += size;
+}
@@ -0,0 +1,44 @@
+#ifndef SERVER_DELTA_H_
+#define SERVER_DELTA_H_
+
+#include <cinttypes>
+#include <cstddef>
+#include <string>
+
+namespace Server {
+/**
+ * @brief Rebuilds a file pushed as a delta: blocks copied from the basis
+ * (an earlier version of the file) and literal data, in order.
+ */
+class DeltaWriter {
+   public:
+    DeltaWriter(const std::string& basis_name, uint32_t block_size,
+                const std::string& file_name);
+    ~DeltaWriter();
+
+    DeltaWriter(const DeltaWriter& other) = delete;
+    DeltaWriter& operator=(const DeltaWriter& other) = delete;
+
+    /** api */
+    void copy(uint32_t first_block, uint32_t num_blocks);
+    void literal(const void* data, std::size_t size);
+    void close();
+
+    /** query */
+    uint64_t get_written() const;
+
+   private:
+    void write(const void* data, std::size_t size);
+
+    std::string file_name;
+    uint32_t block_size;
+    /** Size of the basis file. */
+    uint64_t basis_size{0};
+    int basis_fd{-1};
+    int fd{-1};
+    /** Bytes of the file written so far. */
+    uint64_t written{0};
+};
+}  // namespace Server
+
+#endif
@@ -1,8 +1,10 @@
 #include "server_file_index.h"
 #include <condition_variable>
+#include <stdexcept>
 #include <string>
 
-Server::FileIndex::FileIndex() {
+Server::FileIndex::FileIndex(HashTable& hash_table)
+    : hash_table(&hash_table), shards(NUM_SHARDS) {
 }
 
 Server::FileIndex::~FileIndex() {
@@ -15,11 +17,24 @@ Server::FileIndex::~FileIndex() {
  * @return false if the hash is not added.
  */
 bool Server::FileIndex::exists(const std::string& hash) {
-    /* checks if the hash exists */
-    if (this->files.find(hash) == this->files.end()) {
+    HashId id;
+    return this->find(hash, id);
+}
+
+/**
+ * @brief Gets the id of a hash in the index.
+ *
+ * @param hash Hash.
+ * @param id Where the id is stored, if found.
+ * @return false if the hash is not added (it may be interned anyway, by a
+ * tag for instance).
+ */
+bool Server::FileIndex::find(const std::string& hash, HashId& id) const {
+    if (!this->hash_table->find(hash, id)) {
         return false;
     }
-    return true;
+    const auto& files = this->shards[shard_of(hash)].files;
+    return files.find(id) != files.end();
 }
 
 /**
@@ -27,15 +42,23 @@ bool Server::FileIndex::exists(const std::string& hash) {
  *
  * @param name File name.
  * @param hash Hash.
+ * @return The file name kept by the index, which stays valid as long as
+ * the index.
  */
-void Server::FileIndex::insert_file(const std::string& name,
-                                    const std::string& hash) {
+const std::string& Server::FileIndex::insert_file(const std::string& name,
+                                                  const std::string& hash) {
     if (this->exists(hash)) {
         throw Error::Exists{hash};
     }
 
-    this->hashes[name].insert(hash);
-    this->files[hash] = name;
+    HashId id = this->hash_table->intern(hash);
+    Shard& by_name = this->shards[shard_of(name)];
+    /* the names in `hashes` are never removed (nor moved, it's a map) */
+    auto versions = by_name.hashes.emplace(name, std::set<HashId>{}).first;
+    versions->second.insert(id);
+    by_name.latest[name] = id;
+    this->shards[shard_of(hash)].files[id] = name;
+    return versions->first;
 }
 
 /**
@@ -46,11 +69,21 @@ void Server::FileIndex::insert_file(const std::string& name,
  */
 void Server::FileIndex::remove_file(const std::string& name,
                                     const std::string& hash) {
-    if (this->exists(hash)) {
-        this->hashes[name].erase(hash);
+    HashId id;
+    if (!this->find(hash, id)) {
+        return;
     }
-    if (this->files.find(hash) != this->files.end()) {
-        this->files.erase(hash);
+    Shard& by_name = this->shards[shard_of(name)];
+    by_name.hashes[name].erase(id);
+    this->shards[shard_of(hash)].files.erase(id);
+    /* the order of the other versions is unknown, any of them will do */
+    auto latest = by_name.latest.find(name);
+    if (latest != by_name.latest.end() && latest->second == id) {
+        if (by_name.hashes[name].empty()) {
+            by_name.latest.erase(latest);
+        } else {
+            latest->second = *by_name.hashes[name].rbegin();
+        }
     }
 }
 
@@ -62,23 +95,42 @@ void Server::FileIndex::remove_file(const std::string& name,
  */
 const std::string& Server::FileIndex::get_file_name(
     const std::string& hash) const {
-    return this->files.at(hash);
+    HashId id;
+    if (!this->find(hash, id)) {
+        throw std::out_of_range{hash};
+    }
+    return this->shards[shard_of(hash)].files.at(id);
 }
 
 /**
- * @brief Returns an iterator to the files and associated hashes.
+ * @brief Gets the hash most recently inserted for the given file name.
  *
- * @return Iterator to the set of hashes for each file.
+ * @param name File name.
+ * @return Hash of the latest version of the file.
  */
-Server::FileIndex::const_iterator Server::FileIndex::begin() const {
-    return this->hashes.begin();
+std::string Server::FileIndex::get_latest(const std::string& name) const {
+    try {
+        return this->hash_table->get(
+            this->shards[shard_of(name)].latest.at(name));
+    } catch (const std::out_of_range& e) {
+        throw Error::NotFound{name};
+    }
 }
 
 /**
- * @brief Last iterator.
+ * @brief Visits every hash in the index, in no particular order.
  *
- * @return Last iterator.
+ * @param visit Called with each hash and its file name (the one kept by
+ * the index, see `insert_file`).
  */
-Server::FileIndex::const_iterator Server::FileIndex::end() const {
-    return this->hashes.end();
+void Server::FileIndex::for_each_hash(
+    const std::function<void(const std::string& hash,
+                             const std::string& name)>& visit) const {
+    for (const Shard& shard : this->shards) {
+        for (const auto& versions : shard.hashes) {
+            for (HashId id : versions.second) {
+                visit(this->hash_table->get(id), versions.first);
+            }
+        }
+    }
 }
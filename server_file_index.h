@@ -2,38 +2,62 @@
 #define SERVER_FILE_INDEX_H_
 
 #include <condition_variable>
+#include <functional>
 #include <map>
 #include <mutex>
 #include <set>
 #include <string>
+#include <vector>
 #include "common_error.h"
+#include "server_flat_map.h"
+#include "server_hash_table.h"
+#include "server_shard.h"
 
 namespace Server {
+/**
+ * @brief Files and their versions (hashes).
+ * The entries are split into shards (see `shard_of`): the entry of a hash
+ * goes to the shard of the hash, the ones of a file name to the shard of
+ * the name. Calls that touch different shards may run concurrently, the
+ * caller holds the lock of each shard it touches.
+ * The hashes are kept as ids of a HashTable, which may be shared with other
+ * indexes and must outlive this one.
+ */
 class FileIndex {
    public:
-    using const_iterator =
-        std::map<std::string, std::set<std::string>>::const_iterator;
-
-    FileIndex();
+    explicit FileIndex(HashTable& hash_table);
     ~FileIndex();
 
     /** api */
-    void insert_file(const std::string& name, const std::string& hash);
+    const std::string& insert_file(const std::string& name,
+                                   const std::string& hash);
     void remove_file(const std::string& name, const std::string& hash);
 
     /** query */
     bool exists(const std::string& hash);
     const std::string& get_file_name(const std::string& hash) const;
-
-    /** iterators */
-    const_iterator begin() const;
-    const_iterator end() const;
+    std::string get_latest(const std::string& name) const;
+    void for_each_hash(
+        const std::function<void(const std::string& hash,
+                                 const std::string& name)>& visit) const;
 
    private:
-    /* maps the file name to a group of hashes */
-    std::map<std::string, std::set<std::string>> hashes;
-    /* maps the hash to a file */
-    std::map<std::string, std::string> files;
+    /* reads and writes the maps directly */
+    friend class Snapshot;
+
+    bool find(const std::string& hash, HashId& id) const;
+
+    struct Shard {
+        /* maps the file name to a group of hashes */
+        std::map<std::string, std::set<HashId>> hashes;
+        /* maps the hash to a file */
+        FlatMap<HashId, std::string> files;
+        /* maps the file name to its most recently inserted hash */
+        FlatMap<std::string, HashId> latest;
+    };
+
+    HashTable* hash_table;
+    std::vector<Shard> shards;
 };
 }  // namespace Server
 
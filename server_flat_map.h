@@ -0,0 +1,311 @@
+#ifndef SERVER_FLAT_MAP_H_
+#define SERVER_FLAT_MAP_H_
+
+#include <cinttypes>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace Server {
+/**
+ * @brief Hash map with open addressing, for the lookups of the indexes.
+ * The entries live in a single array, next to an array of control bytes
+ * (one per entry: empty, deleted, or 7 bits of the hash of its key).
+ * Lookups probe groups of 16 control bytes at once (with SSE2 where
+ * available) and only compare the keys whose bits match, so they touch a
+ * couple of cache lines instead of walking a tree.
+ * Iteration follows no particular order; callers that need one sort the
+ * entries. Inserting or erasing invalidates iterators.
+ */
+template <class Key, class Value, class Hash = std::hash<Key>>
+class FlatMap {
+   public:
+    using value_type = std::pair<Key, Value>;
+
+    template <class Map, class Entry>
+    class basic_iterator {
+       public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Entry;
+        using difference_type = std::ptrdiff_t;
+        using pointer = Entry*;
+        using reference = Entry&;
+
+        basic_iterator(Map* map, std::size_t index) : map(map), index(index) {
+            this->skip();
+        }
+
+        reference operator*() const {
+            return this->map->slots[this->index];
+        }
+
+        pointer operator->() const {
+            return &this->map->slots[this->index];
+        }
+
+        basic_iterator& operator++() {
+            this->index++;
+            this->skip();
+            return *this;
+        }
+
+        bool operator==(const basic_iterator& other) const {
+            return this->index == other.index;
+        }
+
+        bool operator!=(const basic_iterator& other) const {
+            return this->index != other.index;
+        }
+
+       private:
+        friend class FlatMap;
+
+        /** Moves to the next entry in use. */
+        void skip() {
+            while (this->index < this->map->slots.size() &&
+                   this->map->control[this->index] < 0) {
+                this->index++;
+            }
+        }
+
+        Map* map;
+        std::size_t index;
+    };
+
+    using iterator = basic_iterator<FlatMap, value_type>;
+    using const_iterator = basic_iterator<const FlatMap, const value_type>;
+
+    FlatMap() : control(GROUP_SIZE, EMPTY), slots(GROUP_SIZE) {
+    }
+
+    iterator begin() {
+        return iterator{this, 0};
+    }
+
+    iterator end() {
+        return iterator{this, this->slots.size()};
+    }
+
+    const_iterator begin() const {
+        return const_iterator{this, 0};
+    }
+
+    const_iterator end() const {
+        return const_iterator{this, this->slots.size()};
+    }
+
+    std::size_t size() const {
+        return this->count;
+    }
+
+    bool empty() const {
+        return this->count == 0;
+    }
+
+    iterator find(const Key& key) {
+        return iterator{this, this->lookup(key)};
+    }
+
+    const_iterator find(const Key& key) const {
+        return const_iterator{this, this->lookup(key)};
+    }
+
+    Value& at(const Key& key) {
+        std::size_t index = this->lookup(key);
+        if (index == this->slots.size()) {
+            throw std::out_of_range{"FlatMap::at"};
+        }
+        return this->slots[index].second;
+    }
+
+    const Value& at(const Key& key) const {
+        std::size_t index = this->lookup(key);
+        if (index == this->slots.size()) {
+            throw std::out_of_range{"FlatMap::at"};
+        }
+        return this->slots[index].second;
+    }
+
+    Value& operator[](const Key& key) {
+        return this->emplace(key, Value{}).first->second;
+    }
+
+    /**
+     * @brief Adds an entry, unless the key is already in the map.
+     *
+     * @return The entry of the key, and whether it was added.
+     */
+    std::pair<iterator, bool> emplace(const Key& key, Value value) {
+        std::size_t index = this->lookup(key);
+        if (index != this->slots.size()) {
+            return {iterator{this, index}, false};
+        }
+        /* keeps at least 1 slot out of 8 empty, so probes end quickly */
+        if ((this->count + this->deleted + 1) * 8 > this->slots.size() * 7) {
+            this->rehash(this->count * 2 >= this->slots.size() / 2
+                             ? this->slots.size() * 2
+                             : this->slots.size());
+        }
+        uint64_t hash = this->hash_of(key);
+        index = this->free_slot(hash);
+        if (this->control[index] == DELETED) {
+            this->deleted--;
+        }
+        this->control[index] = tag_of(hash);
+        this->slots[index] = value_type{key, std::move(value)};
+        this->count++;
+        return {iterator{this, index}, true};
+    }
+
+    std::size_t erase(const Key& key) {
+        std::size_t index = this->lookup(key);
+        if (index == this->slots.size()) {
+            return 0;
+        }
+        this->erase(iterator{this, index});
+        return 1;
+    }
+
+    void erase(iterator it) {
+        this->control[it.index] = DELETED;
+        this->slots[it.index] = value_type{};
+        this->count--;
+        this->deleted++;
+    }
+
+    /**
+     * @brief Gets the memory taken by the map itself, not counting what
+     * its keys and values allocate.
+     */
+    std::size_t memory() const {
+        return this->control.capacity() +
+               this->slots.capacity() * sizeof(value_type);
+    }
+
+   private:
+    static const std::size_t GROUP_SIZE = 16;
+    static const int8_t EMPTY = -128;
+    static const int8_t DELETED = -2;
+
+    /**
+     * @brief Hashes a key, spreading the bits (the hashes of integers are
+     * the integers themselves, and the keys of a shard share their low
+     * bits, see `shard_of`).
+     */
+    uint64_t hash_of(const Key& key) const {
+        return static_cast<uint64_t>(Hash{}(key)) * 0x9e3779b97f4a7c15ULL;
+    }
+
+    /** Bits of the hash kept in the control byte. */
+    static int8_t tag_of(uint64_t hash) {
+        return static_cast<int8_t>(hash >> 57);
+    }
+
+    /** First group to probe. */
+    std::size_t group_of(uint64_t hash) const {
+        return (hash >> 32) & (this->slots.size() / GROUP_SIZE - 1);
+    }
+
+    /**
+     * @brief Finds the bytes of a group equal to a value.
+     *
+     * @return A bit per byte of the group, from the least significant.
+     */
+    uint32_t match(std::size_t group, int8_t value) const {
+        const int8_t* bytes = &this->control[group * GROUP_SIZE];
+#ifdef __SSE2__
+        __m128i ctrl =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes));
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(value)));
+#else
+        uint32_t mask = 0;
+        for (std::size_t i = 0; i < GROUP_SIZE; i++) {
+            mask |= static_cast<uint32_t>(bytes[i] == value) << i;
+        }
+        return mask;
+#endif
+    }
+
+    /**
+     * @brief Finds the slot of a key. The groups are probed in triangular
+     * order (1, 2, 3... groups apart), which visits all of them as their
+     * number is a power of two.
+     *
+     * @return The slot, or the number of slots if the key is missing.
+     */
+    std::size_t lookup(const Key& key) const {
+        uint64_t hash = this->hash_of(key);
+        int8_t tag = tag_of(hash);
+        std::size_t mask = this->slots.size() / GROUP_SIZE - 1;
+        std::size_t group = this->group_of(hash);
+        for (std::size_t step = 1;; step++) {
+            for (uint32_t bits = this->match(group, tag); bits;
+                 bits &= bits - 1) {
+                std::size_t index = group * GROUP_SIZE + __builtin_ctz(bits);
+                if (this->slots[index].first == key) {
+                    return index;
+                }
+            }
+            if (this->match(group, EMPTY) || step > mask) {
+                return this->slots.size();
+            }
+            group = (group + step) & mask;
+        }
+    }
+
+    /** Finds where to add a key that is not in the map. */
+    std::size_t free_slot(uint64_t hash) const {
+        std::size_t mask = this->slots.size() / GROUP_SIZE - 1;
+        std::size_t group = this->group_of(hash);
+        for (std::size_t step = 1;; step++) {
+            uint32_t bits = this->match(group, EMPTY) |
+                            this->match(group, DELETED);
+            if (bits) {
+                return group * GROUP_SIZE + __builtin_ctz(bits);
+            }
+            group = (group + step) & mask;
+        }
+    }
+
+    /**
+     * @brief Moves the entries into new arrays, dropping the deleted ones.
+     *
+     * @param slots Number of slots (a power of two, at least GROUP_SIZE).
+     */
+    void rehash(std::size_t slots) {
+        std::vector<int8_t> old_control(slots, EMPTY);
+        std::vector<value_type> old_slots(slots);
+        old_control.swap(this->control);
+        old_slots.swap(this->slots);
+        for (std::size_t i = 0; i < old_slots.size(); i++) {
+            if (old_control[i] >= 0) {
+                uint64_t hash = this->hash_of(old_slots[i].first);
+                std::size_t index = this->free_slot(hash);
+                this->control[index] = tag_of(hash);
+                this->slots[index] = std::move(old_slots[i]);
+            }
+        }
+        this->deleted = 0;
+    }
+
+    std::vector<int8_t> control;
+    std::vector<value_type> slots;
+    std::size_t count{0};
+    std::size_t deleted{0};
+};
+
+template <class Key, class Value, class Hash>
+const std::size_t FlatMap<Key, Value, Hash>::GROUP_SIZE;
+template <class Key, class Value, class Hash>
+const int8_t FlatMap<Key, Value, Hash>::EMPTY;
+template <class Key, class Value, class Hash>
+const int8_t FlatMap<Key, Value, Hash>::DELETED;
+}  // namespace Server
+
+#endif
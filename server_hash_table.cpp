@@ -0,0 +1,260 @@
+#include "server_hash_table.h"
+#include <atomic>
+#include <cinttypes>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "common_error.h"
+
+/** size of a SHA-256 digest in hex */
+#define DIGEST_HEX_SIZE 64
+/** ids with this bit set refer to `strings`, the others to `digests` */
+#define STRING_ID 0x80000000u
+/** elements per chunk (a power of two), and most chunks of an array */
+#define CHUNK_BITS 16
+#define MAX_CHUNKS (STRING_ID >> CHUNK_BITS)
+/** slots of a shard when it is created, and most used slots out of 4 */
+#define INITIAL_SLOTS 16
+#define MAX_LOAD 3
+
+/* a slot is (high 32 bits of the hash << 32) | (id + 1), 0 if empty */
+
+namespace {
+/**
+ * @brief Bits of the hash of a key that pick its slot in the shard (the
+ * low ones pick the shard).
+ */
+uint32_t slot_bits(std::size_t hash) {
+    return static_cast<uint64_t>(hash) >> 32;
+}
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+}  // namespace
+
+template <class T>
+Server::HashTable::Chunks<T>::Chunks() : chunks(MAX_CHUNKS) {
+    for (std::atomic<T*>& chunk : this->chunks) {
+        chunk.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+template <class T>
+Server::HashTable::Chunks<T>::~Chunks() {
+    for (std::atomic<T*>& chunk : this->chunks) {
+        delete[] chunk.load();
+    }
+}
+
+/**
+ * @brief Appends an element. May run concurrently with other calls.
+ *
+ * @param value Element.
+ * @return Index of the element.
+ */
+template <class T>
+uint32_t Server::HashTable::Chunks<T>::add(const T& value) {
+    uint32_t index = this->count++;
+    if (index >= STRING_ID) {
+        throw Error::Error{"Demasiados hashes"};
+    }
+    std::atomic<T*>& chunk = this->chunks[index >> CHUNK_BITS];
+    T* elements = chunk.load(std::memory_order_acquire);
+    if (!elements) {
+        /* another thread may be allocating it too, the first one wins */
+        T* allocated = new T[1 << CHUNK_BITS];
+        if (chunk.compare_exchange_strong(elements, allocated)) {
+            elements = allocated;
+        } else {
+            delete[] allocated;
+        }
+    }
+    elements[index & ((1 << CHUNK_BITS) - 1)] = value;
+    return index;
+}
+
+/**
+ * @brief Gets an element. The caller must have learned its index after it
+ * was added (the index reached it through a lock, for instance).
+ */
+template <class T>
+const T& Server::HashTable::Chunks<T>::operator[](uint32_t index) const {
+    const T* elements =
+        this->chunks[index >> CHUNK_BITS].load(std::memory_order_acquire);
+    return elements[index & ((1 << CHUNK_BITS) - 1)];
+}
+
+template <class T>
+uint32_t Server::HashTable::Chunks<T>::size() const {
+    return this->count.load();
+}
+
+Server::HashTable::HashTable() : shards(NUM_SHARDS) {
+    for (Shard& shard : this->shards) {
+        shard.slots.resize(INITIAL_SLOTS);
+    }
+}
+
+Server::HashTable::~HashTable() {
+}
+
+/**
+ * @brief Gets the id of a hash, adding it if it is new.
+ *
+ * @param hash Hash.
+ * @return Id of the hash.
+ */
+Server::HashId Server::HashTable::intern(const std::string& hash) {
+    Digest digest;
+    const Digest* parsed = parse(hash, digest) ? &digest : nullptr;
+    std::size_t value = std::hash<std::string>{}(hash);
+    Shard& shard = this->shards[value % NUM_SHARDS];
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    uint64_t* slot = this->probe(shard, value, hash, parsed);
+    if (*slot != 0) {
+        return static_cast<HashId>(*slot) - 1;
+    }
+
+    HashId id = parsed ? this->digests.add(digest)
+                       : STRING_ID | this->strings.add(hash);
+    *slot = static_cast<uint64_t>(slot_bits(value)) << 32 | (id + 1ULL);
+    if (++shard.size * 4 > shard.slots.size() * MAX_LOAD) {
+        grow(shard);
+    }
+    return id;
+}
+
+/**
+ * @brief Looks up a hash.
+ *
+ * @param hash Hash.
+ * @param id Where the id of the hash is stored, if found.
+ * @return false if the hash was never interned.
+ */
+bool Server::HashTable::find(const std::string& hash, HashId& id) {
+    Digest digest;
+    const Digest* parsed = parse(hash, digest) ? &digest : nullptr;
+    std::size_t value = std::hash<std::string>{}(hash);
+    Shard& shard = this->shards[value % NUM_SHARDS];
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    uint64_t* slot = this->probe(shard, value, hash, parsed);
+    if (*slot == 0) {
+        return false;
+    }
+    id = static_cast<HashId>(*slot) - 1;
+    return true;
+}
+
+/**
+ * @brief Gets a hash, as it was interned.
+ *
+ * @param id Id of the hash.
+ * @return Hash.
+ */
+std::string Server::HashTable::get(HashId id) const {
+    if (id & STRING_ID) {
+        return this->strings[id & ~STRING_ID];
+    }
+    static const char digits[] = "0123456789abcdef";
+    const Digest& digest = this->digests[id];
+    std::string hash(DIGEST_HEX_SIZE, '0');
+    for (std::size_t i = 0; i < sizeof(digest.bytes); i++) {
+        hash[2 * i] = digits[digest.bytes[i] >> 4];
+        hash[2 * i + 1] = digits[digest.bytes[i] & 0xf];
+    }
+    return hash;
+}
+
+/**
+ * @brief Gets the number of hashes interned.
+ */
+std::size_t Server::HashTable::size() const {
+    return this->digests.size() + this->strings.size();
+}
+
+/**
+ * @brief Parses a SHA-256 digest in lowercase hex (other spellings are
+ * kept as strings, so `get` gives back the same hash).
+ *
+ * @return false if the hash is not a digest.
+ */
+bool Server::HashTable::parse(const std::string& hash, Digest& digest) {
+    if (hash.size() != DIGEST_HEX_SIZE) {
+        return false;
+    }
+    for (std::size_t i = 0; i < sizeof(digest.bytes); i++) {
+        int high = hex_value(hash[2 * i]);
+        int low = hex_value(hash[2 * i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        digest.bytes[i] = high << 4 | low;
+    }
+    return true;
+}
+
+/**
+ * @brief Checks if an id refers to a hash.
+ *
+ * @param digest The hash, parsed (nullptr if it is not a digest).
+ */
+bool Server::HashTable::matches(HashId id, const std::string& hash,
+                                const Digest* digest) const {
+    if (id & STRING_ID) {
+        return !digest && this->strings[id & ~STRING_ID] == hash;
+    }
+    return digest && memcmp(this->digests[id].bytes, digest->bytes,
+                            sizeof(digest->bytes)) == 0;
+}
+
+/**
+ * @brief Finds the slot of a hash in its shard (linear probing).
+ *
+ * @return The slot of the hash, or the empty one where it would go.
+ */
+uint64_t* Server::HashTable::probe(Shard& shard, std::size_t hash,
+                                   const std::string& key,
+                                   const Digest* digest) const {
+    uint32_t bits = slot_bits(hash);
+    std::size_t mask = shard.slots.size() - 1;
+    for (std::size_t i = bits & mask;; i = (i + 1) & mask) {
+        uint64_t& slot = shard.slots[i];
+        if (slot == 0 || ((slot >> 32) == bits &&
+                          this->matches(static_cast<HashId>(slot) - 1, key,
+                                        digest))) {
+            return &slot;
+        }
+    }
+}
+
+/**
+ * @brief Doubles the slots of a shard. The position of each id is taken
+ * from the hash bits kept in its slot, so no hash is read again.
+ */
+void Server::HashTable::grow(Shard& shard) {
+    std::vector<uint64_t> slots(shard.slots.size() * 2);
+    std::size_t mask = slots.size() - 1;
+    for (uint64_t slot : shard.slots) {
+        if (slot == 0) {
+            continue;
+        }
+        std::size_t i = (slot >> 32) & mask;
+        while (slots[i] != 0) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = slot;
+    }
+    shard.slots.swap(slots);
+}
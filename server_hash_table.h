@@ -0,0 +1,86 @@
+#ifndef SERVER_HASH_TABLE_H_
+#define SERVER_HASH_TABLE_H_
+
+#include <atomic>
+#include <cinttypes>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "server_shard.h"
+
+namespace Server {
+/** Compact identifier of a hash interned in a HashTable. */
+using HashId = uint32_t;
+
+/**
+ * @brief Interns the hashes of the indexes, so each one is stored once and
+ * the indexes refer to it by a HashId.
+ * SHA-256 digests in hex are stored as their 32 bytes, any other hash as a
+ * string. Hashes are never removed, so ids stay valid and `get` needs no
+ * lock. Interning and lookups take a mutex per shard (see `shard_of`) and
+ * may run concurrently with each other.
+ */
+class HashTable {
+   public:
+    HashTable();
+    ~HashTable();
+
+    HashTable(const HashTable& other) = delete;
+    HashTable& operator=(const HashTable& other) = delete;
+
+    /** api */
+    HashId intern(const std::string& hash);
+
+    /** query */
+    bool find(const std::string& hash, HashId& id);
+    std::string get(HashId id) const;
+    std::size_t size() const;
+
+   private:
+    /** A SHA-256 digest. */
+    struct Digest {
+        uint8_t bytes[32];
+    };
+
+    /**
+     * @brief Array that grows by chunks, so its elements never move and can
+     * be read while others are added.
+     */
+    template <class T>
+    class Chunks {
+       public:
+        Chunks();
+        ~Chunks();
+
+        uint32_t add(const T& value);
+        const T& operator[](uint32_t index) const;
+        uint32_t size() const;
+
+       private:
+        std::vector<std::atomic<T*>> chunks;
+        std::atomic<uint32_t> count{0};
+    };
+
+    /** Open addressing set of the ids of a shard. */
+    struct Shard {
+        /** Each slot holds an id and the high bits of its hash. */
+        std::vector<uint64_t> slots;
+        std::size_t size{0};
+        std::mutex mutex;
+    };
+
+    static bool parse(const std::string& hash, Digest& digest);
+    bool matches(HashId id, const std::string& hash,
+                 const Digest* digest) const;
+    uint64_t* probe(Shard& shard, std::size_t hash, const std::string& key,
+                    const Digest* digest) const;
+    static void grow(Shard& shard);
+
+    Chunks<Digest> digests;
+    Chunks<std::string> strings;
+    std::vector<Shard> shards;
+};
+}  // namespace Server
+
+#endif
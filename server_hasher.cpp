@@ -0,0 +1,132 @@
+#include "server_hasher.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "common_error.h"
+#include "common_sha256.h"
+
+/** size of the pieces read back from the file */
+#define HASH_CHUNK_SIZE ((uint64_t)1024 * 1024)
+
+/**
+ * @brief Starts hashing the given file as it is written.
+ *
+ * @param file_name File to hash. It may not exist yet.
+ */
+Server::FileHasher::FileHasher(const std::string& file_name)
+    : file_name(file_name) {
+    this->thread = std::thread(&FileHasher::run, this);
+}
+
+/**
+ * @brief Stops the hashing if it wasn't finished.
+ */
+Server::FileHasher::~FileHasher() {
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->cancelled = true;
+    }
+    this->cv.notify_one();
+    if (this->thread.joinable()) {
+        this->thread.join();
+    }
+}
+
+/**
+ * @brief Reports the bytes of the file written so far.
+ *
+ * @param written Bytes written from the beginning of the file.
+ */
+void Server::FileHasher::advance(uint64_t written) {
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->written = written;
+    }
+    this->cv.notify_one();
+}
+
+/**
+ * @brief Reports that the file is complete and waits for its hash.
+ *
+ * @return SHA-256 of the file, as lowercase hexadecimal.
+ */
+std::string Server::FileHasher::finish() {
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->done = true;
+    }
+    this->cv.notify_one();
+    this->thread.join();
+
+    if (!this->error.empty()) {
+        throw Error::Error{"%s", this->error.c_str()};
+    }
+    return this->digest;
+}
+
+/**
+ * @brief Hashing thread: hashes the written bytes until the file is
+ * complete or the hash is cancelled.
+ */
+void Server::FileHasher::run() {
+    int fd = -1;
+    uint64_t hashed = 0;
+    Digest::Sha256 sha;
+    std::vector<char> buffer;
+
+    while (true) {
+        uint64_t written;
+        bool done;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            while (!this->cancelled && !this->done &&
+                   this->written == hashed) {
+                this->cv.wait(lock);
+            }
+            if (this->cancelled) {
+                break;
+            }
+            written = this->written;
+            done = this->done;
+        }
+
+        /* the writer creates the file, so it is opened once there's data */
+        if (fd == -1 && written > hashed) {
+            fd = open(this->file_name.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1) {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->error = "open " + this->file_name + ": ";
+                this->error += strerror(errno);
+                break;
+            }
+            buffer.resize(HASH_CHUNK_SIZE);
+        }
+
+        while (hashed < written) {
+            uint64_t chunk = std::min(written - hashed, HASH_CHUNK_SIZE);
+            ssize_t bytes_read = pread(fd, buffer.data(), chunk, hashed);
+            if (bytes_read <= 0) {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->error = "Error leyendo " + this->file_name;
+                this->cancelled = true;
+                break;
+            }
+            sha.update(buffer.data(), bytes_read);
+            hashed += bytes_read;
+        }
+
+        if (done && hashed == written) {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->digest = sha.hex_digest();
+            break;
+        }
+    }
+
+    if (fd != -1) {
+        close(fd);
+    }
+}
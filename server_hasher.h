@@ -0,0 +1,51 @@
+#ifndef SERVER_HASHER_H_
+#define SERVER_HASHER_H_
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace Server {
+/**
+ * @brief Hashes a file while it is being written, in its own thread.
+ * The writer reports how many bytes it wrote so far and the hasher reads
+ * them back (from the page cache) behind it, so hashing overlaps with
+ * receiving the file instead of following it.
+ */
+class FileHasher {
+   public:
+    explicit FileHasher(const std::string& file_name);
+    ~FileHasher();
+
+    FileHasher(const FileHasher& other) = delete;
+    FileHasher& operator=(const FileHasher& other) = delete;
+
+    /** api */
+    void advance(uint64_t written);
+    std::string finish();
+
+   private:
+    void run();
+
+    /** Name of the file being hashed. */
+    std::string file_name;
+    /** Bytes of the file already written. */
+    uint64_t written{0};
+    /** Whether the file is complete. */
+    bool done{false};
+    /** Whether the hash is no longer needed. */
+    bool cancelled{false};
+    /** Result, or the error that stopped the hashing. */
+    std::string digest;
+    std::string error;
+    /** Protects the attributes above. */
+    std::mutex mutex;
+    /** Signals new data, completion or cancellation. */
+    std::condition_variable cv;
+    /** Hashing thread. */
+    std::thread thread;
+};
+}  // namespace Server
+
+#endif
@@ -1,20 +1,45 @@
 #include <iostream>
 #include "server.h"
+#include "server_config.h"
+#include "server_pool.h"
+#include "server_reactor.h"
 #include "server_versioner.h"
 
 int main(int argc, const char* argv[]) {
-    if (argc != 3) {
+    if (argc < 3) {
         std::cout << "parametros invalidos" << std::endl;
         return 0;
     }
 
     try {
-        Server::Versioner versioner{argv[2]};
-        Server::Server<Server::Versioner> server{argv[1]};
+        Server::Config config{argc, argv};
+        Server::Versioner versioner{config.index_file};
+        versioner.set_verify(config.verify);
+        versioner.set_compression(config.compression);
+        versioner.set_tag_timeout(config.tag_timeout);
+        if (config.checkpoint_interval > 0) {
+            versioner.set_checkpoint_interval(config.checkpoint_interval);
+        }
+        Server::Server<Server::Versioner> server{config.port};
 
         /* runs until accept is interrupted */
-        while (true) {
-            server.handle_client(versioner);
+        if (config.mode == Server::Mode::Epoll) {
+            Server::Reactor reactor{versioner, config.io_threads,
+                                    config.workers};
+            while (true) {
+                reactor.add(server.accept());
+            }
+        } else if (config.mode == Server::Mode::Pool) {
+            Server::Pool<Server::Versioner> pool{versioner, config.workers,
+                                                 config.queue_size,
+                                                 config.overflow};
+            while (true) {
+                pool.submit(server.accept());
+            }
+        } else {
+            while (true) {
+                server.handle_client(versioner);
+            }
         }
     } catch (const IO::Interrupted& e) {
         /* this exception means that the server must quit */
@@ -0,0 +1,133 @@
+#include "server_metrics.h"
+#include <atomic>
+#include <chrono>
+
+Server::Metrics::Metrics() {
+}
+
+Server::Metrics::~Metrics() {
+}
+
+/**
+ * @brief Records that a command was served.
+ *
+ * @param id Command id (ignored if it is not a valid one).
+ * @param start When the command was received.
+ */
+void Server::Metrics::record_command(
+    uint8_t id, std::chrono::steady_clock::time_point start) {
+    if (id >= NUM_COMMANDS) {
+        return;
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    this->latency[id].record(
+        std::chrono::duration_cast<std::chrono::microseconds>(elapsed)
+            .count());
+}
+
+/**
+ * @brief Records that a file was added to the store.
+ *
+ * @param size Size of the file.
+ */
+void Server::Metrics::add_blob(uint64_t size) {
+    this->blob_bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Gets the name of a command, as reported by `stats`.
+ *
+ * @param id Command id, below NUM_COMMANDS.
+ */
+const char* Server::Metrics::command_name(uint8_t id) {
+    static const char* const names[NUM_COMMANDS] = {
+        "hello",    "push",     "tag",        "pull",  "have", "manifest",
+        "fetch",    "compress", "signatures", "delta", "stats"};
+    return names[id];
+}
+
+/**
+ * @brief Time each command with the given id took, in us.
+ *
+ * @param id Command id, below NUM_COMMANDS.
+ */
+const Stats::Histogram& Server::Metrics::get_latency(uint8_t id) const {
+    return this->latency[id];
+}
+
+/**
+ * @brief Bytes received from the clients.
+ */
+uint64_t Server::Metrics::get_bytes_in() const {
+    return this->bytes_in.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Bytes sent to the clients.
+ */
+uint64_t Server::Metrics::get_bytes_out() const {
+    return this->bytes_out.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Connections being served.
+ */
+uint64_t Server::Metrics::get_connections() const {
+    return this->connections.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Size of the stored files.
+ */
+uint64_t Server::Metrics::get_blob_bytes() const {
+    return this->blob_bytes.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Gets the statistics of the pool of workers, for the Pool to record
+ * them.
+ */
+Server::PoolMetrics& Server::Metrics::get_pool() {
+    return this->pool;
+}
+
+/**
+ * @brief Gets the statistics of the pool of workers.
+ */
+const Server::PoolMetrics& Server::Metrics::get_pool() const {
+    return this->pool;
+}
+
+Server::Metrics::Connection::Connection(Metrics& metrics,
+                                        const IO::Socket& socket)
+    : metrics(metrics), socket(socket) {
+    this->metrics.connections.fetch_add(1, std::memory_order_relaxed);
+    /* the socket may have been used before being handed over */
+    this->bytes_in = socket.get_bytes_received();
+    this->bytes_out = socket.get_bytes_sent();
+}
+
+Server::Metrics::Connection::~Connection() {
+    this->update();
+    this->metrics.connections.fetch_sub(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Adds the bytes that went through the socket since the last call.
+ * The socket counters belong to the thread serving the connection, so the
+ * shared ones are only touched when something changed.
+ */
+void Server::Metrics::Connection::update() {
+    uint64_t received = this->socket.get_bytes_received();
+    uint64_t sent = this->socket.get_bytes_sent();
+    if (received != this->bytes_in) {
+        this->metrics.bytes_in.fetch_add(received - this->bytes_in,
+                                         std::memory_order_relaxed);
+        this->bytes_in = received;
+    }
+    if (sent != this->bytes_out) {
+        this->metrics.bytes_out.fetch_add(sent - this->bytes_out,
+                                          std::memory_order_relaxed);
+        this->bytes_out = sent;
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef SERVER_METRICS_H_
+#define SERVER_METRICS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstddef>
+#include "common_histogram.h"
+#include "common_socket.h"
+
+namespace Server {
+/**
+ * @brief Statistics of the Pool of workers, kept along with the Metrics so
+ * `stats` reports them. Only the pool mode has a pool: `workers` is 0 in
+ * the others.
+ */
+struct PoolMetrics {
+    std::atomic<unsigned> workers{0};
+    /** Clients waiting for a worker, and the most there have been. */
+    std::atomic<std::size_t> queued{0};
+    std::atomic<std::size_t> max_queued{0};
+    std::atomic<uint64_t> accepted{0};
+    std::atomic<uint64_t> rejected{0};
+    /** Time the clients waited for a worker, in us. */
+    Stats::Histogram queue_wait;
+};
+
+/**
+ * @brief Live counters of the server, sent to the clients that ask for them
+ * (the `stats` command). Every counter is a relaxed atomic (the histograms
+ * too), so the handlers record as they go without taking any lock.
+ */
+class Metrics {
+   public:
+    /** Command ids are below this. */
+    static const uint8_t NUM_COMMANDS = 11;
+
+    /**
+     * @brief Counts a connection while it is open, and the bytes that go
+     * through its socket. The bytes are added up when `update` is called
+     * and when the connection ends, so the socket must outlive it.
+     */
+    class Connection {
+       public:
+        Connection(Metrics& metrics, const IO::Socket& socket);
+        ~Connection();
+
+        Connection(const Connection& other) = delete;
+        Connection& operator=(const Connection& other) = delete;
+
+        void update();
+
+       private:
+        Metrics& metrics;
+        const IO::Socket& socket;
+        /** Bytes of the socket already added to the metrics. */
+        uint64_t bytes_in{0};
+        uint64_t bytes_out{0};
+    };
+
+    Metrics();
+    ~Metrics();
+
+    Metrics(const Metrics& other) = delete;
+    Metrics& operator=(const Metrics& other) = delete;
+
+    /** api */
+    void record_command(uint8_t id,
+                        std::chrono::steady_clock::time_point start);
+    void add_blob(uint64_t size);
+    PoolMetrics& get_pool();
+
+    /** query */
+    static const char* command_name(uint8_t id);
+    const Stats::Histogram& get_latency(uint8_t id) const;
+    uint64_t get_bytes_in() const;
+    uint64_t get_bytes_out() const;
+    uint64_t get_connections() const;
+    uint64_t get_blob_bytes() const;
+    const PoolMetrics& get_pool() const;
+
+   private:
+    /** Time each command takes, by id, in us. */
+    Stats::Histogram latency[NUM_COMMANDS];
+    /** Bytes received from and sent to the clients. */
+    std::atomic<uint64_t> bytes_in{0};
+    std::atomic<uint64_t> bytes_out{0};
+    /** Connections being served. */
+    std::atomic<uint64_t> connections{0};
+    /** Size of the stored files. */
+    std::atomic<uint64_t> blob_bytes{0};
+    /** Statistics of the pool, recorded by the Pool itself. */
+    PoolMetrics pool;
+};
+}  // namespace Server
+
+#endif
@@ -0,0 +1,266 @@
+#ifndef SERVER_POOL_H_
+#define SERVER_POOL_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "common_histogram.h"
+#include "common_socket.h"
+#include "server_metrics.h"
+
+namespace Server {
+/** What a full Pool does with a new client. */
+enum class Overflow {
+    /** Waits for room in the queue (the kernel keeps queueing connections). */
+    Block,
+    /** Turns the client away right away through `Functor::reject`. */
+    Reject
+};
+
+/**
+ * @brief Serves clients with a fixed set of worker threads that are reused
+ * across connections.
+ * Accepted clients wait in a bounded queue. Each worker owns a part of the
+ * queue and steals from the others when its own part is empty, so a worker
+ * busy with a long session doesn't delay the clients assigned to it.
+ * The functor must provide `operator()(IO::Socket&)` to serve a client,
+ * `reject(IO::Socket&)` to turn one away and `get_metrics()`, where the
+ * pool keeps its statistics (see PoolMetrics).
+ */
+template <typename Functor>
+class Pool {
+   public:
+    Pool(Functor& handler, unsigned num_workers, std::size_t capacity,
+         Overflow overflow)
+        : handler(handler),
+          capacity(capacity),
+          overflow(overflow),
+          stats(handler.get_metrics().get_pool()) {
+        if (num_workers == 0) {
+            num_workers = 1;
+        }
+        this->stats.workers = num_workers;
+        if (this->capacity == 0) {
+            this->capacity = 1;
+        }
+        for (unsigned i = 0; i < num_workers; i++) {
+            this->workers.emplace_back(new Worker{});
+        }
+        for (unsigned i = 0; i < num_workers; i++) {
+            this->workers[i]->thread = std::thread(&Pool::work, this, i);
+        }
+    }
+
+    /**
+     * @brief Serves the clients still queued and stops the workers.
+     */
+    ~Pool() {
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->work_cv.notify_all();
+        this->space_cv.notify_all();
+        for (auto& worker : this->workers) {
+            worker->thread.join();
+        }
+        this->report(std::cerr);
+    }
+
+    Pool(const Pool& other) = delete;
+    Pool& operator=(const Pool& other) = delete;
+
+    /** API */
+
+    /**
+     * @brief Queues a client to be served by the next free worker. If the
+     * queue is full, blocks or rejects the client depending on the overflow
+     * policy.
+     *
+     * @param client The new client's socket.
+     */
+    void submit(IO::Socket&& client) {
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            if (this->stats.queued >= this->capacity &&
+                this->overflow == Overflow::Block) {
+                while (this->stats.queued >= this->capacity &&
+                       !this->stopping) {
+                    this->space_cv.wait(lock);
+                }
+            }
+
+            if (this->stats.queued < this->capacity) {
+                Worker& worker = *this->workers[this->next];
+                this->next = (this->next + 1) % this->workers.size();
+                {
+                    /* counted along with the push, see `take` */
+                    std::unique_lock<std::mutex> wlock(worker.mutex);
+                    worker.queue.emplace_back(std::move(client));
+                    this->stats.queued += 1;
+                }
+                if (this->stats.queued > this->stats.max_queued) {
+                    this->stats.max_queued = this->stats.queued.load();
+                }
+                this->stats.accepted += 1;
+                lock.unlock();
+                this->work_cv.notify_one();
+                return;
+            }
+        }
+
+        /* the queue is full: sheds the load */
+        this->stats.rejected += 1;
+        this->handler.reject(client);
+    }
+
+    /**
+     * @brief Writes the queue statistics, useful to size the pool.
+     *
+     * @param out Output stream.
+     */
+    void report(std::ostream& out) const {
+        out << "pool: workers=" << this->workers.size()
+            << " capacity=" << this->capacity
+            << " queued=" << this->stats.queued
+            << " max_queued=" << this->stats.max_queued
+            << " accepted=" << this->stats.accepted
+            << " rejected=" << this->stats.rejected << std::endl;
+        this->stats.queue_wait.report(out, "pool queue wait", "us");
+    }
+
+    /** query */
+    std::size_t depth() const {
+        return this->stats.queued;
+    }
+    std::size_t max_depth() const {
+        return this->stats.max_queued;
+    }
+    uint64_t rejections() const {
+        return this->stats.rejected;
+    }
+    const Stats::Histogram& wait_times() const {
+        return this->stats.queue_wait;
+    }
+
+   private:
+    /** A queued client. */
+    struct Task {
+        explicit Task(IO::Socket&& client)
+            : client(std::move(client)),
+              queued_at(std::chrono::steady_clock::now()) {
+        }
+        Task(Task&& other) = default;
+
+        IO::Socket client;
+        std::chrono::steady_clock::time_point queued_at;
+    };
+
+    /** A worker thread and its part of the queue. */
+    struct Worker {
+        std::deque<Task> queue;
+        std::mutex mutex;
+        std::thread thread;
+    };
+
+    /** Custom handler. */
+    Functor& handler;
+    /** Maximum number of queued clients. */
+    std::size_t capacity;
+    /** What to do when the queue is full. */
+    Overflow overflow;
+    /** Workers. */
+    std::vector<std::unique_ptr<Worker>> workers;
+    /** Worker that receives the next client. */
+    std::size_t next{0};
+    /** Protects the counters and the wait conditions. */
+    std::mutex mutex;
+    /** Signals queued clients (or the end of the pool). */
+    std::condition_variable work_cv;
+    /** Signals room in the queue. */
+    std::condition_variable space_cv;
+    /** Whether the pool is being destroyed. */
+    bool stopping{false};
+
+    /** Statistics, reported by `stats` (`queued` also drives the queue). */
+    PoolMetrics& stats;
+
+    /**
+     * @brief Takes the next client for the given worker, first from its own
+     * queue and then from the back of the others'.
+     * The client stops counting as queued within the same critical section,
+     * so `queued` is never above the clients a worker can take: a worker
+     * that finds every queue empty with clients queued would spin instead
+     * of waiting.
+     *
+     * @param id Worker index.
+     * @param task Where the taken client is moved.
+     * @return false if every queue is empty.
+     */
+    bool take(std::size_t id, std::unique_ptr<Task>& task) {
+        for (std::size_t i = 0; i < this->workers.size(); i++) {
+            Worker& worker = *this->workers[(id + i) % this->workers.size()];
+            std::unique_lock<std::mutex> lock(worker.mutex);
+            if (worker.queue.empty()) {
+                continue;
+            }
+            if (i == 0) {
+                task.reset(new Task{std::move(worker.queue.front())});
+                worker.queue.pop_front();
+            } else {
+                task.reset(new Task{std::move(worker.queue.back())});
+                worker.queue.pop_back();
+            }
+            this->stats.queued -= 1;
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Worker thread body.
+     *
+     * @param id Worker index.
+     */
+    void work(std::size_t id) {
+        while (true) {
+            std::unique_ptr<Task> task;
+            if (!this->take(id, task)) {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                if (this->stats.queued == 0) {
+                    if (this->stopping) {
+                        return;
+                    }
+                    this->work_cv.wait(lock);
+                }
+                continue;
+            }
+
+            {
+                /* a submit that just saw the queue full is waiting by now */
+                std::unique_lock<std::mutex> lock(this->mutex);
+            }
+            this->space_cv.notify_one();
+
+            auto waited = std::chrono::steady_clock::now() - task->queued_at;
+            this->stats.queue_wait.record(
+                std::chrono::duration_cast<std::chrono::microseconds>(waited)
+                    .count());
+
+            try {
+                this->handler(task->client);
+            } catch (const std::exception& e) {
+                std::cerr << "Error: " << e.what() << std::endl;
+            }
+        }
+    }
+};
+}  // namespace Server
+
+#endif
@@ -0,0 +1,304 @@
+#include "server_reactor.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "common_error.h"
+
+/** maximum events handled per epoll_wait call */
+#define MAX_EVENTS 64
+/** time between retries of the sessions that wait, in ms */
+#define RETRY_INTERVAL 10
+
+Server::EventLoop::EventLoop(Server::Versioner& versioner,
+                             Server::WorkQueue& work)
+    : versioner(versioner), work(work) {
+    this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (this->epoll_fd == -1) {
+        throw Error::Error{"epoll_create1: %s", strerror(errno)};
+    }
+
+    this->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (this->wakeup_fd == -1) {
+        close(this->epoll_fd);
+        throw Error::Error{"eventfd: %s", strerror(errno)};
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = this->wakeup_fd;
+    if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, this->wakeup_fd, &event) ==
+        -1) {
+        close(this->wakeup_fd);
+        close(this->epoll_fd);
+        throw Error::Error{"epoll_ctl: %s", strerror(errno)};
+    }
+
+    this->thread = std::thread(&EventLoop::run, this);
+}
+
+Server::EventLoop::~EventLoop() {
+    this->stop();
+    this->thread.join();
+
+    /* sessions must be released before the descriptors they depend on */
+    this->sessions.clear();
+    close(this->wakeup_fd);
+    close(this->epoll_fd);
+}
+
+/**
+ * @brief Hands a new client over to the loop. May be called from any thread.
+ *
+ * @param client Connected client socket.
+ */
+void Server::EventLoop::add(IO::Socket&& client) {
+    {
+        std::unique_lock<std::mutex> lock(this->pending_mutex);
+        this->pending.push_back(std::move(client));
+    }
+
+    uint64_t one = 1;
+    if (::write(this->wakeup_fd, &one, sizeof(one)) != sizeof(one)) {
+        throw Error::Error{"eventfd write: %s", strerror(errno)};
+    }
+}
+
+/**
+ * @brief Asks the loop to finish. Sessions still open are dropped.
+ */
+void Server::EventLoop::stop() {
+    this->stopping = true;
+    this->wake();
+}
+
+/**
+ * @brief Wakes up the loop so it retries its waiting sessions. May be
+ * called from any thread.
+ */
+void Server::EventLoop::wake() {
+    uint64_t one = 1;
+    if (::write(this->wakeup_fd, &one, sizeof(one)) != sizeof(one)) {
+        /* nothing else can be done to wake it up */
+    }
+}
+
+/**
+ * @brief Number of sessions served by the loop.
+ */
+std::size_t Server::EventLoop::size() const {
+    return this->num_sessions;
+}
+
+/**
+ * @brief Whether the loop still serves clients (it stops if epoll fails).
+ */
+bool Server::EventLoop::is_running() const {
+    return !this->stopping;
+}
+
+/**
+ * @brief Loop thread: waits for events and dispatches them to the sessions.
+ * Errors of a client only drop its session. If epoll itself fails the loop
+ * can't go on: it stops and drops its sessions, while the other loops keep
+ * serving theirs.
+ */
+void Server::EventLoop::run() {
+    struct epoll_event events[MAX_EVENTS];
+
+    while (!this->stopping) {
+        int timeout = this->waiting.empty() ? -1 : RETRY_INTERVAL;
+        int n = epoll_wait(this->epoll_fd, events, MAX_EVENTS, timeout);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Error: epoll_wait: " << strerror(errno)
+                      << std::endl;
+            this->stopping = true;
+            this->waiting.clear();
+            this->sessions.clear();
+            this->num_sessions = 0;
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == this->wakeup_fd) {
+                this->accept_pending();
+                continue;
+            }
+
+            auto found = this->sessions.find(fd);
+            if (found == this->sessions.end()) {
+                continue;
+            }
+
+            Session& session = *found->second;
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                session.on_readable();
+            }
+            if (events[i].events & EPOLLOUT) {
+                session.on_writable();
+            }
+            this->update(session);
+        }
+        this->retry_waiting();
+    }
+}
+
+/**
+ * @brief Retries the sessions that wait for something other than their
+ * socket (see `Session::is_waiting`).
+ */
+void Server::EventLoop::retry_waiting() {
+    /* updating a session changes the set */
+    std::set<int> fds = this->waiting;
+    for (int fd : fds) {
+        auto found = this->sessions.find(fd);
+        if (found == this->sessions.end()) {
+            this->waiting.erase(fd);
+            continue;
+        }
+        found->second->on_retry();
+        this->update(*found->second);
+    }
+}
+
+/**
+ * @brief Registers the sockets handed over by `add`.
+ */
+void Server::EventLoop::accept_pending() {
+    uint64_t count;
+    if (::read(this->wakeup_fd, &count, sizeof(count)) != sizeof(count)) {
+        /* spurious wake up, the pending list tells the truth anyway */
+    }
+
+    std::vector<IO::Socket> clients;
+    {
+        std::unique_lock<std::mutex> lock(this->pending_mutex);
+        clients.swap(this->pending);
+    }
+
+    for (IO::Socket& client : clients) {
+        /* a client that can't be served is dropped (closing its socket) */
+        try {
+            std::unique_ptr<Session> session{
+                new Session{this->versioner, std::move(client), this->work,
+                            [this] { this->wake(); }}};
+            int fd = session->get_fd();
+
+            struct epoll_event event;
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN | EPOLLRDHUP;
+            event.data.fd = fd;
+            if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+                throw Error::Error{"epoll_ctl: %s", strerror(errno)};
+            }
+
+            this->sessions[fd] = std::move(session);
+            this->num_sessions += 1;
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+    }
+}
+
+/**
+ * @brief Updates the events a session is waiting for, releasing it if it
+ * finished.
+ *
+ * @param session Session whose status may have changed.
+ */
+void Server::EventLoop::update(Server::Session& session) {
+    int fd = session.get_fd();
+
+    uint32_t interest = 0;
+    if (session.wants_read()) {
+        interest |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (session.wants_write()) {
+        interest |= EPOLLOUT;
+    }
+
+    if (session.is_closed() || interest == 0) {
+        this->drop(fd);
+        return;
+    }
+
+    if (session.is_waiting()) {
+        this->waiting.insert(fd);
+    } else {
+        this->waiting.erase(fd);
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = interest;
+    event.data.fd = fd;
+    if (epoll_ctl(this->epoll_fd, EPOLL_CTL_MOD, fd, &event) == -1) {
+        std::cerr << "Error: epoll_ctl: " << strerror(errno) << std::endl;
+        this->drop(fd);
+    }
+}
+
+/**
+ * @brief Releases a session, which must not be used afterwards.
+ *
+ * @param fd File descriptor of the session.
+ */
+void Server::EventLoop::drop(int fd) {
+    epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    this->waiting.erase(fd);
+    this->sessions.erase(fd);
+    this->num_sessions -= 1;
+}
+
+/**
+ * @brief Starts the IO threads.
+ *
+ * @param versioner Versioner that executes the commands.
+ * @param num_threads Number of IO threads (at least 1).
+ * @param num_workers Number of worker threads (at least 1).
+ */
+Server::Reactor::Reactor(Server::Versioner& versioner, unsigned num_threads,
+                         unsigned num_workers)
+    : work(num_workers) {
+    if (num_threads == 0) {
+        num_threads = 1;
+    }
+    for (unsigned i = 0; i < num_threads; i++) {
+        this->loops.emplace_back(new EventLoop{versioner, this->work});
+    }
+}
+
+Server::Reactor::~Reactor() {
+    /* stops every loop first so they finish concurrently */
+    for (auto& loop : this->loops) {
+        loop->stop();
+    }
+}
+
+/**
+ * @brief Hands a client to one of the IO threads (round robin).
+ *
+ * @param client Connected client socket.
+ */
+void Server::Reactor::add(IO::Socket&& client) {
+    /* skips the loops that stopped, the client is dropped if all did */
+    for (std::size_t i = 0; i < this->loops.size(); i++) {
+        EventLoop& loop = *this->loops[this->next];
+        this->next = (this->next + 1) % this->loops.size();
+        if (loop.is_running()) {
+            loop.add(std::move(client));
+            return;
+        }
+    }
+    std::cerr << "Error: no hay event loops activos" << std::endl;
+}
@@ -0,0 +1,95 @@
+#ifndef SERVER_REACTOR_H_
+#define SERVER_REACTOR_H_
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+#include "common_socket.h"
+#include "server_session.h"
+#include "server_versioner.h"
+#include "server_work_queue.h"
+
+namespace Server {
+/**
+ * @brief Event loop that serves its sessions from a single thread using epoll.
+ * This class is meant for internal use of the Reactor.
+ */
+class EventLoop {
+   public:
+    EventLoop(Versioner& versioner, WorkQueue& work);
+    ~EventLoop();
+
+    EventLoop(const EventLoop& other) = delete;
+    EventLoop& operator=(const EventLoop& other) = delete;
+
+    /** api */
+    void add(IO::Socket&& client);
+    void stop();
+    void wake();
+    std::size_t size() const;
+    bool is_running() const;
+
+   private:
+    void run();
+    void accept_pending();
+    void update(Session& session);
+    void retry_waiting();
+    void drop(int fd);
+
+    /** Versioner shared by every session. */
+    Versioner& versioner;
+    /** Runs the work of the sessions that blocks. */
+    WorkQueue& work;
+    /** epoll instance. */
+    int epoll_fd{-1};
+    /** eventfd used to wake up the loop. */
+    int wakeup_fd{-1};
+    /** Sockets handed over by other threads, waiting to be registered. */
+    std::vector<IO::Socket> pending;
+    /** Protects `pending`. */
+    std::mutex pending_mutex;
+    /** Live sessions by file descriptor. Only touched by the loop thread. */
+    std::map<int, std::unique_ptr<Session>> sessions;
+    /** Sessions waiting for something other than their socket. */
+    std::set<int> waiting;
+    /** Number of live sessions. */
+    std::atomic<std::size_t> num_sessions{0};
+    /** Whether the loop must finish. */
+    std::atomic<bool> stopping{false};
+    /** Loop thread. */
+    std::thread thread;
+};
+
+/**
+ * @brief Serves clients with a fixed set of IO threads, each one running an
+ * epoll event loop over non blocking sockets. Unlike Server, the number of
+ * threads doesn't grow with the number of clients. The work that blocks
+ * (committing pushes and tags) runs on a separate set of worker threads.
+ */
+class Reactor {
+   public:
+    Reactor(Versioner& versioner, unsigned num_threads,
+            unsigned num_workers);
+    ~Reactor();
+
+    /** api */
+    void add(IO::Socket&& client);
+
+   private:
+    /** One event loop per IO thread. */
+    std::vector<std::unique_ptr<EventLoop>> loops;
+    /** Loop that receives the next client. */
+    std::size_t next{0};
+    /**
+     * Work handed over by the loops. Declared last so it is destroyed
+     * first, finishing its tasks while the loops they wake up still exist.
+     */
+    WorkQueue work;
+};
+}  // namespace Server
+
+#endif
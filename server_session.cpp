@@ -0,0 +1,627 @@
+#include "server_session.h"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include "common_delta.h"
+#include "common_error.h"
+
+/** size of the buffer used to read from the socket */
+#define READ_CHUNK_SIZE 65536
+/** output queued above this size stops the processing of new commands */
+#define MAX_PENDING_OUTPUT ((std::size_t)1024 * 1024)
+
+Server::Session::Session(Server::Versioner& versioner, IO::Socket&& client,
+                         WorkQueue& work, std::function<void()> wake)
+    : versioner(versioner),
+      work(work),
+      wake(std::move(wake)),
+      client(std::move(client)),
+      connection(versioner.get_metrics(), this->client) {
+    this->client.set_blocking(false);
+}
+
+Server::Session::~Session() {
+    this->close();
+}
+
+/**
+ * @brief Reads everything available in the socket and processes it.
+ */
+void Server::Session::on_readable() {
+    try {
+        char buffer[READ_CHUNK_SIZE];
+        while (!this->peer_closed && this->state != State::Closed) {
+            ssize_t bytes_read = this->client.try_read(buffer, sizeof(buffer));
+            if (bytes_read < 0) {
+                break;
+            }
+            if (bytes_read == 0) {
+                this->peer_closed = true;
+                break;
+            }
+            this->comm.feed(buffer, bytes_read);
+
+            /* processes as it goes so large bodies don't pile up in memory */
+            this->process();
+        }
+        this->process();
+        this->on_writable();
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        this->close();
+    }
+}
+
+/**
+ * @brief Sends as much queued output as possible.
+ */
+void Server::Session::on_writable() {
+    if (this->state == State::Closed) {
+        return;
+    }
+
+    try {
+        bool flushed = this->comm.flush(this->client);
+
+        /* the queue may have been blocking new commands */
+        if (flushed) {
+            this->process();
+            this->comm.flush(this->client);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        this->close();
+        return;
+    }
+    this->connection.update();
+
+    /* a client that is gone and has nothing left to receive is done */
+    if (this->peer_closed && this->comm.pending() == 0) {
+        this->close();
+    }
+}
+
+/**
+ * @brief Whether the session is interested in reading from the socket.
+ */
+bool Server::Session::wants_read() const {
+    /* stops reading from clients that don't read their responses */
+    return this->state != State::Closed && !this->peer_closed &&
+           this->comm.pending() <= MAX_PENDING_OUTPUT;
+}
+
+/**
+ * @brief Whether the session has queued output waiting for the socket.
+ */
+bool Server::Session::wants_write() const {
+    return this->state != State::Closed && this->comm.pending() > 0;
+}
+
+/**
+ * @brief Whether the session finished and may be released.
+ */
+bool Server::Session::is_closed() const {
+    return this->state == State::Closed;
+}
+
+/**
+ * @brief Whether the session waits for something other than its socket (a
+ * tag waiting for uploads, or work handed to the WorkQueue), so it must be
+ * retried now and then.
+ */
+bool Server::Session::is_waiting() const {
+    return this->state == State::TagWait || this->state == State::Working;
+}
+
+/**
+ * @brief Retries what the session waits for (see `is_waiting`), and sends
+ * the output it produced.
+ */
+void Server::Session::on_retry() {
+    try {
+        this->process();
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        this->close();
+        return;
+    }
+    this->on_writable();
+}
+
+/**
+ * @brief File descriptor of the client socket.
+ */
+int Server::Session::get_fd() const {
+    return this->client.get_fd();
+}
+
+/**
+ * @brief Runs the state machine until it needs more input.
+ */
+void Server::Session::process() {
+    bool progress = true;
+    while (progress) {
+        switch (this->state) {
+            case State::Command:
+                progress = this->process_command();
+                break;
+            case State::PushSize:
+                progress = this->process_push_size();
+                break;
+            case State::PushChunkSize:
+                progress = this->process_push_chunk_size();
+                break;
+            case State::PushBody:
+                progress = this->process_push_body();
+                break;
+            case State::DeltaOp:
+                progress = this->process_delta_op();
+                break;
+            case State::DeltaLiteral:
+                progress = this->process_delta_literal();
+                break;
+            case State::TagWait:
+                progress = this->process_tag_wait();
+                break;
+            case State::Working:
+                progress = this->process_working();
+                break;
+            case State::Closed:
+                progress = false;
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Decodes and executes a command, if it is fully buffered.
+ *
+ * @return false if more input is required.
+ */
+bool Server::Session::process_command() {
+    /* applies backpressure to clients that don't read their responses */
+    if (this->comm.pending() > MAX_PENDING_OUTPUT) {
+        return false;
+    }
+    if (this->comm.available() == 0) {
+        return false;
+    }
+
+    uint8_t cmd_id;
+    try {
+        this->comm >> cmd_id;
+        this->command_start = std::chrono::steady_clock::now();
+
+        switch (cmd_id) {
+            case 0:
+                this->versioner.hello(this->comm);
+                break;
+            case 1: {
+                std::string file_name, hash;
+                this->comm >> file_name >> hash;
+                this->comm.commit();
+
+                if (!this->versioner.push_begin(file_name, hash)) {
+                    this->comm << IO::Response::Error;
+                    this->versioner.get_metrics().record_command(
+                        cmd_id, this->command_start);
+                    return true;
+                }
+                this->comm << IO::Response::OK;
+
+                this->push_file_name = file_name;
+                this->push_hash = hash;
+                this->state = State::PushSize;
+                return true;
+            }
+            case 2: {
+                uint32_t num_hashes;
+                this->comm >> num_hashes >> this->tag_name;
+                this->tag_hashes.clear();
+                for (uint32_t i = 0; i < num_hashes; i++) {
+                    std::string hash;
+                    this->comm >> hash;
+                    this->tag_hashes.insert(hash);
+                }
+                this->comm.commit();
+                this->tag_tried = false;
+                this->tag_deadline = this->command_start +
+                                     this->versioner.get_tag_timeout();
+                this->state = State::TagWait;
+                return true;
+            }
+            case 3:
+                this->versioner.pull(this->comm);
+                break;
+            case 4:
+                this->versioner.have(this->comm);
+                break;
+            case 5:
+                this->versioner.manifest(this->comm);
+                break;
+            case 6:
+                this->versioner.fetch(this->comm);
+                break;
+            case 7:
+                this->versioner.compress(this->comm);
+                break;
+            case 8: {
+                std::string file_name;
+                this->comm >> file_name;
+                this->comm.commit();
+                this->find_signatures(file_name);
+                return true;
+            }
+            case 10:
+                this->versioner.stats(this->comm);
+                break;
+            case 9: {
+                std::string file_name, hash, basis;
+                uint32_t block_size;
+                this->comm >> file_name >> hash >> basis >> block_size;
+                this->comm.commit();
+
+                this->delta_writer = this->versioner.delta_begin(
+                    file_name, hash, basis, block_size);
+                if (!this->delta_writer) {
+                    this->comm << IO::Response::Error;
+                    this->versioner.get_metrics().record_command(
+                        cmd_id, this->command_start);
+                    return true;
+                }
+                this->comm << IO::Response::OK;
+                this->push_file_name = file_name;
+                this->push_hash = hash;
+                this->push_hasher = this->versioner.push_hasher(hash);
+                this->state = State::DeltaOp;
+                return true;
+            }
+            default:
+                std::cerr << "Invalid ID " << cmd_id << std::endl;
+                this->close();
+                return false;
+        }
+    } catch (const IO::NeedMore& e) {
+        /* decodes the whole command again once more data arrives */
+        this->comm.rewind();
+        return false;
+    }
+
+    this->comm.commit();
+    this->versioner.get_metrics().record_command(cmd_id, this->command_start);
+    return true;
+}
+
+/**
+ * @brief Decodes the size of the pushed file.
+ *
+ * @return false if more input is required.
+ */
+bool Server::Session::process_push_size() {
+    try {
+        this->push_remaining = this->comm.read_file_size();
+    } catch (const IO::NeedMore& e) {
+        this->comm.rewind();
+        return false;
+    }
+    this->comm.commit();
+
+    this->push_file.open(this->versioner.staging_file(this->push_hash),
+                         std::ios::binary);
+    this->push_written = 0;
+    this->push_hasher = this->versioner.push_hasher(this->push_hash);
+    if (this->comm.get_codec() != IO::Codec::None) {
+        this->push_inflater.reset(new IO::Inflater{});
+    }
+    this->push_chunked = this->push_remaining == IO::CHUNKED_SIZE;
+    this->state = this->push_chunked ? State::PushChunkSize : State::PushBody;
+    return true;
+}
+
+/**
+ * @brief Decodes the size of the next chunk of a file pushed in chunks.
+ *
+ * @return false if more input is required.
+ */
+bool Server::Session::process_push_chunk_size() {
+    try {
+        this->push_remaining = this->comm.read_chunk_size();
+    } catch (const IO::NeedMore& e) {
+        this->comm.rewind();
+        return false;
+    }
+    this->comm.commit();
+
+    /* an empty chunk ends the file */
+    if (this->push_remaining == 0) {
+        this->push_chunked = false;
+    }
+    this->state = State::PushBody;
+    return true;
+}
+
+/**
+ * @brief Writes the buffered part of the pushed file to disk.
+ *
+ * @return false if more input is required.
+ */
+bool Server::Session::process_push_body() {
+    std::size_t chunk = std::min<std::size_t>(this->push_remaining,
+                                              this->comm.available());
+    std::size_t written = chunk;
+    if (this->push_inflater) {
+        std::string decompressed;
+        this->push_inflater->decompress(this->comm.peek(), chunk,
+                                        decompressed);
+        this->push_file.write(decompressed.data(), decompressed.size());
+        written = decompressed.size();
+    } else {
+        this->push_file.write(this->comm.peek(), chunk);
+    }
+    this->comm.skip(chunk);
+    this->push_remaining -= chunk;
+    this->push_written += written;
+    if (this->push_hasher && written > 0) {
+        /* the hasher reads back what reached the file */
+        this->push_file.flush();
+        this->push_hasher->advance(this->push_written);
+    }
+
+    if (this->push_remaining > 0) {
+        return false;
+    }
+    if (this->push_chunked) {
+        this->state = State::PushChunkSize;
+        return true;
+    }
+
+    if (this->push_inflater && !this->push_inflater->finished()) {
+        throw Error::Error{"Archivo comprimido incompleto"};
+    }
+    this->push_inflater.reset();
+
+    this->push_file.close();
+    if (!this->push_file) {
+        throw Error::Error{"Error escribiendo %s", this->push_hash.c_str()};
+    }
+
+    this->commit_push(1);
+    return true;
+}
+
+/**
+ * @brief Decodes and applies the next instruction of a delta push.
+ *
+ * @return false if more input is required.
+ */
+bool Server::Session::process_delta_op() {
+    uint8_t op;
+    uint32_t first_block = 0, num_blocks = 0, size = 0;
+    try {
+        this->comm >> op;
+        if (op == static_cast<uint8_t>(Delta::Op::Copy)) {
+            this->comm >> first_block >> num_blocks;
+        } else if (op == static_cast<uint8_t>(Delta::Op::Literal)) {
+            this->comm >> size;
+        }
+    } catch (const IO::NeedMore& e) {
+        this->comm.rewind();
+        return false;
+    }
+    this->comm.commit();
+
+    switch (static_cast<Delta::Op>(op)) {
+        case Delta::Op::Copy:
+            this->delta_writer->copy(first_block, num_blocks);
+            break;
+        case Delta::Op::Literal:
+            this->push_remaining = size;
+            this->state = State::DeltaLiteral;
+            return true;
+        case Delta::Op::End:
+            this->delta_writer->close();
+            this->delta_writer.reset();
+            this->commit_push(9);
+            return true;
+        default:
+            throw Error::Error{"Instruccion de delta invalida"};
+    }
+
+    if (this->push_hasher) {
+        this->push_hasher->advance(this->delta_writer->get_written());
+    }
+    return true;
+}
+
+/**
+ * @brief Writes the buffered part of a literal of a delta push.
+ *
+ * @return false if more input is required.
+ */
+bool Server::Session::process_delta_literal() {
+    std::size_t chunk = std::min<std::size_t>(this->push_remaining,
+                                              this->comm.available());
+    this->delta_writer->literal(this->comm.peek(), chunk);
+    this->comm.skip(chunk);
+    this->push_remaining -= chunk;
+    if (this->push_hasher && chunk > 0) {
+        this->push_hasher->advance(this->delta_writer->get_written());
+    }
+
+    if (this->push_remaining > 0) {
+        return false;
+    }
+    this->state = State::DeltaOp;
+    return true;
+}
+
+/**
+ * @brief Hands a completely received push to the WorkQueue, which commits
+ * it (see `Versioner::push_commit`). The push is over even if the commit
+ * fails.
+ *
+ * @param cmd_id Command of the push (a regular one or a delta).
+ */
+void Server::Session::commit_push(uint8_t cmd_id) {
+    std::shared_ptr<Job> job{new Job};
+    std::shared_ptr<FileHasher> hasher{std::move(this->push_hasher)};
+    Versioner& versioner = this->versioner;
+    std::string file_name = this->push_file_name;
+    std::string hash = this->push_hash;
+    std::function<void()> wake = this->wake;
+    this->work.submit([&versioner, file_name, hash, hasher, job, wake] {
+        try {
+            job->succeeded =
+                versioner.push_commit(file_name, hash, hasher.get());
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+        job->done = true;
+        wake();
+    });
+
+    this->job = job;
+    this->job_command = cmd_id;
+    this->state = State::Working;
+    this->push_file_name.clear();
+    this->push_hash.clear();
+}
+
+/**
+ * @brief Hands a `signatures` command to the WorkQueue, which computes them
+ * (see `Versioner::find_signatures`) reading the whole basis file.
+ *
+ * @param file_name Name of the file.
+ */
+void Server::Session::find_signatures(const std::string& file_name) {
+    std::shared_ptr<Job> job{new Job};
+    Versioner& versioner = this->versioner;
+    std::function<void()> wake = this->wake;
+    this->work.submit([&versioner, file_name, job, wake] {
+        try {
+            job->succeeded =
+                versioner.find_signatures(file_name, job->signatures);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+        job->done = true;
+        wake();
+    });
+
+    this->job = job;
+    this->job_command = 8;
+    this->state = State::Working;
+}
+
+/**
+ * @brief Hands the decoded tag to the WorkQueue, which adds it unless it
+ * must wait for uploads in progress. It is only tried again once some
+ * upload finished, without blocking the other sessions (one of them may
+ * be the upload), and rejected if they don't finish in time.
+ *
+ * @return false if the tag must wait.
+ */
+bool Server::Session::process_tag_wait() {
+    if (this->tag_tried &&
+        std::chrono::steady_clock::now() >= this->tag_deadline) {
+        this->comm << IO::Response::Error;
+        this->versioner.get_metrics().record_command(2, this->command_start);
+        this->tag_name.clear();
+        this->tag_hashes.clear();
+        this->state = State::Command;
+        return true;
+    }
+
+    uint64_t generation = this->versioner.get_staging_generation();
+    if (this->tag_tried && generation == this->tag_generation) {
+        return false;
+    }
+    this->tag_tried = true;
+    this->tag_generation = generation;
+
+    std::shared_ptr<Job> job{new Job};
+    Versioner& versioner = this->versioner;
+    std::string name = this->tag_name;
+    std::set<std::string> hashes = this->tag_hashes;
+    std::function<void()> wake = this->wake;
+    this->work.submit([&versioner, name, hashes, job, wake] {
+        try {
+            Versioner::TagResult result = versioner.add_tag(name, hashes);
+            job->succeeded = result == Versioner::TagResult::Added;
+            job->waiting = result == Versioner::TagResult::Waiting;
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+        job->done = true;
+        wake();
+    });
+
+    this->job = job;
+    this->job_command = 2;
+    this->state = State::Working;
+    return true;
+}
+
+/**
+ * @brief Finishes the command whose work was handed to the WorkQueue, once
+ * it is done.
+ *
+ * @return false if the work is still in progress.
+ */
+bool Server::Session::process_working() {
+    if (!this->job->done) {
+        return false;
+    }
+    std::shared_ptr<Job> job = std::move(this->job);
+    this->state = State::Command;
+
+    if (this->job_command == 2) {
+        if (job->waiting) {
+            this->state = State::TagWait;
+            return true;
+        }
+        this->comm << (job->succeeded ? IO::Response::OK
+                                      : IO::Response::Error);
+        this->tag_name.clear();
+        this->tag_hashes.clear();
+    } else if (this->job_command == 8) {
+        if (job->succeeded) {
+            Versioner::send_signatures(this->comm, job->signatures);
+        } else {
+            this->comm << IO::Response::Error;
+        }
+    } else if (this->comm.get_version() >= 9) {
+        /* final response of the push (see `Versioner::push`) */
+        this->comm << (job->succeeded ? IO::Response::OK
+                                      : IO::Response::Error);
+    }
+    /* the time includes receiving the file or waiting for the work */
+    this->versioner.get_metrics().record_command(this->job_command,
+                                                 this->command_start);
+    return true;
+}
+
+/**
+ * @brief Finishes the session, undoing any push left halfway.
+ */
+void Server::Session::close() {
+    if (this->state == State::Closed) {
+        return;
+    }
+    if (this->state == State::PushSize ||
+        this->state == State::PushChunkSize ||
+        this->state == State::PushBody || this->state == State::DeltaOp ||
+        this->state == State::DeltaLiteral) {
+        this->push_file.close();
+        this->push_hasher.reset();
+        this->push_inflater.reset();
+        this->delta_writer.reset();
+        this->versioner.push_abort(this->push_file_name, this->push_hash);
+    }
+    this->state = State::Closed;
+}
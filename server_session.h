@@ -0,0 +1,136 @@
+#ifndef SERVER_SESSION_H_
+#define SERVER_SESSION_H_
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include "common_codec.h"
+#include "common_comm_buffer.h"
+#include "common_socket.h"
+#include "server_delta.h"
+#include "server_hasher.h"
+#include "server_metrics.h"
+#include "server_versioner.h"
+#include "server_work_queue.h"
+
+namespace Server {
+/**
+ * @brief State machine that runs the Versioner protocol over a non blocking
+ * socket. It never blocks: it is fed whenever the socket is readable or
+ * writable and processes as many commands as the buffered input allows.
+ * Several commands may be sent through the same connection.
+ * The work that blocks (committing a push, adding a tag, computing the
+ * signatures of a file) is handed to a WorkQueue, and the session waits
+ * for it without reading new commands.
+ */
+class Session {
+   public:
+    Session(Versioner& versioner, IO::Socket&& client, WorkQueue& work,
+            std::function<void()> wake);
+    ~Session();
+
+    Session(const Session& other) = delete;
+    Session& operator=(const Session& other) = delete;
+
+    /** events */
+    void on_readable();
+    void on_writable();
+    void on_retry();
+
+    /** status */
+    bool wants_read() const;
+    bool wants_write() const;
+    bool is_closed() const;
+    bool is_waiting() const;
+    int get_fd() const;
+
+   private:
+    /** Protocol states. */
+    enum class State {
+        Command,
+        PushSize,
+        PushChunkSize,
+        PushBody,
+        DeltaOp,
+        DeltaLiteral,
+        TagWait,
+        Working,
+        Closed
+    };
+
+    /** Outcome of the work handed to the WorkQueue, once `done`. */
+    struct Job {
+        std::atomic<bool> done{false};
+        /** Whether the push was committed, or the tag added. */
+        bool succeeded{false};
+        /** Whether the tag must wait for uploads in progress. */
+        bool waiting{false};
+        /** Signatures found (when `succeeded`). */
+        Versioner::Signatures signatures;
+    };
+
+    void process();
+    bool process_command();
+    bool process_push_size();
+    bool process_push_chunk_size();
+    bool process_push_body();
+    bool process_delta_op();
+    bool process_delta_literal();
+    bool process_tag_wait();
+    bool process_working();
+    void commit_push(uint8_t cmd_id);
+    void find_signatures(const std::string& file_name);
+    void close();
+
+    /** Versioner that executes the commands. */
+    Versioner& versioner;
+    /** Runs the work that blocks. */
+    WorkQueue& work;
+    /** Wakes up the loop of the session, from any thread. */
+    std::function<void()> wake;
+    /** Client socket (non blocking). */
+    IO::Socket client;
+    /** Counts the connection and its traffic. */
+    Metrics::Connection connection;
+    /** Input and output buffers. */
+    IO::CommBuffer comm;
+    /** Current state. */
+    State state{State::Command};
+    /** When the command being served was received. */
+    std::chrono::steady_clock::time_point command_start;
+    /** Whether the client closed its side of the connection. */
+    bool peer_closed{false};
+
+    /** push in progress */
+    std::string push_file_name;
+    std::string push_hash;
+    std::ofstream push_file;
+    uint64_t push_remaining{0};
+    uint64_t push_written{0};
+    bool push_chunked{false};
+    std::unique_ptr<FileHasher> push_hasher;
+    std::unique_ptr<IO::Inflater> push_inflater;
+    /** rebuilds a file pushed as a delta */
+    std::unique_ptr<DeltaWriter> delta_writer;
+
+    /** tag waiting for uploads in progress */
+    std::string tag_name;
+    std::set<std::string> tag_hashes;
+    /** Whether it was tried, and `staging_generation` before that. */
+    bool tag_tried{false};
+    uint64_t tag_generation{0};
+    /** When the tag is rejected if it still waits. */
+    std::chrono::steady_clock::time_point tag_deadline;
+
+    /** work in progress, shared with the task that does it */
+    std::shared_ptr<Job> job;
+    /** Command the work belongs to. */
+    uint8_t job_command{0};
+};
+}  // namespace Server
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef SERVER_SHARD_H_
+#define SERVER_SHARD_H_
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+namespace Server {
+/** Number of shards the indexes are split into, each behind its own lock. */
+const std::size_t NUM_SHARDS = 64;
+
+/**
+ * @brief Gets the shard of a key (a hash, a file name or a tag name).
+ *
+ * @param key Key.
+ * @return Shard, in [0, NUM_SHARDS).
+ */
+inline std::size_t shard_of(const std::string& key) {
+    return std::hash<std::string>{}(key) % NUM_SHARDS;
+}
+}  // namespace Server
+
+#endif
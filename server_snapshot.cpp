@@ -0,0 +1,629 @@
+#include "server_snapshot.h"
+#include <endian.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include "common_error.h"
+
+/** first bytes of a binary snapshot */
+#define SNAPSHOT_MAGIC "VRSNSNAP"
+#define SNAPSHOT_MAGIC_SIZE 8
+/** version of the binary format, bumped on incompatible changes */
+#define SNAPSHOT_VERSION 1
+/** index that refers to nothing (a hash without a file, a file without
+ * versions) */
+#define SNAPSHOT_NONE UINT64_MAX
+
+/*
+ * Binary format (integers are little endian, sections are aligned to 8):
+ *
+ *  magic[8] version:u64
+ *  names:u64 hashes:u64 tags:u64 members:u64
+ *  file names   string table, sorted
+ *  hashes       string table, sorted (the files' and the tags' ones)
+ *  file_of      u64[hashes]  file name of each hash
+ *  latest       u64[names]   latest hash of each file name
+ *  tag names    string table, sorted
+ *  first_member u64[tags + 1]
+ *  members      u64[members] hashes of each tag, sorted
+ *
+ * A string table is u64[count + 1] offsets into the bytes that follow.
+ */
+
+namespace {
+/**
+ * @brief Maps a whole file into memory, read-only.
+ */
+class Mapping {
+   public:
+    explicit Mapping(const std::string& file_name) {
+        int fd = open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            throw Error::Error{"open %s: %s", file_name.c_str(),
+                               strerror(errno)};
+        }
+        struct stat info;
+        if (fstat(fd, &info) == -1) {
+            int error = errno;
+            close(fd);
+            throw Error::Error{"fstat %s: %s", file_name.c_str(),
+                               strerror(error)};
+        }
+        this->size = info.st_size;
+        if (this->size > 0) {
+            this->data = mmap(nullptr, this->size, PROT_READ, MAP_PRIVATE, fd,
+                              0);
+        }
+        int error = errno;
+        close(fd);
+        if (this->data == MAP_FAILED) {
+            throw Error::Error{"mmap %s: %s", file_name.c_str(),
+                               strerror(error)};
+        }
+        madvise(this->data, this->size, MADV_SEQUENTIAL);
+    }
+
+    ~Mapping() {
+        if (this->data != MAP_FAILED) {
+            munmap(this->data, this->size);
+        }
+    }
+
+    Mapping(const Mapping& other) = delete;
+    Mapping& operator=(const Mapping& other) = delete;
+
+    void* data{MAP_FAILED};
+    std::size_t size{0};
+};
+
+/**
+ * @brief Reads the sections of a mapped snapshot, checking that they lie
+ * within it.
+ */
+class Reader {
+   public:
+    Reader(const void* data, std::size_t size)
+        : data(static_cast<const char*>(data)), size(size) {
+    }
+
+    const char* bytes(uint64_t count) {
+        if (count > this->size - this->position) {
+            throw Error::Error{"Snapshot truncado"};
+        }
+        const char* start = this->data + this->position;
+        this->position += count;
+        /* keeps the next section aligned */
+        this->position = std::min<uint64_t>(this->size,
+                                            (this->position + 7) & ~7ULL);
+        return start;
+    }
+
+    uint64_t u64() {
+        return load_u64(this->bytes(sizeof(uint64_t)));
+    }
+
+    const char* array(uint64_t count) {
+        if (count > this->size / sizeof(uint64_t)) {
+            throw Error::Error{"Snapshot truncado"};
+        }
+        return this->bytes(count * sizeof(uint64_t));
+    }
+
+    static uint64_t load_u64(const char* at) {
+        uint64_t value;
+        memcpy(&value, at, sizeof(value));
+        return le64toh(value);
+    }
+
+    static uint64_t load_u64(const char* array, uint64_t index) {
+        return load_u64(array + index * sizeof(uint64_t));
+    }
+
+   private:
+    const char* data;
+    std::size_t size;
+    std::size_t position{0};
+};
+
+/**
+ * @brief Sorted table of strings of a mapped snapshot.
+ */
+class StringTable {
+   public:
+    StringTable(Reader& reader, uint64_t count) : count(count) {
+        this->offsets = reader.array(count + 1);
+        /* checks the offsets once, so the lookups need not */
+        uint64_t previous = 0;
+        for (uint64_t i = 0; i <= count; i++) {
+            uint64_t offset = Reader::load_u64(this->offsets, i);
+            if (offset < previous) {
+                throw Error::Error{"Snapshot corrupto"};
+            }
+            previous = offset;
+        }
+        this->strings = reader.bytes(previous);
+    }
+
+    std::string at(uint64_t index) const {
+        if (index >= this->count) {
+            throw Error::Error{"Snapshot corrupto"};
+        }
+        uint64_t begin = Reader::load_u64(this->offsets, index);
+        uint64_t end = Reader::load_u64(this->offsets, index + 1);
+        return std::string{this->strings + begin, end - begin};
+    }
+
+    /**
+     * @brief Gets a string, checking that the table is sorted (which the
+     * linear load relies on).
+     */
+    std::string next(uint64_t index, const std::string& previous) const {
+        std::string value = this->at(index);
+        if (index > 0 && !(previous < value)) {
+            throw Error::Error{"Snapshot desordenado"};
+        }
+        return value;
+    }
+
+    uint64_t count;
+
+   private:
+    const char* offsets;
+    const char* strings;
+};
+
+/**
+ * @brief Buffers the sections of a snapshot being written.
+ */
+class Writer {
+   public:
+    explicit Writer(std::ostream& output) : output(output) {
+    }
+
+    void bytes(const void* data, std::size_t count) {
+        this->output.write(static_cast<const char*>(data), count);
+        this->written += count;
+    }
+
+    void u64(uint64_t value) {
+        value = htole64(value);
+        this->bytes(&value, sizeof(value));
+    }
+
+    void align() {
+        static const char zeros[8] = {0};
+        this->bytes(zeros, (8 - this->written % 8) % 8);
+    }
+
+    void strings(const std::vector<const std::string*>& table) {
+        uint64_t offset = 0;
+        this->u64(offset);
+        for (const std::string* value : table) {
+            offset += value->size();
+            this->u64(offset);
+        }
+        for (const std::string* value : table) {
+            this->bytes(value->data(), value->size());
+        }
+        this->align();
+    }
+
+   private:
+    std::ostream& output;
+    uint64_t written{0};
+};
+
+bool less(const std::string* a, const std::string* b) {
+    return *a < *b;
+}
+
+/**
+ * @brief Finds the position of a string in a sorted table.
+ */
+uint64_t find(const std::vector<const std::string*>& table,
+              const std::string& value) {
+    auto it = std::lower_bound(table.begin(), table.end(), &value, less);
+    return it - table.begin();
+}
+}  // namespace
+
+/**
+ * @brief Tells the format of an index file by its first bytes.
+ *
+ * @param file_name Name of the index file.
+ * @return Format (text if the file doesn't exist).
+ */
+Server::Snapshot::Format Server::Snapshot::detect(
+    const std::string& file_name) {
+    std::ifstream file{file_name, std::ios::binary};
+    char magic[SNAPSHOT_MAGIC_SIZE];
+    if (file.read(magic, sizeof(magic)) &&
+        memcmp(magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE) == 0) {
+        return Format::Binary;
+    }
+    return Format::Text;
+}
+
+/**
+ * @brief Loads an index file of either format. A missing file is an empty
+ * index.
+ *
+ * @param file_name Name of the index file.
+ * @param files Index to add the files to.
+ * @param tags Index to add the tags to.
+ */
+void Server::Snapshot::load(const std::string& file_name, FileIndex& files,
+                            TagIndex& tags) {
+    if (detect(file_name) == Format::Binary) {
+        read_binary(file_name, files, tags);
+    } else {
+        std::ifstream file{file_name};
+        read_text(file, files, tags, false);
+    }
+}
+
+/**
+ * @brief Writes an index file.
+ *
+ * @param file_name Name of the index file.
+ * @param format Format to write.
+ * @param files Files to write.
+ * @param tags Tags to write.
+ */
+void Server::Snapshot::save(const std::string& file_name, Format format,
+                            const FileIndex& files, const TagIndex& tags) {
+    std::ofstream file{file_name, std::ios::binary};
+    if (format == Format::Binary) {
+        write_binary(file, files, tags);
+    } else {
+        write_text(file, files, tags);
+    }
+    file.close();
+    if (!file) {
+        throw Error::Error{"Error escribiendo %s", file_name.c_str()};
+    }
+}
+
+/**
+ * @brief Reads index records (as written by `write_text`).
+ *
+ * @param input Records.
+ * @param files Index to add the files to.
+ * @param tags Index to add the tags to.
+ * @param replaying Whether the records come from the log. A record may be
+ * both in the snapshot and in the log (if the server stopped after writing
+ * the snapshot but before emptying the log), so existing entries are
+ * skipped instead of rejected.
+ */
+void Server::Snapshot::read_text(std::istream& input, FileIndex& files,
+                                 TagIndex& tags, bool replaying) {
+    while (input) {
+        std::string type, name, hash;
+
+        input >> type >> name;
+
+        if (!input) {
+            break;
+        }
+        try {
+            if (type == "f") {
+                while (input && (input >> hash, hash != ";")) {
+                    files.insert_file(name, hash);
+                }
+            } else if (type == "t") {
+                std::set<std::string> hashes;
+                while (input && (input >> hash, hash != ";")) {
+                    hashes.insert(hash);
+                }
+                tags.add(name, hashes);
+            } else {
+                throw Error::Error{"Unexpected type %s", type.c_str()};
+            }
+        } catch (const Error::Exists& e) {
+            if (!replaying) {
+                throw;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Writes the index as text records, one per file and per tag.
+ *
+ * @param output Stream to write to.
+ * @param files Files to write.
+ * @param tags Tags to write.
+ */
+void Server::Snapshot::write_text(std::ostream& output, const FileIndex& files,
+                                  const TagIndex& tags) {
+    /* writes the files */
+    for (const Entry* file : sorted_files(files)) {
+        output << "f " << file->first << " ";
+        if (file->second.empty()) {
+            output << ";\n";
+            continue;
+        }
+
+        /* the latest version goes last, so it is the latest once loaded */
+        HashId latest =
+            files.shards[shard_of(file->first)].latest.at(file->first);
+        for (HashId id : file->second) {
+            if (id != latest) {
+                output << files.hash_table->get(id) << " ";
+            }
+        }
+        output << files.hash_table->get(latest) << " ;\n";
+    }
+
+    /* writes the tags */
+    for (const TagEntry* tag : sorted_tags(tags)) {
+        output << "t " << tag->first << " ";
+        for (HashId id : tag->second) {
+            output << tags.hash_table->get(id) << " ";
+        }
+        output << ";\n";
+    }
+}
+
+/**
+ * @brief Loads a binary snapshot. The file is mapped into memory and, as
+ * every table in it is sorted, each entry is appended at the end of the
+ * indexes, so the load takes time linear in the size of the file.
+ *
+ * @param file_name Name of the snapshot.
+ * @param files Index to load the files into (must be empty).
+ * @param tags Index to load the tags into (must be empty, and share its
+ * HashTable with `files`).
+ */
+void Server::Snapshot::read_binary(const std::string& file_name,
+                                   FileIndex& files, TagIndex& tags) {
+    if (files.hash_table != tags.hash_table) {
+        throw Error::Error{"Los indices no comparten la tabla de hashes"};
+    }
+    Mapping mapping{file_name};
+    Reader reader{mapping.data, mapping.size};
+
+    if (memcmp(reader.bytes(SNAPSHOT_MAGIC_SIZE), SNAPSHOT_MAGIC,
+               SNAPSHOT_MAGIC_SIZE) != 0) {
+        throw Error::Error{"%s no es un snapshot", file_name.c_str()};
+    }
+    uint64_t version = reader.u64();
+    if (version != SNAPSHOT_VERSION) {
+        throw Error::Error{"Version de snapshot no soportada: %" PRIu64,
+                           version};
+    }
+    uint64_t num_names = reader.u64();
+    uint64_t num_hashes = reader.u64();
+    uint64_t num_tags = reader.u64();
+    uint64_t num_members = reader.u64();
+    /* every entry takes at least 8 bytes */
+    uint64_t limit = mapping.size / sizeof(uint64_t);
+    if (num_names > limit || num_hashes > limit || num_tags > limit ||
+        num_members > limit) {
+        throw Error::Error{"Snapshot corrupto"};
+    }
+
+    StringTable names{reader, num_names};
+    StringTable hashes{reader, num_hashes};
+    const char* file_of = reader.array(num_hashes);
+    const char* latest = reader.array(num_names);
+    StringTable tag_names{reader, num_tags};
+    const char* first_member = reader.array(num_tags + 1);
+    const char* members = reader.array(num_members);
+
+    /* file names */
+    using Versions = decltype(FileIndex::Shard::hashes);
+    std::vector<Versions::iterator> versions;
+    versions.reserve(num_names);
+    std::string name;
+    for (uint64_t i = 0; i < num_names; i++) {
+        name = names.next(i, name);
+        Versions& shard = files.shards[shard_of(name)].hashes;
+        versions.push_back(
+            shard.emplace_hint(shard.end(), name, std::set<HashId>{}));
+    }
+
+    /* hashes, interned in order so their ids grow and each one goes
+     * after the previous in its file's set too */
+    std::vector<HashId> ids;
+    ids.reserve(num_hashes);
+    std::string hash;
+    for (uint64_t i = 0; i < num_hashes; i++) {
+        hash = hashes.next(i, hash);
+        ids.push_back(files.hash_table->intern(hash));
+        uint64_t file = Reader::load_u64(file_of, i);
+        if (file == SNAPSHOT_NONE) {
+            continue;
+        }
+        if (file >= num_names) {
+            throw Error::Error{"Snapshot corrupto"};
+        }
+        auto& set = versions[file]->second;
+        set.emplace_hint(set.end(), ids.back());
+        files.shards[shard_of(hash)].files.emplace(ids.back(),
+                                                   versions[file]->first);
+    }
+
+    /* latest versions */
+    for (uint64_t i = 0; i < num_names; i++) {
+        uint64_t index = Reader::load_u64(latest, i);
+        if (index == SNAPSHOT_NONE) {
+            continue;
+        }
+        if (index >= num_hashes) {
+            throw Error::Error{"Snapshot corrupto"};
+        }
+        const std::string& name = versions[i]->first;
+        files.shards[shard_of(name)].latest.emplace(name, ids[index]);
+    }
+
+    /* tags */
+    std::string tag;
+    for (uint64_t i = 0; i < num_tags; i++) {
+        tag = tag_names.next(i, tag);
+        uint64_t first = Reader::load_u64(first_member, i);
+        uint64_t last = Reader::load_u64(first_member, i + 1);
+        if (first > last || last > num_members) {
+            throw Error::Error{"Snapshot corrupto"};
+        }
+        std::vector<HashId> tag_ids;
+        tag_ids.reserve(last - first);
+        for (uint64_t j = first; j < last; j++) {
+            uint64_t member = Reader::load_u64(members, j);
+            if (member >= num_hashes) {
+                throw Error::Error{"Snapshot corrupto"};
+            }
+            tag_ids.push_back(ids[member]);
+        }
+        tags.shards[shard_of(tag)].emplace(
+            tag, tags.runs->make(std::move(tag_ids)));
+    }
+}
+
+/**
+ * @brief Writes the index as a binary snapshot.
+ *
+ * @param output Stream to write to.
+ * @param files Files to write.
+ * @param tags Tags to write.
+ */
+void Server::Snapshot::write_binary(std::ostream& output,
+                                    const FileIndex& files,
+                                    const TagIndex& tags) {
+    std::vector<const Entry*> file_entries = sorted_files(files);
+    std::vector<const TagEntry*> tag_entries = sorted_tags(tags);
+
+    /* sorted tables (the hashes come from both indexes) */
+    std::vector<const std::string*> names, tag_names;
+    std::vector<HashId> ids;
+    uint64_t num_members = 0;
+    for (const Entry* file : file_entries) {
+        names.push_back(&file->first);
+        ids.insert(ids.end(), file->second.begin(), file->second.end());
+    }
+    for (const TagEntry* tag : tag_entries) {
+        tag_names.push_back(&tag->first);
+        ids.insert(ids.end(), tag->second.begin(), tag->second.end());
+        num_members += tag->second.size();
+    }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+    std::vector<std::pair<std::string, HashId>> sorted;
+    sorted.reserve(ids.size());
+    for (HashId id : ids) {
+        sorted.emplace_back(files.hash_table->get(id), id);
+    }
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<const std::string*> hashes;
+    /* position in the table of each id, in the order of `ids` */
+    std::vector<uint64_t> position(ids.size());
+    for (const auto& pair : sorted) {
+        position[std::lower_bound(ids.begin(), ids.end(), pair.second) -
+                 ids.begin()] = hashes.size();
+        hashes.push_back(&pair.first);
+    }
+    auto find_id = [&](HashId id) {
+        return position[std::lower_bound(ids.begin(), ids.end(), id) -
+                        ids.begin()];
+    };
+
+    Writer writer{output};
+    writer.bytes(SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE);
+    writer.u64(SNAPSHOT_VERSION);
+    writer.u64(names.size());
+    writer.u64(hashes.size());
+    writer.u64(tag_names.size());
+    writer.u64(num_members);
+
+    writer.strings(names);
+    writer.strings(hashes);
+
+    /* file of each hash */
+    for (const auto& pair : sorted) {
+        const auto& shard = files.shards[shard_of(pair.first)].files;
+        auto file = shard.find(pair.second);
+        writer.u64(file == shard.end() ? SNAPSHOT_NONE
+                                       : find(names, file->second));
+    }
+
+    /* latest version of each file */
+    for (const std::string* name : names) {
+        const auto& shard = files.shards[shard_of(*name)].latest;
+        auto latest = shard.find(*name);
+        writer.u64(latest == shard.end() ? SNAPSHOT_NONE
+                                         : find_id(latest->second));
+    }
+
+    writer.strings(tag_names);
+    uint64_t first = 0;
+    for (const TagEntry* tag : tag_entries) {
+        writer.u64(first);
+        first += tag->second.size();
+    }
+    writer.u64(first);
+    std::vector<uint64_t> members;
+    for (const TagEntry* tag : tag_entries) {
+        /* the ids are not in the order of the hashes */
+        members.clear();
+        for (HashId id : tag->second) {
+            members.push_back(find_id(id));
+        }
+        std::sort(members.begin(), members.end());
+        for (uint64_t member : members) {
+            writer.u64(member);
+        }
+    }
+}
+
+/**
+ * @brief Gathers the files of every shard, sorted by name.
+ *
+ * @param files File index.
+ * @return Each file name and its hashes.
+ */
+std::vector<const Server::Snapshot::Entry*> Server::Snapshot::sorted_files(
+    const FileIndex& files) {
+    std::vector<const Entry*> entries;
+    for (const FileIndex::Shard& shard : files.shards) {
+        for (const Entry& entry : shard.hashes) {
+            entries.push_back(&entry);
+        }
+    }
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry* a, const Entry* b) {
+                  return a->first < b->first;
+              });
+    return entries;
+}
+
+/**
+ * @brief Gathers the tags of every shard, sorted by name.
+ *
+ * @param tags Tag index.
+ * @return Each tag name and its hashes.
+ */
+std::vector<const Server::Snapshot::TagEntry*>
+Server::Snapshot::sorted_tags(const TagIndex& tags) {
+    std::vector<const TagEntry*> entries;
+    for (const auto& shard : tags.shards) {
+        for (const TagEntry& entry : shard) {
+            entries.push_back(&entry);
+        }
+    }
+    std::sort(entries.begin(), entries.end(),
+              [](const TagEntry* a, const TagEntry* b) {
+                  return a->first < b->first;
+              });
+    return entries;
+}
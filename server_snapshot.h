@@ -0,0 +1,55 @@
+#ifndef SERVER_SNAPSHOT_H_
+#define SERVER_SNAPSHOT_H_
+
+#include <istream>
+#include <ostream>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include "server_file_index.h"
+#include "server_tag_index.h"
+
+namespace Server {
+/**
+ * @brief Reads and writes the index files.
+ * There are two formats: the text one (a record per file or tag, also used
+ * by the write-ahead log) and a versioned binary one, made of sorted string
+ * tables and arrays of fixed-width indices into them, which is mapped into
+ * memory and loaded in time linear in its size.
+ */
+class Snapshot {
+   public:
+    enum class Format { Text, Binary };
+
+    /** api */
+    static Format detect(const std::string& file_name);
+    static void load(const std::string& file_name, FileIndex& files,
+                     TagIndex& tags);
+    static void save(const std::string& file_name, Format format,
+                     const FileIndex& files, const TagIndex& tags);
+
+    /** text format */
+    static void read_text(std::istream& input, FileIndex& files,
+                          TagIndex& tags, bool replaying);
+    static void write_text(std::ostream& output, const FileIndex& files,
+                           const TagIndex& tags);
+
+    /** binary format */
+    static void read_binary(const std::string& file_name, FileIndex& files,
+                            TagIndex& tags);
+    static void write_binary(std::ostream& output, const FileIndex& files,
+                             const TagIndex& tags);
+
+   private:
+    /** A file and its hashes. */
+    using Entry = std::pair<const std::string, std::set<HashId>>;
+    /** A tag and its hashes. */
+    using TagEntry = std::pair<std::string, TagMembers>;
+
+    static std::vector<const Entry*> sorted_files(const FileIndex& files);
+    static std::vector<const TagEntry*> sorted_tags(const TagIndex& tags);
+};
+}  // namespace Server
+
+#endif
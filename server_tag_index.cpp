@@ -1,8 +1,12 @@
 #include "server_tag_index.h"
 #include <set>
+#include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
 
-Server::TagIndex::TagIndex() {
+Server::TagIndex::TagIndex(HashTable& hash_table)
+    : hash_table(&hash_table), runs(new RunTable), shards(NUM_SHARDS) {
 }
 
 Server::TagIndex::~TagIndex() {
@@ -14,10 +18,25 @@ Server::TagIndex::~TagIndex() {
  * @param tag Tag to query.
  * @return Set of associated hashes.
  */
-const std::set<std::string>& Server::TagIndex::get_hashes(
+std::set<std::string> Server::TagIndex::get_hashes(
+    const std::string& tag) const {
+    std::set<std::string> hashes;
+    for (HashId id : this->get_members(tag)) {
+        hashes.insert(this->hash_table->get(id));
+    }
+    return hashes;
+}
+
+/**
+ * @brief Gets the hashes of a tag, as ids.
+ *
+ * @param tag Tag to query.
+ * @return Members of the tag.
+ */
+const Server::TagMembers& Server::TagIndex::get_members(
     const std::string& tag) const {
     try {
-        return this->hashes.at(tag);
+        return this->shards[shard_of(tag)].at(tag);
     } catch (const std::out_of_range& e) {
         throw Error::NotFound{tag};
     }
@@ -31,29 +50,49 @@ const std::set<std::string>& Server::TagIndex::get_hashes(
  */
 void Server::TagIndex::add(const std::string& tag,
                            const std::set<std::string>& hashes) {
+    auto& shard = this->shards[shard_of(tag)];
+
     /* checks if the tag already exists */
-    if (this->hashes.find(tag) != this->hashes.end()) {
+    if (shard.find(tag) != shard.end()) {
         throw Error::Exists{tag};
     }
 
-    /* inserts the hashes into the tag */
-    this->hashes[tag].insert(hashes.begin(), hashes.end());
+    std::vector<HashId> ids;
+    ids.reserve(hashes.size());
+    for (const std::string& hash : hashes) {
+        ids.push_back(this->hash_table->intern(hash));
+    }
+    shard.emplace(tag, this->runs->make(std::move(ids)));
 }
 
 /**
- * @brief Returns an iterator to the tags and associated hashes.
+ * @brief Adds a new tag with the members of a tag of another index that
+ * shares the same HashTable. Its runs are not copied, so they must outlive
+ * this index.
  *
- * @return Iterator to the set of hashes for each tag.
+ * @param tag Name of the new tag.
+ * @param members Members of the tag.
  */
-Server::TagIndex::const_iterator Server::TagIndex::begin() const {
-    return this->hashes.begin();
+void Server::TagIndex::add(const std::string& tag,
+                           const TagMembers& members) {
+    auto& shard = this->shards[shard_of(tag)];
+    if (shard.find(tag) != shard.end()) {
+        throw Error::Exists{tag};
+    }
+    shard.emplace(tag, members);
 }
 
 /**
- * @brief Last iterator.
+ * @brief Visits every tag in the index, in no particular order.
  *
- * @return Last iterator.
+ * @param visit Called with each tag and its members.
  */
-Server::TagIndex::const_iterator Server::TagIndex::end() const {
-    return this->hashes.end();
+void Server::TagIndex::for_each_tag(
+    const std::function<void(const std::string& tag,
+                             const TagMembers& members)>& visit) const {
+    for (const auto& shard : this->shards) {
+        for (const auto& pair : shard) {
+            visit(pair.first, pair.second);
+        }
+    }
 }
@@ -1,30 +1,50 @@
 #ifndef SERVER_TAG_INDEX_H_
 #define SERVER_TAG_INDEX_H_
 
-#include <map>
+#include <functional>
+#include <memory>
 #include <set>
 #include <string>
+#include <vector>
 #include "common_error.h"
+#include "server_flat_map.h"
+#include "server_hash_table.h"
+#include "server_shard.h"
+#include "server_tag_members.h"
 
 namespace Server {
+/**
+ * @brief Tags and the hashes in each one.
+ * The tags are split into shards by name (see `shard_of`), the caller holds
+ * the lock of the shard of each tag it touches. The hashes are kept as ids
+ * of a HashTable, which may be shared with other indexes and must outlive
+ * this one, in runs shared between the tags (see RunTable) and between the
+ * copies of the index.
+ */
 class TagIndex {
    public:
-    using const_iterator =
-        std::map<std::string, std::set<std::string>>::const_iterator;
-
-    TagIndex();
+    explicit TagIndex(HashTable& hash_table);
     ~TagIndex();
 
     /** api */
-    const std::set<std::string>& get_hashes(const std::string& tag) const;
+    std::set<std::string> get_hashes(const std::string& tag) const;
+    const TagMembers& get_members(const std::string& tag) const;
     void add(const std::string& tag, const std::set<std::string>& hashes);
+    void add(const std::string& tag, const TagMembers& members);
 
-    /** iterators */
-    const_iterator begin() const;
-    const_iterator end() const;
+    /** query */
+    void for_each_tag(
+        const std::function<void(const std::string& tag,
+                                 const TagMembers& members)>& visit) const;
 
    private:
-    std::map<std::string, std::set<std::string>> hashes;
+    /* reads and writes the maps directly */
+    friend class Snapshot;
+
+    HashTable* hash_table;
+    std::shared_ptr<RunTable> runs;
+    /* maps each tag to its hashes, by shard */
+    std::vector<FlatMap<std::string, TagMembers>> shards;
 };
 }  // namespace Server
 
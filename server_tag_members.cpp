@@ -0,0 +1,82 @@
+#include "server_tag_members.h"
+#include <algorithm>
+#include <cinttypes>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/** average length of a run: 1 id out of this many ends one */
+#define RUN_TARGET 64
+/** longest run, so a tag made of ids that never end one is still split */
+#define MAX_RUN (4 * RUN_TARGET)
+
+Server::RunTable::RunTable() {
+}
+
+Server::RunTable::~RunTable() {
+}
+
+/**
+ * @brief Makes the members of a tag, sharing the runs that other tags
+ * already have.
+ *
+ * @param ids Hash ids of the tag, in any order and possibly repeated.
+ * @return Members.
+ */
+Server::TagMembers Server::RunTable::make(std::vector<HashId> ids) {
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+    TagMembers members;
+    members.count = ids.size();
+    std::lock_guard<std::mutex> lock(this->mutex);
+    Run run;
+    for (HashId id : ids) {
+        run.push_back(id);
+        if (ends_run(id) || run.size() == MAX_RUN) {
+            members.runs.push_back(this->intern(run));
+            run.clear();
+        }
+    }
+    if (!run.empty()) {
+        members.runs.push_back(this->intern(run));
+    }
+    return members;
+}
+
+/**
+ * @brief Gets the number of distinct runs stored.
+ */
+std::size_t Server::RunTable::size() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->runs.size();
+}
+
+/**
+ * @brief Tells whether a run ends after an id, looking only at the id.
+ */
+bool Server::RunTable::ends_run(HashId id) {
+    /* spreads the ids, which are consecutive, before picking 1 out of
+     * RUN_TARGET */
+    uint64_t mixed = (id + 1ULL) * 0x9e3779b97f4a7c15ULL;
+    return (mixed >> 32) % RUN_TARGET == 0;
+}
+
+/**
+ * @brief Gets the stored copy of a run, storing it if it is new.
+ *
+ * @param run Run, moved into the table if it is new.
+ * @return Stored run.
+ */
+const Server::Run* Server::RunTable::intern(Run& run) {
+    return &*this->runs.insert(std::move(run)).first;
+}
+
+std::size_t Server::RunTable::RunHash::operator()(const Run& run) const {
+    /* FNV-1a over the ids */
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (HashId id : run) {
+        hash = (hash ^ id) * 0x100000001b3ULL;
+    }
+    return hash;
+}
@@ -0,0 +1,120 @@
+#ifndef SERVER_TAG_MEMBERS_H_
+#define SERVER_TAG_MEMBERS_H_
+
+#include <cstddef>
+#include <iterator>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+#include "server_hash_table.h"
+
+namespace Server {
+/** Hash ids in increasing order, shared by every tag that contains them. */
+using Run = std::vector<HashId>;
+
+/**
+ * @brief Hashes of a tag, as ids in increasing order.
+ * They are split into runs, each stored once in a RunTable, so a tag only
+ * takes a pointer per run and copying it copies the pointers.
+ */
+class TagMembers {
+   public:
+    /** Walks the ids of every run, one after the other. */
+    class const_iterator {
+       public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = HashId;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const HashId*;
+        using reference = const HashId&;
+
+        const_iterator(std::vector<const Run*>::const_iterator run,
+                       std::size_t index)
+            : run(run), index(index) {
+        }
+
+        reference operator*() const {
+            return (**this->run)[this->index];
+        }
+
+        const_iterator& operator++() {
+            if (++this->index == (*this->run)->size()) {
+                ++this->run;
+                this->index = 0;
+            }
+            return *this;
+        }
+
+        bool operator==(const const_iterator& other) const {
+            return this->run == other.run && this->index == other.index;
+        }
+
+        bool operator!=(const const_iterator& other) const {
+            return !(*this == other);
+        }
+
+       private:
+        std::vector<const Run*>::const_iterator run;
+        std::size_t index;
+    };
+
+    const_iterator begin() const {
+        return const_iterator{this->runs.begin(), 0};
+    }
+
+    const_iterator end() const {
+        return const_iterator{this->runs.end(), 0};
+    }
+
+    std::size_t size() const {
+        return this->count;
+    }
+
+   private:
+    friend class RunTable;
+
+    /**
+     * Runs of the tag, in order. Each one holds at least an id, which the
+     * iterator relies on (a tag without hashes has no runs at all).
+     */
+    std::vector<const Run*> runs;
+    std::size_t count{0};
+};
+
+/**
+ * @brief Stores each distinct run of the tags once.
+ * The ids of a tag are cut after the ids picked by their value alone (see
+ * `ends_run`), so tags that share their hashes around some id get the same
+ * runs there, and a tag only adds the runs where it differs from the
+ * others. Runs are never freed before the table. Making members takes a
+ * mutex, reading them doesn't.
+ */
+class RunTable {
+   public:
+    RunTable();
+    ~RunTable();
+
+    RunTable(const RunTable& other) = delete;
+    RunTable& operator=(const RunTable& other) = delete;
+
+    /** api */
+    TagMembers make(std::vector<HashId> ids);
+
+    /** query */
+    std::size_t size();
+
+   private:
+    static bool ends_run(HashId id);
+    const Run* intern(Run& run);
+
+    struct RunHash {
+        std::size_t operator()(const Run& run) const;
+    };
+
+    /* elements of an unordered_set don't move, the members point to them */
+    std::unordered_set<Run, RunHash> runs;
+    std::mutex mutex;
+};
+}  // namespace Server
+
+#endif
@@ -1,56 +1,360 @@
 #include "server_versioner.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 #include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <set>
+#include <sstream>
 #include <string>
+#include <tuple>
+#include <utility>
 #include <vector>
+#include "common_delta.h"
+#include "common_epoch.h"
 #include "common_rw_lock.h"
+#include "server_snapshot.h"
+
+/** suffix of the write-ahead log, next to the index file */
+#define WAL_SUFFIX ".wal"
+/** suffix of the log being checkpointed, until the snapshot is written */
+#define OLD_WAL_SUFFIX ".wal.old"
+
+/** time a rejected client has to send its `hello`, in ms */
+#define REJECT_WAIT 10
+
+/** directory where the uploads are written until they are complete */
+#define STAGING_DIR ".staging"
+
+/**
+ * @brief Creates the staging directory if it doesn't exist.
+ */
+static void create_staging_dir() {
+    if (mkdir(STAGING_DIR, 0755) == -1 && errno != EEXIST) {
+        throw Error::Error{"mkdir %s: %s", STAGING_DIR, strerror(errno)};
+    }
+}
 
 Server::Versioner::Versioner() {
+    create_staging_dir();
+    this->locks.set_stats(&this->lock_read_wait, &this->lock_write_wait);
 }
 
 /**
  * @brief Initializes a Versioner object from an index in the given file name.
+ * The index is the last snapshot, and the changes made after it are
+ * replayed from the write-ahead log next to it (and from the log of an
+ * unfinished checkpoint, if any).
  *
  * @param file_name The name of the index file.
  */
 Server::Versioner::Versioner(const std::string& file_name)
     : index_file_name(file_name) {
-    std::ifstream file{file_name};
+    create_staging_dir();
+    this->locks.set_stats(&this->lock_read_wait, &this->lock_write_wait);
+    Snapshot::load(file_name, this->file_index, this->tag_index);
 
-    /* reads the files */
-    while (file) {
-        std::string type, name, hash;
+    std::string wal_name = file_name + WAL_SUFFIX;
+    std::string old_wal_name = file_name + OLD_WAL_SUFFIX;
+    bool unfinished = access(old_wal_name.c_str(), F_OK) == 0;
+    if (unfinished) {
+        this->replay(old_wal_name);
+    }
+    this->replay(wal_name);
+    this->wal.reset(new WriteAheadLog{wal_name});
+    this->publish();
 
-        file >> type >> name;
+    /* the next checkpoint would replace the old log, so its records are
+     * saved first */
+    if (unfinished) {
+        this->snapshot();
+    }
+}
 
-        if (!file) {
-            break;
+Server::Versioner::~Versioner() {
+    if (this->checkpointer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(this->checkpoint_mutex);
+            this->stopping = true;
+        }
+        this->checkpoint_cv.notify_all();
+        this->checkpointer.join();
+        std::cerr << "checkpoint: count=" << this->checkpoint_duration.count()
+                  << std::endl;
+        this->checkpoint_pause.report(std::cerr, "checkpoint pause", "us");
+        this->checkpoint_duration.report(std::cerr, "checkpoint duration",
+                                         "ms");
+    }
+    this->lock_read_wait.report(std::cerr, "lock read wait", "us");
+    this->lock_write_wait.report(std::cerr, "lock write wait", "us");
+    if (this->index_file_name.empty()) {
+        return;
+    }
+    try {
+        this->snapshot();
+    } catch (const std::exception& e) {
+        /* the log still holds the changes */
+        std::cerr << "Error: " << e.what() << std::endl;
+    }
+    if (this->wal) {
+        std::cerr << "wal: records=" << this->wal->get_records()
+                  << " syncs=" << this->wal->get_syncs() << std::endl;
+    }
+}
+
+/**
+ * @brief Applies the records of the write-ahead log. A record is a line
+ * ending in `;`, so a record cut short by a crash is recognized and
+ * dropped from the log, before new records are appended after it.
+ *
+ * @param wal_name Name of the log file.
+ */
+void Server::Versioner::replay(const std::string& wal_name) {
+    std::ifstream wal{wal_name, std::ios::binary};
+    if (!wal) {
+        return;
+    }
+
+    std::string line;
+    uint64_t valid = 0;
+    while (std::getline(wal, line) && wal.good() && !line.empty() &&
+           line.back() == ';') {
+        std::istringstream record{line};
+        Snapshot::read_text(record, this->file_index, this->tag_index, true);
+        valid += line.size() + 1;
+    }
+
+    wal.clear();
+    wal.seekg(0, std::ios::end);
+    if (static_cast<uint64_t>(wal.tellg()) > valid) {
+        std::cerr << "wal: se descarta un registro incompleto" << std::endl;
+        if (truncate(wal_name.c_str(), valid) == -1) {
+            throw Error::Error{"truncate %s: %s", wal_name.c_str(),
+                               strerror(errno)};
+        }
+    }
+}
+
+/**
+ * @brief Writes a snapshot of the index (in the binary format, which loads
+ * faster), replacing the previous one. The snapshot is written aside and
+ * renamed into place, so there is always a complete one on disk, and the
+ * rename is durable when it returns.
+ *
+ * @param files Files to save.
+ * @param tags Tags to save.
+ */
+void Server::Versioner::write_snapshot(const FileIndex& files,
+                                       const TagIndex& tags) {
+    std::string temp_name = this->index_file_name + ".tmp";
+    Snapshot::save(temp_name, Snapshot::Format::Binary, files, tags);
+
+    int fd = open(temp_name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || fsync(fd) == -1) {
+        int error = errno;
+        if (fd != -1) {
+            close(fd);
         }
-        if (type == "f") {
-            while (file && (file >> hash, hash != ";")) {
-                this->file_index.insert_file(name, hash);
+        throw Error::Error{"fsync %s: %s", temp_name.c_str(), strerror(error)};
+    }
+    close(fd);
+
+    if (rename(temp_name.c_str(), this->index_file_name.c_str()) == -1) {
+        throw Error::Error{"rename %s: %s", temp_name.c_str(),
+                           strerror(errno)};
+    }
+    /* the logs it replaces are removed next, which must not reach the disk
+     * before the new name does */
+    sync_directory(this->index_file_name);
+}
+
+/**
+ * @brief Writes a snapshot and empties the logs. Only for when no client is
+ * being served (at startup and shutdown).
+ */
+void Server::Versioner::snapshot() {
+    this->write_snapshot(this->file_index, this->tag_index);
+    std::string old_wal_name = this->index_file_name + OLD_WAL_SUFFIX;
+    if (unlink(old_wal_name.c_str()) == -1 && errno != ENOENT) {
+        throw Error::Error{"unlink %s: %s", old_wal_name.c_str(),
+                           strerror(errno)};
+    }
+    if (this->wal) {
+        this->wal->truncate();
+    }
+}
+
+/**
+ * @brief Rebuilds the indexes as they were when `published_count` was
+ * `cut`, from the published entries and without taking any lock.
+ *
+ * @param cut Position of the first entry left out.
+ * @param files Where the files are added (must be empty).
+ * @param tags Where the tags are added (must be empty).
+ */
+void Server::Versioner::copy_published(uint64_t cut, FileIndex& files,
+                                       TagIndex& tags) {
+    Concurrency::EpochGuard guard;
+
+    /* in the order they were published, so the latest version of each file
+     * is added last */
+    std::vector<std::tuple<uint64_t, HashId, const std::string*>> entries;
+    this->published_files.for_each(
+        [&](HashId id, const Published<const std::string*>& file) {
+            if (file.position < cut) {
+                entries.emplace_back(file.position, id, file.value);
             }
-        } else if (type == "t") {
-            std::set<std::string> hashes;
-            while (file && (file >> hash, hash != ";")) {
-                hashes.insert(hash);
+        });
+    std::sort(entries.begin(), entries.end());
+    for (const auto& entry : entries) {
+        files.insert_file(*std::get<2>(entry),
+                          this->hash_table.get(std::get<1>(entry)));
+    }
+
+    /* the runs of the tags belong to `tag_index`, which outlives the copy */
+    this->published_tags.for_each(
+        [&](const std::string& name, const Published<TagMembers>& tag) {
+            if (tag.position < cut) {
+                tags.add(name, tag.value);
             }
-            this->tag_index.add(name, hashes);
-        } else {
-            throw Error::Error{"Unexpected type %s", type.c_str()};
+        });
+}
+
+/**
+ * @brief Writes a snapshot while the clients are being served, and drops
+ * the log records it holds.
+ * The log is rotated while no change is between being logged and being
+ * published (see `log_lock`), and the snapshot holds what was published
+ * up to then: every change in the old log is in the snapshot, and every
+ * change missing from it is in the new log. Writers only wait for the
+ * rotation, readers not even then; the snapshot is rebuilt from the
+ * published entries, which are never changed.
+ */
+void Server::Versioner::checkpoint() {
+    auto start = std::chrono::steady_clock::now();
+    std::string old_wal_name = this->index_file_name + OLD_WAL_SUFFIX;
+
+    uint64_t cut;
+    std::chrono::steady_clock::duration pause;
+    {
+        Concurrency::WriteLock logging(this->log_lock);
+        auto locked = std::chrono::steady_clock::now();
+        /* after a failed checkpoint the old log is still needed, so the
+         * new records stay in the current one */
+        if (access(old_wal_name.c_str(), F_OK) == -1) {
+            this->wal->rotate(old_wal_name);
         }
+        cut = this->published_count;
+        pause = std::chrono::steady_clock::now() - locked;
+    }
+
+    FileIndex files{this->hash_table};
+    TagIndex tags{this->hash_table};
+    this->copy_published(cut, files, tags);
+    this->write_snapshot(files, tags);
+    if (unlink(old_wal_name.c_str()) == -1) {
+        throw Error::Error{"unlink %s: %s", old_wal_name.c_str(),
+                           strerror(errno)};
     }
+
+    using std::chrono::duration_cast;
+    auto end = std::chrono::steady_clock::now();
+    this->checkpoint_pause.record(
+        duration_cast<std::chrono::microseconds>(pause).count());
+    this->checkpoint_duration.record(
+        duration_cast<std::chrono::milliseconds>(end - start).count());
 }
 
-Server::Versioner::~Versioner() {
-    std::ofstream file{this->index_file_name};
-    this->save(file);
+/**
+ * @brief Body of the checkpoint thread: checkpoints every `interval`, if
+ * something was logged since the last time, until the Versioner is
+ * destroyed.
+ *
+ * @param interval Time between checkpoints.
+ */
+void Server::Versioner::checkpoint_loop(std::chrono::seconds interval) {
+    uint64_t checkpointed = this->wal->get_records();
+    std::unique_lock<std::mutex> lock(this->checkpoint_mutex);
+    while (!this->checkpoint_cv.wait_for(lock, interval,
+                                         [this] { return this->stopping; })) {
+        uint64_t records = this->wal->get_records();
+        if (records == checkpointed) {
+            continue;
+        }
+        lock.unlock();
+        try {
+            this->checkpoint();
+            checkpointed = records;
+        } catch (const std::exception& e) {
+            /* the logs still hold the changes */
+            std::cerr << "checkpoint: " << e.what() << std::endl;
+        }
+        lock.lock();
+    }
+}
+
+/**
+ * @brief Appends a change of the index to the write-ahead log (if there is
+ * one) and waits until it is on disk. Changes are logged before they are
+ * applied, within `log_lock`. Must be called without holding the locks of
+ * the shards, so other clients go on while it waits.
+ *
+ * @param type Record type (`f` for files, `t` for tags).
+ * @param name File or tag name.
+ * @param hashes Hashes of the record.
+ */
+void Server::Versioner::log(char type, const std::string& name,
+                            const std::set<std::string>& hashes) {
+    if (!this->wal) {
+        return;
+    }
+
+    std::string record;
+    record += type;
+    record += " " + name + " ";
+    for (const std::string& hash : hashes) {
+        record += hash + " ";
+    }
+    record += ";\n";
+    this->wal->append(record);
+}
+
+/**
+ * @brief Hello handler: agrees on the protocol revision of the connection,
+ * which is the latest one both sides speak. Clients that never send it
+ * keep the original revision.
+ *
+ * @param comm Communication endpoint.
+ */
+void Server::Versioner::hello(IO::Comm& comm) {
+    uint32_t version;
+    comm >> version;
+
+    version = std::min(version, IO::PROTOCOL_VERSION);
+    if (version == 0) {
+        comm << IO::Response::Error;
+        return;
+    }
+    comm << IO::Response::OK << version;
+    comm.set_version(version);
 }
 
 /**
  * @brief Push handler.
+ * The file is received into a staging file without holding any lock, so a
+ * slow upload doesn't block the other clients. It only enters the index
+ * once it was completely received. From revision 9 on, a final response
+ * tells the client whether it was committed.
  *
  * @param comm Communication endpoint.
  */
@@ -60,25 +364,294 @@ void Server::Versioner::push(IO::Comm& comm) {
     /* reads the cmd data */
     comm >> filename >> hash;
 
-    Concurrency::WriteLock lock(this->lock);
+    if (!this->push_begin(filename, hash)) {
+        comm << IO::Response::Error;
+        return;
+    }
 
+    std::unique_ptr<FileHasher> hasher;
     try {
-        this->file_index.insert_file(filename, hash);
-
         /* sends the response */
         comm << IO::Response::OK;
 
-        /* reads the file */
-        std::ofstream file{hash, std::ios::binary};
-        comm >> file;
-    } catch (const Error::Exists& e) {
-        comm << IO::Response::Error;
+        /* reads the file, hashing it as it arrives */
+        hasher = this->push_hasher(hash);
+        IO::Progress progress;
+        if (hasher) {
+            progress = [&hasher](uint64_t written) {
+                hasher->advance(written);
+            };
+        }
+        comm.receive_file(this->staging_file(hash), progress);
+    } catch (...) {
+        hasher.reset();
+        this->push_abort(filename, hash);
+        throw;
+    }
+
+    bool committed = this->push_commit(filename, hash, hasher.get());
+    if (comm.get_version() >= 9) {
+        comm << (committed ? IO::Response::OK : IO::Response::Error);
+    }
+}
+
+/**
+ * @brief Reserves the hash of a file that is about to be pushed. The caller
+ * must answer the client with the result and, on success, receive the file
+ * body into `staging_file(hash)` and then call `push_commit` (or
+ * `push_abort` if that fails).
+ * While the upload is in progress, pushes of the same hash are rejected as
+ * if it already existed.
+ *
+ * @param file_name Name of the pushed file.
+ * @param hash Hash of the pushed file.
+ * @return false if the hash already exists or is being uploaded.
+ */
+bool Server::Versioner::push_begin(const std::string& file_name,
+                                   const std::string& hash) {
+    std::size_t shard = shard_of(hash);
+    Concurrency::WriteLock lock(this->locks[shard]);
+
+    if (this->file_index.exists(hash) ||
+        this->staging[shard].find(hash) != this->staging[shard].end()) {
+        return false;
+    }
+    this->staging[shard].insert(hash);
+    return true;
+}
+
+/**
+ * @brief Gets the name of the file where an upload is received.
+ *
+ * @param hash Hash of the pushed file.
+ * @return Staging file name.
+ */
+std::string Server::Versioner::staging_file(const std::string& hash) const {
+    return std::string{STAGING_DIR} + "/" + hash;
+}
+
+/**
+ * @brief Starts hashing an upload as it is received, if pushed files must
+ * be verified. The receiver must report its progress to the hasher and
+ * hand it to `push_commit`.
+ *
+ * @param hash Hash of the pushed file.
+ * @return The hasher, or nothing if files are not verified.
+ */
+std::unique_ptr<Server::FileHasher> Server::Versioner::push_hasher(
+    const std::string& hash) const {
+    if (!this->verify) {
+        return nullptr;
+    }
+    return std::unique_ptr<FileHasher>{
+        new FileHasher{this->staging_file(hash)}};
+}
+
+/**
+ * @brief Moves a completely received upload into the index. If it was
+ * hashed and the contents don't match the hash, it is discarded instead.
+ *
+ * @param file_name Name of the pushed file.
+ * @param hash Hash of the pushed file.
+ * @param hasher Hasher given by `push_hasher` (may be null).
+ * @return false if the upload was discarded.
+ */
+bool Server::Versioner::push_commit(const std::string& file_name,
+                                    const std::string& hash,
+                                    FileHasher* hasher) {
+    if (hasher) {
+        std::string digest;
+        try {
+            digest = hasher->finish();
+        } catch (...) {
+            this->push_abort(file_name, hash);
+            throw;
+        }
+
+        std::string expected = hash;
+        std::transform(expected.begin(), expected.end(), expected.begin(),
+                       ::tolower);
+        if (digest != expected) {
+            std::cerr << "Push de " << file_name << " rechazado: el contenido "
+                      << "no coincide con el hash " << hash << std::endl;
+            this->push_abort(file_name, hash);
+            return false;
+        }
+    }
+
+    /* the blob is not reachable until it is in the index, so it can be
+     * moved into place without the lock */
+    if (rename(this->staging_file(hash).c_str(), hash.c_str()) == -1) {
+        int error = errno;
+        this->push_abort(file_name, hash);
+        throw Error::Error{"rename %s: %s", hash.c_str(), strerror(error)};
+    }
+
+    {
+        /* the file is durable before anyone can see it (it stays in
+         * `staging` meanwhile, so it can't be pushed nor tagged) */
+        Concurrency::ReadLock logging(this->log_lock);
+        try {
+            this->log('f', file_name, {hash});
+        } catch (...) {
+            /* the blob stays, in case the record reached the log */
+            this->push_abort(file_name, hash);
+            throw;
+        }
+
+        std::size_t shard = shard_of(hash);
+        Concurrency::MultiLock lock(this->locks, {},
+                                    {shard, shard_of(file_name)});
+        this->staging[shard].erase(hash);
+        const std::string& name =
+            this->file_index.insert_file(file_name, hash);
+        /* positioned under the lock of the name, so the latest version of
+         * a file is the last one published */
+        this->published_files.insert(this->hash_table.intern(hash),
+                                     {&name, this->published_count++});
+    }
+    this->staging_changed();
+    struct stat info;
+    if (stat(hash.c_str(), &info) == 0) {
+        this->metrics.add_blob(info.st_size);
+    }
+    return true;
+}
+
+/**
+ * @brief Discards an upload that could not be received.
+ *
+ * @param file_name Name of the pushed file.
+ * @param hash Hash of the pushed file.
+ */
+void Server::Versioner::push_abort(const std::string& file_name,
+                                   const std::string& hash) {
+    unlink(this->staging_file(hash).c_str());
+
+    {
+        std::size_t shard = shard_of(hash);
+        Concurrency::WriteLock lock(this->locks[shard]);
+        this->staging[shard].erase(hash);
+    }
+    this->staging_changed();
+}
+
+/**
+ * @brief Wakes up the tags waiting for uploads, after one of them left
+ * `staging`.
+ */
+void Server::Versioner::staging_changed() {
+    {
+        std::lock_guard<std::mutex> lock(this->staging_mutex);
+        this->staging_generation++;
+    }
+    this->staging_cv.notify_all();
+}
+
+/**
+ * @brief Gets the number of uploads that left `staging` so far. A tag that
+ * must wait (see `add_tag`) is worth trying again once it changes.
+ */
+uint64_t Server::Versioner::get_staging_generation() {
+    std::lock_guard<std::mutex> lock(this->staging_mutex);
+    return this->staging_generation;
+}
+
+/**
+ * @brief Reserves the hash of a file that is about to be pushed as a delta
+ * against an earlier version, like `push_begin`. The caller must then apply
+ * the delta instructions to the returned writer, close it and call
+ * `push_commit` (or `push_abort` if anything fails).
+ *
+ * @param file_name Name of the pushed file.
+ * @param hash Hash of the pushed file.
+ * @param basis Hash of the earlier version the delta refers to.
+ * @param block_size Block size of the delta.
+ * @return The writer, or nothing if the hash already exists or is being
+ * uploaded, or the basis doesn't exist.
+ */
+std::unique_ptr<Server::DeltaWriter> Server::Versioner::delta_begin(
+    const std::string& file_name, const std::string& hash,
+    const std::string& basis, uint32_t block_size) {
+    {
+        Concurrency::ReadLock lock(this->locks[shard_of(basis)]);
+        if (!this->file_index.exists(basis)) {
+            return nullptr;
+        }
+    }
+    if (!this->push_begin(file_name, hash)) {
+        return nullptr;
+    }
+
+    try {
+        return std::unique_ptr<DeltaWriter>{
+            new DeltaWriter{basis, block_size, this->staging_file(hash)}};
     } catch (...) {
-        this->file_index.remove_file(filename, hash);
+        this->push_abort(file_name, hash);
         throw;
     }
 }
 
+/**
+ * @brief Enables the verification of pushed files: their SHA-256 must match
+ * the hash they are pushed with, or they are discarded.
+ *
+ * @param verify Whether to verify the pushed files.
+ */
+void Server::Versioner::set_verify(bool verify) {
+    this->verify = verify;
+}
+
+/**
+ * @brief Starts checkpointing the index in the background, so the log
+ * doesn't grow without bounds and a restart replays little of it. Does
+ * nothing without an index file.
+ *
+ * @param seconds Time between checkpoints.
+ */
+void Server::Versioner::set_checkpoint_interval(unsigned seconds) {
+    if (!this->wal || this->checkpointer.joinable()) {
+        return;
+    }
+    this->checkpointer = std::thread(&Versioner::checkpoint_loop, this,
+                                     std::chrono::seconds{seconds});
+}
+
+/**
+ * @brief Sets how long a tag waits for the uploads of its files before it
+ * is rejected.
+ *
+ * @param seconds Time to wait.
+ */
+void Server::Versioner::set_tag_timeout(unsigned seconds) {
+    this->tag_timeout = std::chrono::seconds{seconds};
+}
+
+/**
+ * @brief Gets how long a tag waits for the uploads of its files, for the
+ * callers that wait on their own.
+ */
+std::chrono::seconds Server::Versioner::get_tag_timeout() const {
+    return this->tag_timeout;
+}
+
+/**
+ * @brief Gets the counters of the server, for the callers that serve the
+ * commands on their own.
+ */
+Server::Metrics& Server::Versioner::get_metrics() {
+    return this->metrics;
+}
+
+/**
+ * @brief Sets the compression offered to the clients that ask for it.
+ *
+ * @param codec Compression (`None` to never compress).
+ */
+void Server::Versioner::set_compression(IO::Codec codec) {
+    this->compression = codec;
+}
+
 /**
  * @brief Pull handler.
  *
@@ -86,32 +659,105 @@ void Server::Versioner::push(IO::Comm& comm) {
  */
 void Server::Versioner::pull(IO::Comm& comm) {
     try {
-        /* pull only requires read access */
-        Concurrency::ReadLock lock(this->lock);
-
         /* reads the tag name */
         std::string tag;
         comm >> tag;
 
-        /* gets the associated hashes */
-        const auto& hashes = this->tag_index.get_hashes(tag);
+        std::set<std::string> hashes;
+        std::vector<std::string> names = this->tagged_files(tag, hashes);
 
         comm << IO::Response::OK << static_cast<uint32_t>(hashes.size());
 
+        /* blobs never change once in the index, so no lock is needed */
+        std::size_t i = 0;
         for (const std::string& hash : hashes) {
-            comm << this->file_index.get_file_name(hash);
+            comm << names[i++];
 
             /* sends the file content */
-            std::ifstream file{hash, std::ios::binary};
-            comm << file;
+            comm.send_file(hash);
         }
     } catch (const Error::NotFound& e) {
         comm << IO::Response::Error;
     }
 }
 
+/**
+ * @brief Gets the files of a tag, without taking any lock.
+ *
+ * @param tag Tag name.
+ * @param hashes Where the hashes of the tag are stored.
+ * @return File name of each hash, in the same order.
+ * @throw Error::NotFound if the tag doesn't exist, or a file of it is still
+ * being uploaded.
+ */
+std::vector<std::string> Server::Versioner::tagged_files(
+    const std::string& tag, std::set<std::string>& hashes) {
+    Concurrency::EpochGuard guard;
+    const Published<TagMembers>* tagged = this->published_tags.find(tag);
+    if (!tagged) {
+        throw Error::NotFound{tag};
+    }
+
+    /* in the order of the hashes, as the client expects */
+    std::map<std::string, const std::string*> files;
+    for (HashId id : tagged->value) {
+        std::string hash = this->hash_table.get(id);
+        /* a tagged file may still be being uploaded */
+        const Published<const std::string*>* file =
+            this->published_files.find(id);
+        if (!file) {
+            throw Error::NotFound{hash};
+        }
+        files.emplace(std::move(hash), file->value);
+    }
+    std::vector<std::string> names;
+    for (const auto& file : files) {
+        hashes.insert(file.first);
+        names.push_back(*file.second);
+    }
+    return names;
+}
+
+/**
+ * @brief Publishes every file and tag of the indexes for the lock-free
+ * readers (see `published_files`), and counts the size of the stored
+ * files.
+ */
+void Server::Versioner::publish() {
+    /* the latest version of each file goes after the others */
+    std::vector<std::pair<HashId, const std::string*>> latest;
+    this->file_index.for_each_hash(
+        [&](const std::string& hash, const std::string& name) {
+            HashId id = this->hash_table.intern(hash);
+            if (this->file_index.get_latest(name) == hash) {
+                latest.emplace_back(id, &name);
+            } else {
+                this->published_files.insert(
+                    id, {&name, this->published_count++});
+            }
+            struct stat info;
+            if (stat(hash.c_str(), &info) == 0) {
+                this->metrics.add_blob(info.st_size);
+            }
+        });
+    for (const auto& file : latest) {
+        this->published_files.insert(
+            file.first, {file.second, this->published_count++});
+    }
+    this->tag_index.for_each_tag(
+        [this](const std::string& tag, const TagMembers& members) {
+            this->published_tags.insert(tag,
+                                        {members, this->published_count++});
+        });
+}
+
 /**
  * @brief Tag handler.
+ * A tag may name files whose upload is still in progress (the client may
+ * tag a file right after pushing it, before the server received it
+ * completely): it waits for them, so a tag never holds a file that may
+ * still be discarded. It is rejected if they don't finish in time (see
+ * `set_tag_timeout`).
  *
  * @param comm Communication endpoint.
  */
@@ -120,55 +766,500 @@ void Server::Versioner::tag(IO::Comm& comm) {
     uint32_t num_hashes;
     std::set<std::string> hashes;
 
+    /* the whole request is read before taking the lock */
+    comm >> num_hashes >> name;
+    for (uint32_t i = 0; i < num_hashes; i++) {
+        std::string hash;
+        comm >> hash;
+        hashes.insert(hash);
+    }
+
+    TagResult result;
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + this->tag_timeout;
     try {
-        Concurrency::WriteLock lock(this->lock);
+        while (true) {
+            uint64_t generation;
+            {
+                std::lock_guard<std::mutex> lock(this->staging_mutex);
+                generation = this->staging_generation;
+            }
+            result = this->add_tag(name, hashes);
+            if (result != TagResult::Waiting) {
+                break;
+            }
 
-        comm >> num_hashes >> name;
-        for (uint32_t i = 0; i < num_hashes; i++) {
-            std::string hash;
-            comm >> hash;
-            hashes.insert(hash);
+            std::unique_lock<std::mutex> lock(this->staging_mutex);
+            if (!this->staging_cv.wait_until(
+                    lock, deadline, [this, generation] {
+                        return this->staging_generation != generation;
+                    })) {
+                result = TagResult::Rejected;
+                break;
+            }
         }
+    } catch (const std::exception& e) {
+        result = TagResult::Rejected;
+    }
 
-        /* checks that all the hashes exist */
+    comm << (result == TagResult::Added ? IO::Response::OK
+                                        : IO::Response::Error);
+}
+
+/**
+ * @brief Adds a tag, unless some of its files are still being uploaded.
+ * Callers that get `Waiting` must try again once those uploads finish (see
+ * `staging_generation`).
+ *
+ * @param name Tag name.
+ * @param hashes Hashes of the tag.
+ * @return Whether the tag was added, can't be (it exists or a file is
+ * missing) or must wait.
+ */
+Server::Versioner::TagResult Server::Versioner::add_tag(
+    const std::string& name, const std::set<std::string>& hashes) {
+    std::set<std::size_t> shards;
+    for (const auto& hash : hashes) {
+        shards.insert(shard_of(hash));
+    }
+
+    Concurrency::ReadLock logging(this->log_lock);
+    {
+        Concurrency::MultiLock lock(this->locks, shards, {shard_of(name)});
+
+        bool staged = false;
         for (const auto& hash : hashes) {
-            if (!this->file_index.exists(hash)) {
-                comm << IO::Response::Error;
-                return;
+            if (this->file_index.exists(hash)) {
+                continue;
+            }
+            const auto& staging = this->staging[shard_of(hash)];
+            if (staging.find(hash) == staging.end()) {
+                return TagResult::Rejected;
             }
+            staged = true;
+        }
+        if (staged) {
+            return TagResult::Waiting;
         }
 
-        this->tag_index.add(name, hashes);
-        comm << IO::Response::OK;
-    } catch (const std::exception& e) {
+        /* takes the name, but pulls don't see the tag until it is
+         * published */
+        try {
+            this->tag_index.add(name, hashes);
+        } catch (const Error::Exists& e) {
+            return TagResult::Rejected;
+        }
+    }
+
+    /* the tag is durable before anyone can see it */
+    this->log('t', name, hashes);
+
+    TagMembers members;
+    {
+        Concurrency::ReadLock lock(this->locks[shard_of(name)]);
+        members = this->tag_index.get_members(name);
+    }
+    this->published_tags.insert(name, {members, this->published_count++});
+    return TagResult::Added;
+}
+
+/**
+ * @brief Have handler: tells which of the given hashes the server already
+ * has, so the client only pushes the missing ones.
+ * The answer is a bitmap with a bit per hash, in the order they were given
+ * and starting from the least significant bit of the first byte.
+ *
+ * @param comm Communication endpoint.
+ */
+void Server::Versioner::have(IO::Comm& comm) {
+    uint32_t num_hashes;
+    std::vector<std::string> hashes;
+
+    /* the whole request is read before taking the lock */
+    comm >> num_hashes;
+    for (uint32_t i = 0; i < num_hashes; i++) {
+        std::string hash;
+        comm >> hash;
+        hashes.push_back(std::move(hash));
+    }
+
+    std::set<std::size_t> shards;
+    for (const std::string& hash : hashes) {
+        shards.insert(shard_of(hash));
+    }
+
+    std::vector<uint8_t> bitmap((num_hashes + 7) / 8, 0);
+    {
+        Concurrency::MultiLock lock(this->locks, shards, {});
+        for (uint32_t i = 0; i < num_hashes; i++) {
+            /* uploads in progress count, pushing them again would fail */
+            const auto& staging = this->staging[shard_of(hashes[i])];
+            if (this->file_index.exists(hashes[i]) ||
+                staging.find(hashes[i]) != staging.end()) {
+                bitmap[i / 8] |= 1 << (i % 8);
+            }
+        }
+    }
+
+    comm << IO::Response::OK << num_hashes;
+    comm.write(bitmap.data(), bitmap.size());
+}
+
+/**
+ * @brief Manifest handler: lists the files of a tag without sending them,
+ * so the client can fetch them on its own (e.g. through several
+ * connections). Each file is sent as its name, hash and size.
+ *
+ * @param comm Communication endpoint.
+ */
+void Server::Versioner::manifest(IO::Comm& comm) {
+    try {
+        std::string tag;
+        comm >> tag;
+
+        std::set<std::string> hashes;
+        std::vector<std::string> names = this->tagged_files(tag, hashes);
+
+        std::vector<uint64_t> sizes;
+        for (const std::string& hash : hashes) {
+            struct stat info;
+            if (stat(hash.c_str(), &info) == -1) {
+                throw Error::NotFound{hash};
+            }
+            sizes.push_back(info.st_size);
+        }
+
+        comm << IO::Response::OK << static_cast<uint32_t>(hashes.size());
+
+        std::size_t i = 0;
+        for (const std::string& hash : hashes) {
+            comm << names[i] << hash << sizes[i];
+            i++;
+        }
+    } catch (const Error::NotFound& e) {
+        comm << IO::Response::Error;
+    }
+}
+
+/**
+ * @brief Fetch handler: sends a single file, given its hash.
+ *
+ * @param comm Communication endpoint.
+ */
+void Server::Versioner::fetch(IO::Comm& comm) {
+    std::string hash;
+    comm >> hash;
+
+    bool exists;
+    {
+        Concurrency::EpochGuard guard;
+        HashId id;
+        exists = this->hash_table.find(hash, id) &&
+                 this->published_files.find(id) != nullptr;
+    }
+    if (!exists) {
+        comm << IO::Response::Error;
+        return;
+    }
+
+    /* blobs never change once in the index, so no lock is needed */
+    comm << IO::Response::OK;
+    comm.send_file(hash);
+}
+
+/**
+ * @brief Compress handler: picks the compression of the file bodies of the
+ * connection among the ones the client offers, in order of preference.
+ * Every file sent after the response is compressed with it, in both
+ * directions.
+ * Requires protocol revision 5: the codec is left unset on connections
+ * that didn't agree on it.
+ *
+ * @param comm Communication endpoint.
+ */
+void Server::Versioner::compress(IO::Comm& comm) {
+    uint8_t num_codecs;
+    comm >> num_codecs;
+
+    /* compressed files are sent in chunks, which older revisions lack */
+    if (comm.get_version() < 5) {
+        for (uint8_t i = 0; i < num_codecs; i++) {
+            uint8_t codec;
+            comm >> codec;
+        }
+        comm << IO::Response::Error;
+        return;
+    }
+
+    IO::Codec chosen = IO::Codec::None;
+    for (uint8_t i = 0; i < num_codecs; i++) {
+        uint8_t codec;
+        comm >> codec;
+        if (chosen == IO::Codec::None && this->compression != IO::Codec::None &&
+            codec == static_cast<uint8_t>(this->compression)) {
+            chosen = this->compression;
+        }
+    }
+
+    comm << IO::Response::OK << static_cast<uint8_t>(chosen);
+    comm.set_codec(chosen);
+}
+
+/**
+ * @brief Signatures handler: sends the signatures of the blocks of the
+ * latest version of a file, so the client can push the next one as a
+ * delta against it. The response has the hash of that version, the block
+ * size and the checksum and strong hash of each block.
+ *
+ * @param comm Communication endpoint.
+ */
+void Server::Versioner::signatures(IO::Comm& comm) {
+    std::string file_name;
+    comm >> file_name;
+
+    Signatures signatures;
+    if (!this->find_signatures(file_name, signatures)) {
+        comm << IO::Response::Error;
+        return;
+    }
+    send_signatures(comm, signatures);
+}
+
+/**
+ * @brief Computes the signatures of the blocks of the latest version of a
+ * file, which reads the whole version.
+ *
+ * @param file_name Name of the file.
+ * @param signatures Where the signatures are stored.
+ * @return false if the file has no version.
+ */
+bool Server::Versioner::find_signatures(const std::string& file_name,
+                                        Signatures& signatures) {
+    try {
+        Concurrency::ReadLock lock(this->locks[shard_of(file_name)]);
+        signatures.basis = this->file_index.get_latest(file_name);
+    } catch (const Error::NotFound& e) {
+        return false;
+    }
+
+    /* blobs never change once in the index, so no lock is needed */
+    struct stat info;
+    if (stat(signatures.basis.c_str(), &info) == -1) {
+        return false;
+    }
+    signatures.block_size = Delta::block_size_for(info.st_size);
+    signatures.blocks =
+        Delta::compute_signatures(signatures.basis, signatures.block_size);
+    return true;
+}
+
+/**
+ * @brief Sends the response of a `signatures` command that found them.
+ *
+ * @param comm Communication endpoint.
+ * @param signatures Signatures given by `find_signatures`.
+ */
+void Server::Versioner::send_signatures(IO::Comm& comm,
+                                        const Signatures& signatures) {
+    comm << IO::Response::OK << signatures.basis << signatures.block_size
+         << static_cast<uint32_t>(signatures.blocks.size());
+    for (const Delta::BlockSignature& block : signatures.blocks) {
+        comm << block.weak << block.strong;
+    }
+}
+
+/**
+ * @brief Delta handler: receives a file as a delta against an earlier
+ * version (see `Delta::Op`) and rebuilds it in the staging directory, as a
+ * push would receive it. Like a push, it gets a final response from
+ * revision 9 on.
+ *
+ * @param comm Communication endpoint.
+ */
+void Server::Versioner::delta(IO::Comm& comm) {
+#define LITERAL_BUFFER_SIZE 65536
+    std::string file_name, hash, basis;
+    uint32_t block_size;
+    comm >> file_name >> hash >> basis >> block_size;
+
+    std::unique_ptr<DeltaWriter> writer =
+        this->delta_begin(file_name, hash, basis, block_size);
+    if (!writer) {
         comm << IO::Response::Error;
+        return;
+    }
+
+    std::unique_ptr<FileHasher> hasher;
+    try {
+        comm << IO::Response::OK;
+        hasher = this->push_hasher(hash);
+
+        uint8_t op;
+        while ((comm >> op, op != static_cast<uint8_t>(Delta::Op::End))) {
+            if (op == static_cast<uint8_t>(Delta::Op::Copy)) {
+                uint32_t first_block, num_blocks;
+                comm >> first_block >> num_blocks;
+                writer->copy(first_block, num_blocks);
+            } else if (op == static_cast<uint8_t>(Delta::Op::Literal)) {
+                uint32_t size;
+                comm >> size;
+                while (size > 0) {
+                    char buffer[LITERAL_BUFFER_SIZE];
+                    uint32_t piece = std::min<uint32_t>(size, sizeof(buffer));
+                    if (comm.read(buffer, piece) !=
+                        static_cast<ssize_t>(piece)) {
+                        throw IO::CommError{"Error en la lectura de delta"};
+                    }
+                    writer->literal(buffer, piece);
+                    size -= piece;
+                }
+            } else {
+                throw Error::Error{"Instruccion de delta invalida"};
+            }
+
+            if (hasher) {
+                hasher->advance(writer->get_written());
+            }
+        }
+        writer->close();
+    } catch (...) {
+        writer.reset();
+        hasher.reset();
+        this->push_abort(file_name, hash);
+        throw;
+    }
+
+    bool committed = this->push_commit(file_name, hash, hasher.get());
+    if (comm.get_version() >= 9) {
+        comm << (committed ? IO::Response::OK : IO::Response::Error);
+    }
+}
+
+/**
+ * @brief Adds the values of a histogram to a `stats` response: the number
+ * of values, their sum, the largest one and the count of each non empty
+ * bucket, named after its upper bound (e.g. `pull.le_1023_us`).
+ *
+ * @param values Response values.
+ * @param name Name of the measured value.
+ * @param histogram Histogram, in us.
+ */
+static void add_histogram(
+    std::vector<std::pair<std::string, uint64_t>>& values,
+    const std::string& name, const Stats::Histogram& histogram) {
+    values.emplace_back(name + ".count", histogram.count());
+    values.emplace_back(name + ".sum_us", histogram.sum());
+    values.emplace_back(name + ".max_us", histogram.max());
+    for (int i = 0; i < Stats::Histogram::NUM_BUCKETS; i++) {
+        uint64_t count = histogram.bucket(i);
+        if (count > 0) {
+            values.emplace_back(
+                name + ".le_" +
+                    std::to_string(Stats::Histogram::upper_bound(i)) + "_us",
+                count);
+        }
+    }
+}
+
+/**
+ * @brief Stats handler: sends the live metrics of the server, as a list of
+ * names and values. There are the requests and the latency of each
+ * command, the traffic, the open connections, the time waited for the
+ * locks of the indexes and their sizes, and in the pool mode the queue of
+ * the pool. Nothing is locked, so the values may be slightly behind the
+ * ones being recorded.
+ *
+ * @param comm Communication endpoint.
+ */
+void Server::Versioner::stats(IO::Comm& comm) {
+    std::vector<std::pair<std::string, uint64_t>> values;
+    for (uint8_t id = 0; id < Metrics::NUM_COMMANDS; id++) {
+        add_histogram(values, Metrics::command_name(id),
+                      this->metrics.get_latency(id));
+    }
+    values.emplace_back("bytes_in", this->metrics.get_bytes_in());
+    values.emplace_back("bytes_out", this->metrics.get_bytes_out());
+    values.emplace_back("connections", this->metrics.get_connections());
+    add_histogram(values, "lock_read_wait", this->lock_read_wait);
+    add_histogram(values, "lock_write_wait", this->lock_write_wait);
+    values.emplace_back("files", this->published_files.size());
+    values.emplace_back("tags", this->published_tags.size());
+    values.emplace_back("hashes", this->hash_table.size());
+    values.emplace_back("blob_bytes", this->metrics.get_blob_bytes());
+    const PoolMetrics& pool = this->metrics.get_pool();
+    if (pool.workers > 0) {
+        values.emplace_back("pool_workers", pool.workers.load());
+        values.emplace_back("pool_queued", pool.queued.load());
+        values.emplace_back("pool_max_queued", pool.max_queued.load());
+        values.emplace_back("pool_accepted", pool.accepted.load());
+        values.emplace_back("pool_rejected", pool.rejected.load());
+        add_histogram(values, "pool_queue_wait", pool.queue_wait);
+    }
+
+    comm << IO::Response::OK << static_cast<uint32_t>(values.size());
+    for (const auto& value : values) {
+        comm << value.first << value.second;
     }
 }
 
 /**
  * @brief Server request handler.
+ * Serves commands until the client closes the connection, so a client may
+ * send several commands (even without waiting for the responses) through
+ * the same connection.
  *
  * @param client The newly connected client.
  */
 void Server::Versioner::operator()(IO::Socket& client) {
     try {
         IO::CommSocket comm{std::move(client)};
-        uint8_t cmd_id;
-        comm >> cmd_id;
+        Metrics::Connection connection{this->metrics, comm.get_socket()};
 
-        switch (cmd_id) {
-            case 1:
-                this->push(comm);
-                break;
-            case 2:
-                this->tag(comm);
-                break;
-            case 3:
-                this->pull(comm);
-                break;
-            default:
-                std::cerr << "Invalid ID " << cmd_id << std::endl;
-                break;
+        while (true) {
+            uint8_t cmd_id;
+            comm >> cmd_id;
+            auto start = std::chrono::steady_clock::now();
+
+            switch (cmd_id) {
+                case 0:
+                    this->hello(comm);
+                    break;
+                case 1:
+                    this->push(comm);
+                    break;
+                case 2:
+                    this->tag(comm);
+                    break;
+                case 3:
+                    this->pull(comm);
+                    break;
+                case 4:
+                    this->have(comm);
+                    break;
+                case 5:
+                    this->manifest(comm);
+                    break;
+                case 6:
+                    this->fetch(comm);
+                    break;
+                case 7:
+                    this->compress(comm);
+                    break;
+                case 8:
+                    this->signatures(comm);
+                    break;
+                case 9:
+                    this->delta(comm);
+                    break;
+                case 10:
+                    this->stats(comm);
+                    break;
+                default:
+                    std::cerr << "Invalid ID " << cmd_id << std::endl;
+                    return;
+            }
+            this->metrics.record_command(cmd_id, start);
+            connection.update();
         }
     } catch (const IO::CommError& e) {
         /* if the client closed the connection nothing is done */
@@ -178,26 +1269,47 @@ void Server::Versioner::operator()(IO::Socket& client) {
 }
 
 /**
- * @brief Saves the index in a file.
+ * @brief Turns a client away when the server is overloaded, waiting at most
+ * REJECT_WAIT for its first command.
+ * A client that sends a `hello` asking for revision 8 or later gets `Busy`
+ * as its response. Any other one speaks revision 1, which can't tell that
+ * from the response to a command: its connection is closed without a
+ * reply, so it fails instead.
  *
- * @param file File to save the index to.
+ * @param client The newly connected client.
  */
-void Server::Versioner::save(std::ofstream& file) {
-    /* writes the files */
-    for (auto& pair : this->file_index) {
-        file << "f " << pair.first << " ";
-        for (const std::string& hash : pair.second) {
-            file << hash << " ";
+void Server::Versioner::reject(IO::Socket& client) {
+    try {
+        /* clients send their first command right after connecting */
+        struct pollfd readable = {client.get_fd(), POLLIN, 0};
+        if (poll(&readable, 1, REJECT_WAIT) != 1) {
+            return;
         }
-        file << ";" << std::endl;
-    }
-
-    /* writes the tags */
-    for (auto& pair : this->tag_index) {
-        file << "t " << pair.first << " ";
-        for (const std::string& hash : pair.second) {
-            file << hash << " ";
+        client.set_blocking(false);
+        uint8_t hello[5];
+        ssize_t bytes_read = client.try_read(hello, sizeof(hello));
+        if (bytes_read != sizeof(hello) || hello[0] != 0) {
+            return;
+        }
+        uint32_t version;
+        memcpy(&version, hello + 1, sizeof(version));
+        if (ntohl(version) < 8) {
+            return;
         }
-        file << ";" << std::endl;
+
+        client.set_blocking(true);
+        IO::CommSocket comm{std::move(client)};
+        comm << IO::Response::Busy;
+    } catch (const std::exception& e) {
+        /* the client is being dropped anyway */
     }
 }
+
+/**
+ * @brief Saves the index in a file, in the text format.
+ *
+ * @param file File to save the index to.
+ */
+void Server::Versioner::save(std::ofstream& file) {
+    Snapshot::write_text(file, this->file_index, this->tag_index);
+}
@@ -1,16 +1,45 @@
 #ifndef SERVER_VERSIONER_H_
 #define SERVER_VERSIONER_H_
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <thread>
+#include <vector>
 #include "common_comm_socket.h"
+#include "common_delta.h"
+#include "common_histogram.h"
+#include "common_rcu_map.h"
 #include "common_rw_lock.h"
 #include "common_socket.h"
+#include "server_delta.h"
 #include "server_file_index.h"
+#include "server_hash_table.h"
+#include "server_hasher.h"
+#include "server_metrics.h"
+#include "server_shard.h"
 #include "server_tag_index.h"
+#include "server_wal.h"
 
 namespace Server {
 class Versioner {
    public:
+    /** Outcome of `add_tag`. */
+    enum class TagResult { Added, Rejected, Waiting };
+
+    /** Signatures of the latest version of a file (see `signatures`). */
+    struct Signatures {
+        /** Hash of the version. */
+        std::string basis;
+        uint32_t block_size{0};
+        std::vector<Delta::BlockSignature> blocks;
+    };
+
     Versioner();
     explicit Versioner(Versioner&& other);
     explicit Versioner(const std::string& file_name);
@@ -18,20 +47,142 @@ class Versioner {
 
     Versioner& operator=(Versioner& other) = delete;
     void operator()(IO::Socket& client);
+    void reject(IO::Socket& client);
 
+    void hello(IO::Comm& comm);
     void push(IO::Comm& comm);
     void pull(IO::Comm& comm);
     void tag(IO::Comm& comm);
+    void have(IO::Comm& comm);
+    void manifest(IO::Comm& comm);
+    void fetch(IO::Comm& comm);
+    void compress(IO::Comm& comm);
+    void signatures(IO::Comm& comm);
+    void delta(IO::Comm& comm);
+    void stats(IO::Comm& comm);
+
+    /** push steps, for callers that receive the file body on their own */
+    bool push_begin(const std::string& file_name, const std::string& hash);
+    std::string staging_file(const std::string& hash) const;
+    std::unique_ptr<FileHasher> push_hasher(const std::string& hash) const;
+    bool push_commit(const std::string& file_name, const std::string& hash,
+                     FileHasher* hasher);
+    void push_abort(const std::string& file_name, const std::string& hash);
+    std::unique_ptr<DeltaWriter> delta_begin(const std::string& file_name,
+                                             const std::string& hash,
+                                             const std::string& basis,
+                                             uint32_t block_size);
+
+    /** signatures steps, for callers that can't block while hashing */
+    bool find_signatures(const std::string& file_name,
+                         Signatures& signatures);
+    static void send_signatures(IO::Comm& comm,
+                                const Signatures& signatures);
+
+    /** tag step, for callers that can't block until uploads finish */
+    TagResult add_tag(const std::string& name,
+                      const std::set<std::string>& hashes);
+    uint64_t get_staging_generation();
+
+    void set_verify(bool verify);
+    void set_compression(IO::Codec codec);
+    void set_checkpoint_interval(unsigned seconds);
+    void set_tag_timeout(unsigned seconds);
+    std::chrono::seconds get_tag_timeout() const;
+
+    Metrics& get_metrics();
 
     void save(std::ofstream& file);
 
    private:
-    FileIndex file_index;
-    TagIndex tag_index;
+    /** An entry published for the lock-free readers. */
+    template <class T>
+    struct Published {
+        T value;
+        /** Order in which it was published (see `published_count`). */
+        uint64_t position;
+    };
+
+    void replay(const std::string& wal_name);
+    void write_snapshot(const FileIndex& files, const TagIndex& tags);
+    void snapshot();
+    void copy_published(uint64_t cut, FileIndex& files, TagIndex& tags);
+    void checkpoint();
+    void checkpoint_loop(std::chrono::seconds interval);
+    void log(char type, const std::string& name,
+             const std::set<std::string>& hashes);
+    std::vector<std::string> tagged_files(const std::string& tag,
+                                          std::set<std::string>& hashes);
+    void publish();
+    void staging_changed();
+
+    /** Hashes of both indexes, stored once. */
+    HashTable hash_table;
+    FileIndex file_index{hash_table};
+    TagIndex tag_index{hash_table};
 
     std::string index_file_name;
 
-    Concurrency::RWLock lock;
+    /** Hashes whose upload is in progress, by shard. */
+    std::set<std::string> staging[NUM_SHARDS];
+
+    /** Whether pushed files must match their SHA-256 hash. */
+    bool verify{false};
+
+    /** Compression offered to the clients. */
+    IO::Codec compression{IO::Codec::None};
+
+    /**
+     * Counts the uploads that left `staging` (committed or aborted), so
+     * tags that wait for them know when to look again.
+     */
+    uint64_t staging_generation{0};
+    std::mutex staging_mutex;
+    std::condition_variable staging_cv;
+    /** Time a tag waits for those uploads before it is rejected. */
+    std::chrono::seconds tag_timeout{60};
+
+    /** A lock per shard of the indexes (and of `staging`). */
+    Concurrency::StripedLock locks{NUM_SHARDS};
+    /**
+     * The file name of each hash (by id, pointing at the name kept by
+     * `file_index`) and the hashes of each tag, for pulls: they are read
+     * without locks, as entries never change once added (tags can't be
+     * modified). Updated along with the indexes, under their locks.
+     * As entries are only added, the ones published before a given
+     * position are the indexes at that point, which checkpoints save.
+     */
+    Concurrency::RcuMap<Published<const std::string*>, HashId>
+        published_files;
+    Concurrency::RcuMap<Published<TagMembers>> published_tags;
+    /** Entries published so far. */
+    std::atomic<uint64_t> published_count{0};
+
+    /** Time waited for the locks, in us. */
+    Stats::Histogram lock_read_wait;
+    Stats::Histogram lock_write_wait;
+
+    /** Counters reported by `stats`. */
+    Metrics metrics;
+
+    /** Changes since the last snapshot (only if there is an index file). */
+    std::unique_ptr<WriteAheadLog> wal;
+    /**
+     * Held (shared) by writers from logging a change until it is published,
+     * and (exclusive) by checkpoints while they rotate the log, so every
+     * change in the old log is published before the rotation.
+     */
+    Concurrency::RWLock log_lock;
+
+    /** Background checkpoints (see `set_checkpoint_interval`). */
+    std::thread checkpointer;
+    std::mutex checkpoint_mutex;
+    std::condition_variable checkpoint_cv;
+    bool stopping{false};
+    /** Time writers wait while the log is rotated, in us. */
+    Stats::Histogram checkpoint_pause;
+    /** Time a checkpoint takes, in ms. */
+    Stats::Histogram checkpoint_duration;
 };
 }  // namespace Server
 
@@ -0,0 +1,179 @@
+#include "server_wal.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "common_error.h"
+
+/**
+ * @brief Makes the entries of the directory of a file durable, after the
+ * file was created, renamed or removed (syncing the file itself doesn't).
+ *
+ * @param file_name Name of the file.
+ */
+void Server::sync_directory(const std::string& file_name) {
+    std::size_t slash = file_name.find_last_of('/');
+    std::string directory = slash == std::string::npos
+                                ? "."
+                                : file_name.substr(0, slash + 1);
+    int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1 || fsync(fd) == -1) {
+        int error = errno;
+        if (fd != -1) {
+            close(fd);
+        }
+        throw Error::Error{"fsync %s: %s", directory.c_str(),
+                           strerror(error)};
+    }
+    close(fd);
+}
+
+/**
+ * @brief Opens the log, creating it if it doesn't exist. New records are
+ * appended after the existing ones.
+ *
+ * @param file_name Name of the log file.
+ */
+Server::WriteAheadLog::WriteAheadLog(const std::string& file_name)
+    : file_name(file_name) {
+    this->fd = open(file_name.c_str(),
+                    O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (this->fd == -1) {
+        throw Error::Error{"open %s: %s", file_name.c_str(), strerror(errno)};
+    }
+    /* records synced into a log that may have just been created would be
+     * lost along with its name */
+    try {
+        sync_directory(file_name);
+    } catch (...) {
+        close(this->fd);
+        throw;
+    }
+}
+
+Server::WriteAheadLog::~WriteAheadLog() {
+    close(this->fd);
+}
+
+/**
+ * @brief Appends a record and waits until it is on disk.
+ * The first writer that finds no sync in progress writes every pending
+ * record (its own and the ones appended by others meanwhile) and syncs
+ * them at once, while the rest wait for it.
+ *
+ * @param record Record, including its line break.
+ * @throw Error::Error if the log can't be written.
+ */
+void Server::WriteAheadLog::append(const std::string& record) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->pending += record;
+    uint64_t sequence = ++this->appended;
+
+    while (this->synced < sequence && this->error.empty()) {
+        if (this->syncing) {
+            this->synced_cv.wait(lock);
+            continue;
+        }
+
+        /* leads the next group */
+        this->syncing = true;
+        std::string group;
+        group.swap(this->pending);
+        uint64_t last = this->appended;
+        lock.unlock();
+
+        std::string error;
+        for (std::size_t done = 0; done < group.size() && error.empty();) {
+            ssize_t n = write(this->fd, group.data() + done,
+                              group.size() - done);
+            if (n <= 0) {
+                error = strerror(errno);
+            } else {
+                done += n;
+            }
+        }
+        if (error.empty() && fdatasync(this->fd) == -1) {
+            error = strerror(errno);
+        }
+
+        lock.lock();
+        this->syncing = false;
+        this->syncs++;
+        if (error.empty()) {
+            this->synced = last;
+        } else {
+            this->error = error;
+        }
+        this->synced_cv.notify_all();
+    }
+
+    if (this->synced < sequence) {
+        throw Error::Error{"%s: %s", this->file_name.c_str(),
+                           this->error.c_str()};
+    }
+}
+
+/**
+ * @brief Empties the log, once a snapshot holds every record in it.
+ * Must not be called while records are being appended.
+ */
+void Server::WriteAheadLog::truncate() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (ftruncate(this->fd, 0) == -1 || fdatasync(this->fd) == -1) {
+        throw Error::Error{"truncate %s: %s", this->file_name.c_str(),
+                           strerror(errno)};
+    }
+}
+
+/**
+ * @brief Moves the records logged so far to another file, and goes on
+ * logging into a new, empty one. Records appended but not written yet go
+ * to the new file.
+ *
+ * @param old_name Name to give to the current log.
+ * @throw Error::Error if the log can't be rotated (it is left as it was),
+ * or if the rotation can't be made durable (records go to the new file
+ * anyway).
+ */
+void Server::WriteAheadLog::rotate(const std::string& old_name) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    /* the group being written must land in the old file */
+    this->synced_cv.wait(lock, [this] { return !this->syncing; });
+
+    if (rename(this->file_name.c_str(), old_name.c_str()) == -1) {
+        throw Error::Error{"rename %s: %s", this->file_name.c_str(),
+                           strerror(errno)};
+    }
+    int fd = open(this->file_name.c_str(),
+                  O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        int error = errno;
+        rename(old_name.c_str(), this->file_name.c_str());
+        throw Error::Error{"open %s: %s", this->file_name.c_str(),
+                           strerror(error)};
+    }
+    close(this->fd);
+    this->fd = fd;
+
+    /* records synced into the new file need its name to be durable too */
+    sync_directory(this->file_name);
+}
+
+/**
+ * @brief Number of records appended.
+ */
+uint64_t Server::WriteAheadLog::get_records() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->appended;
+}
+
+/**
+ * @brief Number of syncs done (at most one per record, fewer when the
+ * records are grouped).
+ */
+uint64_t Server::WriteAheadLog::get_syncs() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->syncs;
+}
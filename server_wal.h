@@ -0,0 +1,58 @@
+#ifndef SERVER_WAL_H_
+#define SERVER_WAL_H_
+
+#include <cinttypes>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+
+namespace Server {
+void sync_directory(const std::string& file_name);
+
+/**
+ * @brief Append-only log of the changes to the index, so they survive a
+ * crash before the next snapshot.
+ * Appending blocks until the record is on disk. Records appended while a
+ * sync is in progress are written and synced together by the next one
+ * (group commit), so concurrent writers share the cost of `fdatasync`.
+ */
+class WriteAheadLog {
+   public:
+    explicit WriteAheadLog(const std::string& file_name);
+    ~WriteAheadLog();
+
+    WriteAheadLog(const WriteAheadLog& other) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog& other) = delete;
+
+    /** api */
+    void append(const std::string& record);
+    void truncate();
+    void rotate(const std::string& old_name);
+
+    /** query */
+    uint64_t get_records();
+    uint64_t get_syncs();
+
+   private:
+    std::string file_name;
+    int fd{-1};
+
+    /** Records appended but not written yet. */
+    std::string pending;
+    /** Number of records appended, and of those already on disk. */
+    uint64_t appended{0};
+    uint64_t synced{0};
+    /** Number of syncs done. */
+    uint64_t syncs{0};
+    /** Whether a thread is writing and syncing a group. */
+    bool syncing{false};
+    /** Error that broke the log, if any (no record is durable after it). */
+    std::string error;
+    /** Protects the attributes above. */
+    std::mutex mutex;
+    /** Signals the end of each sync. */
+    std::condition_variable synced_cv;
+};
+}  // namespace Server
+
+#endif
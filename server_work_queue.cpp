@@ -0,0 +1,72 @@
+#include "server_work_queue.h"
+#include <exception>
+#include <iostream>
+#include <utility>
+
+/**
+ * @brief Starts the threads.
+ *
+ * @param num_threads Number of threads (at least 1).
+ */
+Server::WorkQueue::WorkQueue(unsigned num_threads) {
+    if (num_threads == 0) {
+        num_threads = 1;
+    }
+    for (unsigned i = 0; i < num_threads; i++) {
+        this->threads.emplace_back(&WorkQueue::work, this);
+    }
+}
+
+/**
+ * @brief Runs the tasks still queued and stops the threads.
+ */
+Server::WorkQueue::~WorkQueue() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->cv.notify_all();
+    for (std::thread& thread : this->threads) {
+        thread.join();
+    }
+}
+
+/**
+ * @brief Queues a task to be run by the next free thread.
+ *
+ * @param task Task. It must report its own errors, an exception that
+ * escapes it is only logged.
+ */
+void Server::WorkQueue::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->tasks.push_back(std::move(task));
+    }
+    this->cv.notify_one();
+}
+
+/**
+ * @brief Thread body: runs tasks until the queue is destroyed and empty.
+ */
+void Server::WorkQueue::work() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->cv.wait(lock, [this] {
+                return this->stopping || !this->tasks.empty();
+            });
+            if (this->tasks.empty()) {
+                return;
+            }
+            task = std::move(this->tasks.front());
+            this->tasks.pop_front();
+        }
+
+        try {
+            task();
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+    }
+}
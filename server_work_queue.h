@@ -0,0 +1,46 @@
+#ifndef SERVER_WORK_QUEUE_H_
+#define SERVER_WORK_QUEUE_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Server {
+/**
+ * @brief Runs the work of the event loops that blocks (syncing the log,
+ * waiting for a hash) on its own threads, so a loop keeps serving its
+ * other sessions meanwhile. Tasks run in the order they were submitted,
+ * as many at once as there are threads, so their syncs are grouped (see
+ * WriteAheadLog).
+ */
+class WorkQueue {
+   public:
+    explicit WorkQueue(unsigned num_threads);
+    ~WorkQueue();
+
+    WorkQueue(const WorkQueue& other) = delete;
+    WorkQueue& operator=(const WorkQueue& other) = delete;
+
+    /** api */
+    void submit(std::function<void()> task);
+
+   private:
+    void work();
+
+    /** Tasks not started yet. */
+    std::deque<std::function<void()>> tasks;
+    /** Whether the queue is being destroyed. */
+    bool stopping{false};
+    /** Protects the attributes above. */
+    std::mutex mutex;
+    /** Signals new tasks (or the end of the queue). */
+    std::condition_variable cv;
+    /** Threads that run the tasks. */
+    std::vector<std::thread> threads;
+};
+}  // namespace Server
+
+#endif